@@ -0,0 +1,153 @@
+module;
+
+#define GLFW_INCLUDE_NONE
+#include "Try.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <imgui.h>
+#include <random>
+#include <stdexcept>
+
+export module scenes:animation;
+
+import moonstone;
+import :common;
+
+namespace
+{
+constexpr glm::uvec2 sprites_across{160, 90};
+constexpr float sprite_size = 8.0F;
+} // namespace
+
+export namespace moonstone::scenes
+{
+// A screen full of animated sprites. They never move, so each one keeps its
+// vertices on the GPU and a tick only rewrites the ones that changed frame.
+class animation : public moonstone::scene
+{
+	engine::world m_world;
+	engine::animation_library m_clips;
+	engine::retained_sprite_batch m_batch{
+		std::size_t{sprites_across.x} * sprites_across.y};
+	engine::camera m_camera;
+	renderer::asset_handle<renderer::shader> m_shader;
+	renderer::asset_handle<renderer::texture_array<256, 256>> m_textures;
+	renderer::renderer& m_renderer;
+	std::mt19937 m_random{99};
+	float m_speed{1.0F};
+	std::size_t m_changed{0};
+
+	// Every texture layer is a two by two sheet, one clip per layer at a
+	// different pace
+	void make_clips()
+	{
+		for (std::uint32_t layer = 0; layer < 3; ++layer)
+		{
+			this->m_clips.add(
+				{.frames = engine::slice_sheet({2, 2}, layer, 0, 4),
+				 .frame_duration = 0.1F + (0.1F * static_cast<float>(layer))});
+		}
+	}
+
+	error::result<> populate()
+	{
+		std::uniform_int_distribution<engine::clip_id> clip{0, 2};
+		std::uniform_int_distribution<std::uint32_t> frame{0, 3};
+		std::uniform_real_distribution<float> speed{0.5F, 2.0F};
+		for (std::uint32_t y = 0; y < sprites_across.y; ++y)
+		{
+			for (std::uint32_t x = 0; x < sprites_across.x; ++x)
+			{
+				const engine::animator state{.clip = clip(this->m_random),
+											 .frame = frame(this->m_random),
+											 .speed = speed(this->m_random)};
+				const auto look =
+					this->m_clips.get(state.clip).frames[state.frame];
+				const engine::transform where{
+					.position = glm::vec2{x, y} * sprite_size,
+					.size = glm::vec2{sprite_size}};
+				const auto slot = Try(this->m_batch.add(where, look));
+				this->m_world.create(
+					where, look, state, engine::sprite_slot{slot});
+			}
+		}
+		return {};
+	}
+
+	error::result<> create()
+	{
+		Try(this->populate());
+		return setup_sprite_shader(*this->m_shader);
+	}
+
+public:
+	static constexpr const char* s_name = "Animation";
+
+	static void preload(renderer::asset_cache& assets)
+	{
+		preload_sprite_assets(assets);
+	}
+
+	animation(renderer::renderer& renderer, renderer::asset_cache& assets) :
+		m_shader{assets.get_shader("shader.vert", "shader.frag")},
+		m_textures{get_sprite_textures(assets)},
+		m_renderer{renderer}
+	{
+		this->make_clips();
+		this->m_camera.set_position(glm::vec2{sprites_across} * sprite_size *
+									0.5F);
+		auto err = this->create();
+		if (!err.has_value())
+		{
+			throw std::runtime_error(err.error().format());
+		}
+	}
+	~animation() override = default;
+
+	error::result<> on_update(float delta_time) override
+	{
+		this->m_changed =
+			engine::update_animations(this->m_world,
+									  this->m_clips,
+									  delta_time * this->m_speed,
+									  this->m_batch);
+		return {};
+	}
+
+	error::result<> on_render(float alpha) override
+	{
+		Try(this->m_textures->bind());
+		for (std::uint32_t layer = 0; layer < 3; ++layer)
+		{
+			this->m_textures->mark_layer_used(layer);
+		}
+		Try(this->m_camera.apply(this->m_renderer));
+		Try(this->m_renderer.push_draw_block(draw_block{}));
+		Try(this->m_batch.upload());
+		Try(this->m_batch.draw(*this->m_shader));
+		return {};
+	}
+
+	error::result<> on_imgui_render() override
+	{
+		ImGui::Text("%zu of %zu sprites changed frame",
+					this->m_changed,
+					this->m_batch.size());
+		ImGui::Text("%zu sprites uploaded", this->m_batch.uploaded());
+		ImGui::SliderFloat("Speed", &this->m_speed, 0.0F, 4.0F);
+		return {};
+	}
+
+	[[nodiscard]] const char* get_name() const override
+	{
+		return s_name;
+	}
+
+	animation(const animation&) = delete;
+	animation(animation&&) = delete;
+	animation& operator=(const animation&) = delete;
+	animation& operator=(animation&&) = delete;
+};
+} // namespace moonstone::scenes
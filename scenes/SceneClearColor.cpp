@@ -18,6 +18,8 @@ class clear_color : public scene
 	std::array<float, 4> m_clear_color;
 
 public:
+	static constexpr const char* s_name = "Clear color.";
+
 	clear_color() : m_clear_color{1.0F, 0.8F, 0.8F, 1.0F} {};
 	explicit clear_color(std::array<float, 4> m_clear_color) :
 		m_clear_color(m_clear_color)
@@ -29,7 +31,7 @@ public:
 	{
 		return {};
 	};
-	error::result<> on_render() override
+	error::result<> on_render(float alpha) override
 	{
 		Try(renderer::gl().call(glClearColor,
 								m_clear_color[0],
@@ -46,7 +48,7 @@ public:
 	}
 	[[nodiscard]] const char* get_name() const override
 	{
-		return "Clear color.";
+		return s_name;
 	};
 };
 } // namespace moonstone::scenes
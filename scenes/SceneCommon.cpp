@@ -0,0 +1,45 @@
+module;
+
+#include <glm/glm.hpp>
+
+export module scenes:common;
+
+import moonstone;
+
+// Shared by the scenes, not exported past the scenes module
+namespace moonstone::scenes
+{
+// std140, matches `draw_block` in shader.vert and particle.vert
+struct draw_block
+{
+	glm::mat4 model{1.0F};
+};
+
+// shader.frag samples the texture array bound to unit 1
+error::result<> setup_sprite_shader(renderer::shader& shader)
+{
+	return shader.setUniformInt1("u_textureArray", 1);
+}
+
+// The texture array the texture, sprites, tilemap and animation scenes draw
+// from
+void preload_sprite_textures(renderer::asset_cache& assets)
+{
+	assets.preload_texture_array<256, 256>(
+		{"texarr1.png", "texarr2.png", "texarr3.png"});
+}
+
+auto get_sprite_textures(renderer::asset_cache& assets)
+	-> renderer::asset_handle<renderer::texture_array<256, 256>>
+{
+	return assets.get_texture_array<256, 256>(
+		{"texarr1.png", "texarr2.png", "texarr3.png"});
+}
+
+// Runs on a worker before the scene is opened, see scene_registry
+void preload_sprite_assets(renderer::asset_cache& assets)
+{
+	preload_sprite_textures(assets);
+	assets.preload_shader("shader.vert", "shader.frag");
+}
+} // namespace moonstone::scenes
@@ -0,0 +1,131 @@
+module;
+
+#define GLFW_INCLUDE_NONE
+#include "Try.hpp"
+#include <cmath>
+#include <cstddef>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <imgui.h>
+#include <numbers>
+#include <random>
+#include <stdexcept>
+
+export module scenes:particles;
+
+import moonstone;
+import :common;
+
+namespace
+{
+constexpr std::size_t particle_capacity = 256UZ * 1024;
+} // namespace
+
+export namespace moonstone::scenes
+{
+// A fountain of up to a quarter million particles, simulated on the job
+// system and drawn in one instanced call
+class particles : public moonstone::scene
+{
+	engine::particle_system m_particles{
+		particle_capacity,
+		{.start_colour = {1.0F, 0.8F, 0.3F, 1.0F},
+		 .end_colour = {0.9F, 0.1F, 0.4F, 0.0F},
+		 .start_size = 6.0F,
+		 .end_size = 1.0F}};
+	engine::camera m_camera;
+	renderer::asset_handle<renderer::shader> m_shader;
+	renderer::renderer& m_renderer;
+	std::mt19937 m_random{2024};
+	float m_rate{60000.0F};
+	// Fractions of a particle left over from the last update
+	float m_pending{0.0F};
+
+	void emit(std::size_t amount)
+	{
+		std::uniform_real_distribution<float> angle{
+			std::numbers::pi_v<float> * 0.35F,
+			std::numbers::pi_v<float> * 0.65F};
+		std::uniform_real_distribution<float> speed{150.0F, 450.0F};
+		std::uniform_real_distribution<float> lifetime{1.5F, 4.0F};
+		for (std::size_t i = 0; i < amount; ++i)
+		{
+			const auto direction = angle(this->m_random);
+			const auto magnitude = speed(this->m_random);
+			const engine::particle_spawn spawn{
+				.position = {0.0F, -250.0F},
+				.velocity = glm::vec2{std::cos(direction),
+									  std::sin(direction)} *
+							magnitude,
+				.lifetime = lifetime(this->m_random)};
+			if (!this->m_particles.emit(spawn))
+			{
+				return;
+			}
+		}
+	}
+
+public:
+	static constexpr const char* s_name = "Particles";
+
+	static void preload(renderer::asset_cache& assets)
+	{
+		assets.preload_shader("particle.vert", "particle.frag");
+	}
+
+	particles(renderer::renderer& renderer, renderer::asset_cache& assets) :
+		m_shader{assets.get_shader("particle.vert", "particle.frag")},
+		m_renderer{renderer}
+	{
+	}
+	~particles() override = default;
+
+	error::result<> on_update(float delta_time) override
+	{
+		this->m_pending += this->m_rate * delta_time;
+		const auto whole = std::floor(this->m_pending);
+		this->m_pending -= whole;
+		this->emit(static_cast<std::size_t>(whole));
+		this->m_particles.update(delta_time);
+		return {};
+	}
+
+	error::result<> on_render(float alpha) override
+	{
+		Try(this->m_camera.apply(this->m_renderer));
+		Try(this->m_renderer.push_draw_block(draw_block{}));
+		Try(this->m_particles.draw(*this->m_shader, alpha));
+		return {};
+	}
+
+	error::result<> on_imgui_render() override
+	{
+		const auto stats = this->m_particles.get_stats();
+		ImGui::Text("%zu of %zu particles", stats.alive, stats.capacity);
+		ImGui::SliderFloat(
+			"Per second", &this->m_rate, 0.0F, 200000.0F, "%.0f");
+		auto& gravity = this->m_particles.settings().gravity;
+		ImGui::SliderFloat2("Gravity", &gravity.x, -400.0F, 400.0F);
+		if (ImGui::Button("Burst"))
+		{
+			this->emit(20000);
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Clear"))
+		{
+			this->m_particles.clear();
+		}
+		return {};
+	}
+
+	[[nodiscard]] const char* get_name() const override
+	{
+		return s_name;
+	}
+
+	particles(const particles&) = delete;
+	particles(particles&&) = delete;
+	particles& operator=(const particles&) = delete;
+	particles& operator=(particles&&) = delete;
+};
+} // namespace moonstone::scenes
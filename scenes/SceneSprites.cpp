@@ -0,0 +1,276 @@
+module;
+
+#define GLFW_INCLUDE_NONE
+#include "Try.hpp"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <imgui.h>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+export module scenes:sprites;
+
+import moonstone;
+import :common;
+
+namespace
+{
+// The update moves `current`, the transform that gets drawn is placed
+// between `previous` and `current` by the render alpha
+struct motion
+{
+	glm::vec2 velocity{0.0F, 0.0F};
+	glm::vec2 previous{0.0F, 0.0F};
+	glm::vec2 current{0.0F, 0.0F};
+};
+
+// Five screens across, only the part under the cameras is drawn
+constexpr float world_size = 4000.0F;
+} // namespace
+
+export namespace moonstone::scenes
+{
+// Thousands of bouncing sprites in one draw, the ECS counterpart of the
+// texture scene. The world is larger than the screen, a spatial grid picks
+// out the sprites under the camera and the optional minimap.
+class sprites : public moonstone::scene
+{
+	engine::world m_world;
+	// One per group of overlapping cameras, see engine::group_views
+	std::array<engine::sprite_batch, 2> m_batches{engine::sprite_batch{20000},
+												  engine::sprite_batch{20000}};
+	engine::camera m_camera;
+	engine::camera m_minimap{
+		{.origin = {0.74F, 0.74F}, .size = {0.25F, 0.25F}}};
+	engine::sprite_grid m_grid{{{0.0F, 0.0F}, {world_size, world_size}},
+							   128.0F};
+	std::vector<engine::entity> m_entities;
+	renderer::asset_handle<renderer::shader> m_shader;
+	renderer::asset_handle<renderer::texture_array<256, 256>> m_textures;
+	renderer::renderer& m_renderer;
+	std::mt19937 m_random{1234};
+	int m_spawn_count{1000};
+	bool m_cull{true};
+	bool m_show_minimap{false};
+	std::size_t m_drawn{0};
+
+	void spawn(std::size_t amount)
+	{
+		std::uniform_real_distribution<float> position{0.0F, world_size};
+		std::uniform_real_distribution<float> speed{-150.0F, 150.0F};
+		std::uniform_real_distribution<float> size{8.0F, 32.0F};
+		std::uniform_int_distribution<std::uint32_t> layer{0, 2};
+		this->m_entities.reserve(this->m_entities.size() + amount);
+		for (std::size_t i = 0; i < amount; ++i)
+		{
+			const auto side = size(this->m_random);
+			const engine::transform where{
+				.position = {position(this->m_random),
+							 position(this->m_random)},
+				.size = {side, side},
+				.anchor = {0.5F, 0.5F}};
+			const auto created = this->m_world.create(
+				where,
+				engine::sprite{.layer = layer(this->m_random)},
+				motion{.velocity = {speed(this->m_random),
+									speed(this->m_random)},
+					   .previous = where.position,
+					   .current = where.position},
+				engine::culling_proxy{});
+			this->m_world.get<engine::culling_proxy>(created)->id =
+				this->m_grid.insert(engine::bounds_of(where), created);
+			this->m_entities.push_back(created);
+		}
+	}
+
+	void despawn(std::size_t amount)
+	{
+		for (std::size_t i = 0; i < amount && !this->m_entities.empty(); ++i)
+		{
+			const auto target = this->m_entities.back();
+			this->m_grid.remove(
+				this->m_world.get<engine::culling_proxy>(target)->id);
+			this->m_world.destroy(target);
+			this->m_entities.pop_back();
+		}
+	}
+
+public:
+	static constexpr const char* s_name = "Sprites (ECS)";
+
+	static void preload(renderer::asset_cache& assets)
+	{
+		preload_sprite_assets(assets);
+	}
+
+	sprites(renderer::renderer& renderer, renderer::asset_cache& assets) :
+		m_shader{assets.get_shader("shader.vert", "shader.frag")},
+		m_textures{get_sprite_textures(assets)},
+		m_renderer{renderer}
+	{
+		this->m_camera.set_position({400.0F, 400.0F});
+		this->m_minimap.set_position(glm::vec2{world_size * 0.5F});
+		this->spawn(40000);
+		auto err = setup_sprite_shader(*this->m_shader);
+		if (!err.has_value())
+		{
+			throw std::runtime_error(err.error().format());
+		}
+	}
+	~sprites() override = default;
+
+	error::result<> on_update(float delta_time) override
+	{
+		this->m_world.each_chunk_parallel<motion>(
+			jobs(),
+			[delta_time](std::span<const engine::entity> /*owners*/,
+						 std::span<motion> motions) {
+				for (auto& moving : motions)
+				{
+					moving.previous = moving.current;
+					moving.current += moving.velocity * delta_time;
+					for (int axis = 0; axis < 2; ++axis)
+					{
+						if (moving.current[axis] < 0.0F ||
+							moving.current[axis] > world_size)
+						{
+							moving.velocity[axis] = -moving.velocity[axis];
+							moving.current[axis] = glm::clamp(
+								moving.current[axis], 0.0F, world_size);
+						}
+					}
+				}
+			});
+		return {};
+	}
+
+	error::result<> on_render(float alpha) override
+	{
+		const glm::vec2 framebuffer{this->m_renderer.get_framebuffer_size()};
+		const std::array<engine::camera*, 2> cameras{&this->m_camera,
+													 &this->m_minimap};
+		const std::size_t used = this->m_show_minimap ? 2 : 1;
+		if (framebuffer.x <= 0.0F || framebuffer.y <= 0.0F)
+		{
+			// Minimized, every camera would be empty
+			return {};
+		}
+		// Where the sprites are between the last two updates, the grid
+		// culls by the same positions that get drawn
+		this->m_world.each_chunk_parallel<engine::transform, motion>(
+			jobs(),
+			[alpha](std::span<const engine::entity> /*owners*/,
+					std::span<engine::transform> transforms,
+					std::span<const motion> motions) {
+				for (std::size_t i = 0; i < motions.size(); ++i)
+				{
+					transforms[i].position = glm::mix(
+						motions[i].previous, motions[i].current, alpha);
+				}
+			});
+		engine::sync_sprite_grid(this->m_world, this->m_grid);
+		// The whole world fits the minimap whatever the window size
+		const auto minimap_pixels =
+			this->m_minimap.get_viewport().size * framebuffer;
+		this->m_minimap.set_zoom(std::min(minimap_pixels.x, minimap_pixels.y) /
+								 world_size);
+		std::array<engine::aabb, 2> views{};
+		for (std::size_t i = 0; i < used; ++i)
+		{
+			cameras.at(i)->set_framebuffer(framebuffer);
+			views.at(i) = cameras.at(i)->visible_bounds();
+		}
+		auto groups = engine::group_views(std::span{views}.first(used));
+		if (!this->m_cull)
+		{
+			groups.assign(1, {.cameras = (1U << used) - 1});
+		}
+
+		Try(this->m_textures->bind());
+		for (std::uint32_t layer = 0; layer < 3; ++layer)
+		{
+			this->m_textures->mark_layer_used(layer);
+		}
+		this->m_drawn = 0;
+		for (std::size_t group = 0; group < groups.size(); ++group)
+		{
+			auto& batch = this->m_batches.at(group);
+			if (this->m_cull)
+			{
+				engine::build_sprite_batch(
+					this->m_world, batch, this->m_grid, groups[group].bounds);
+			}
+			else
+			{
+				engine::build_sprite_batch(this->m_world, batch);
+			}
+			this->m_drawn += batch.size();
+			Try(batch.upload());
+			for (std::size_t i = 0; i < used; ++i)
+			{
+				if ((groups[group].cameras & (1U << i)) == 0)
+				{
+					continue;
+				}
+				Try(cameras.at(i)->apply(this->m_renderer));
+				Try(this->m_renderer.push_draw_block(draw_block{}));
+				Try(batch.draw(*this->m_shader));
+			}
+		}
+		return {};
+	}
+
+	error::result<> on_imgui_render() override
+	{
+		ImGui::Text("%zu entities in %zu archetypes",
+					this->m_world.size(),
+					this->m_world.archetype_count());
+		ImGui::Text("%zu drawn", this->m_drawn);
+		auto position = this->m_camera.get_position();
+		auto zoom = this->m_camera.get_zoom();
+		auto rotation = this->m_camera.get_rotation();
+		if (ImGui::SliderFloat2("Camera", &position.x, 0.0F, world_size))
+		{
+			this->m_camera.set_position(position);
+		}
+		if (ImGui::SliderFloat("Zoom", &zoom, 0.25F, 4.0F))
+		{
+			this->m_camera.set_zoom(zoom);
+		}
+		if (ImGui::SliderAngle("Rotation", &rotation))
+		{
+			this->m_camera.set_rotation(rotation);
+		}
+		ImGui::Checkbox("Cull", &this->m_cull);
+		ImGui::SameLine();
+		ImGui::Checkbox("Minimap", &this->m_show_minimap);
+		ImGui::SliderInt("Amount", &this->m_spawn_count, 1, 10000);
+		if (ImGui::Button("Spawn"))
+		{
+			this->spawn(static_cast<std::size_t>(this->m_spawn_count));
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Despawn"))
+		{
+			this->despawn(static_cast<std::size_t>(this->m_spawn_count));
+		}
+		return {};
+	}
+
+	[[nodiscard]] const char* get_name() const override
+	{
+		return s_name;
+	}
+
+	sprites(const sprites&) = delete;
+	sprites(sprites&&) = delete;
+	sprites& operator=(const sprites&) = delete;
+	sprites& operator=(sprites&&) = delete;
+};
+} // namespace moonstone::scenes
@@ -0,0 +1,105 @@
+module;
+
+#define GLFW_INCLUDE_NONE
+#include "Try.hpp"
+#include <array>
+#include <format>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <imgui.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+export module scenes:text;
+
+import moonstone;
+import :common;
+
+namespace
+{
+constexpr std::string_view font_path = "fonts/default.ttf";
+} // namespace
+
+export namespace moonstone::scenes
+{
+// Text drawn by the engine instead of ImGui. The labels only upload when
+// they're edited, the frame counter is laid out into a batch every frame.
+class text : public moonstone::scene
+{
+	engine::font m_font{std::string{font_path}, 32.0F};
+	engine::text_label m_title{m_font, "Moonstone", {40.0F, 700.0F}, 2.0F};
+	engine::text_label m_editable{m_font, "Edit me", {40.0F, 560.0F}};
+	engine::sprite_batch m_dynamic{64};
+	engine::camera m_camera;
+	renderer::asset_handle<renderer::shader> m_shader;
+	renderer::renderer& m_renderer;
+	std::array<char, 256> m_input{"Edit me"};
+
+public:
+	static constexpr const char* s_name = "Text";
+
+	static void preload(renderer::asset_cache& assets)
+	{
+		assets.preload_shader("shader.vert", "shader.frag");
+	}
+
+	text(renderer::renderer& renderer, renderer::asset_cache& assets) :
+		m_shader{assets.get_shader("shader.vert", "shader.frag")},
+		m_renderer{renderer}
+	{
+		auto err = setup_sprite_shader(*this->m_shader);
+		if (!err.has_value())
+		{
+			throw std::runtime_error(err.error().format());
+		}
+	}
+	~text() override = default;
+
+	error::result<> on_update(float delta_time) override
+	{
+		return {};
+	}
+
+	error::result<> on_render(float alpha) override
+	{
+		// World units are pixels with the origin in the bottom left corner
+		this->m_camera.set_position(
+			glm::vec2{this->m_renderer.get_framebuffer_size()} * 0.5F);
+		Try(this->m_camera.apply(this->m_renderer));
+		Try(this->m_renderer.push_draw_block(draw_block{}));
+		Try(this->m_title.draw(*this->m_shader));
+		Try(this->m_editable.draw(*this->m_shader));
+
+		this->m_dynamic.clear();
+		Try(this->m_font.append(
+			this->m_dynamic,
+			std::format("{:.0f} fps", ImGui::GetIO().Framerate),
+			{40.0F, 620.0F}));
+		Try(this->m_dynamic.upload());
+		Try(this->m_font.bind());
+		Try(this->m_dynamic.draw(*this->m_shader));
+		return {};
+	}
+
+	error::result<> on_imgui_render() override
+	{
+		if (ImGui::InputTextMultiline(
+				"Label", this->m_input.data(), this->m_input.size()))
+		{
+			this->m_editable.set_text(this->m_input.data());
+		}
+		return {};
+	}
+
+	[[nodiscard]] const char* get_name() const override
+	{
+		return s_name;
+	}
+
+	text(const text&) = delete;
+	text(text&&) = delete;
+	text& operator=(const text&) = delete;
+	text& operator=(text&&) = delete;
+};
+} // namespace moonstone::scenes
@@ -3,11 +3,10 @@ module;
 #define GLFW_INCLUDE_NONE
 #include "Try.hpp"
 #include <glad/glad.h>
-#include <glm/ext/matrix_clip_space.hpp>
-#include <glm/ext/matrix_transform.hpp>
 #include <glm/ext/vector_float2.hpp>
 #include <glm/glm.hpp>
 #include <imgui.h>
+#include <memory>
 #include <print>
 #include <stdexcept>
 #include <string>
@@ -15,10 +14,7 @@ module;
 export module scenes:texture;
 
 import moonstone;
-
-constexpr glm::mat4 view = glm::translate(glm::mat4{1.0F}, glm::vec3(0, 0, 0));
-static const glm::mat4 projection =
-	glm::ortho(0.0F, 800.0F, 0.0F, 800.0F, -1.0F, 1.0F);
+import :common;
 
 export namespace moonstone::scenes
 {
@@ -29,9 +25,10 @@ class texture : public moonstone::scene
 	renderer::vertex_buffer<renderer::vertex_element, 4UL> vbo;
 	renderer::buffer_layout blo;
 	moonstone::engine::quad quad1, quad2, quad3;
-	renderer::shader shader;
-	renderer::texture_array<256, 256> tex_arr;
+	renderer::asset_handle<renderer::shader> shader;
+	renderer::asset_handle<renderer::texture_array<256, 256>> tex_arr;
 	renderer::renderer& renderer;
+	moonstone::engine::camera view_camera;
 	glm::vec2 new_pos1{}, new_pos2{}, new_pos3{};
 
 	error::result<> create()
@@ -39,14 +36,12 @@ class texture : public moonstone::scene
 		Try(vao.add_buffer(vbo, blo));
 		Try(vao.bind());
 		Try(ibo.bind());
-		Try(shader.bind());
-		Try(tex_arr.bind());
+		Try(tex_arr->bind());
 
-		Try(shader.setUniformInt1("u_textureArray", 1));
+		Try(setup_sprite_shader(*shader));
 
 		Try(moonstone::renderer::vertex_array::unbind());
 		Try(ibo.unbind());
-		Try(shader.unbind());
 		return {};
 	}
 
@@ -55,18 +50,48 @@ class texture : public moonstone::scene
 		Try(moonstone::renderer::vertex_array::unbind());
 		Try(this->vbo.unbind());
 		Try(ibo.unbind());
-		Try(shader.unbind());
+		Try(shader->unbind());
 		return {};
 	}
 
+	static auto decode_textures(renderer::asset_cache& assets) -> task<>
+	{
+		co_await on_workers();
+		preload_sprite_textures(assets);
+	}
+
+	static auto prepare_shader(renderer::asset_cache& assets) -> task<>
+	{
+		co_await on_workers();
+		assets.preload_shader("shader.vert", "shader.frag");
+	}
+
 public:
-	explicit texture(renderer::renderer& renderer) :
+	static constexpr const char* s_name = "Texture";
+
+	static void preload(renderer::asset_cache& assets)
+	{
+		preload_sprite_assets(assets);
+	}
+
+	// Decodes the textures and prepares the shader in parallel on the
+	// workers, only the GL objects are made on the render thread
+	static auto load(renderer::renderer& renderer,
+					 renderer::asset_cache& assets)
+		-> task<std::unique_ptr<moonstone::scene>>
+	{
+		co_await when_all(decode_textures(assets), prepare_shader(assets));
+		co_await on_render_thread();
+		co_return std::make_unique<texture>(renderer, assets);
+	}
+
+	texture(renderer::renderer& renderer, renderer::asset_cache& assets) :
 		quad1{{}, {200.0F, 200.0F}, {0.0F, 0.0F}, 2, this->vbo.connect(), ibo},
 		quad2{{}, {50.0F, 50.0F}, {0.5F, 0.5F}, 0, this->vbo.connect(), ibo},
 		quad3{{}, {300.0F, 300.0F}, {0.0F, 0.0F}, 1, this->vbo.connect(), ibo},
-		tex_arr({"texarr1.png", "texarr2.png", "texarr3.png"}),
+		tex_arr(get_sprite_textures(assets)),
 		renderer(renderer),
-		shader{"shader.vert", "shader.frag"}
+		shader{assets.get_shader("shader.vert", "shader.frag")}
 	{
 		error::init();
 		renderer::vertex_element::register_layout(blo);
@@ -81,17 +106,19 @@ public:
 	{
 		return {};
 	}
-	error::result<> on_render() override
+	error::result<> on_render(float alpha) override
 	{
-		Try(shader.bind());
-		glm::mat4 model = glm::mat4{1.0F};
-		glm::mat4 mvp = projection * view * model;
-		auto err = shader.setUniformMatf4("u_model_view_projection", mvp);
-		if (!err.has_value())
-		{
-			std::println(stderr, "{}", err.error().format());
-		}
-		Try(renderer.draw(vao, ibo, shader));
+		Try(shader->bind());
+		Try(tex_arr->bind());
+		tex_arr->mark_layer_used(0);
+		tex_arr->mark_layer_used(1);
+		tex_arr->mark_layer_used(2);
+		// Keeps the world origin in the bottom left corner, one unit a pixel
+		this->view_camera.set_position(
+			glm::vec2{renderer.get_framebuffer_size()} * 0.5F);
+		Try(this->view_camera.apply(renderer));
+		Try(renderer.push_draw_block(draw_block{}));
+		Try(renderer.draw(vao, ibo, *shader));
 		return {};
 	};
 	error::result<> on_imgui_render() override
@@ -107,7 +134,7 @@ public:
 	}
 	[[nodiscard]] const char* get_name() const override
 	{
-		return "Texture";
+		return s_name;
 	}
 	texture(const texture&) = delete;
 	texture(texture&&) = delete;
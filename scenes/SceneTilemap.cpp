@@ -0,0 +1,170 @@
+module;
+
+#define GLFW_INCLUDE_NONE
+#include "Try.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <imgui.h>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+export module scenes:tilemap;
+
+import moonstone;
+import :common;
+
+namespace
+{
+constexpr glm::uvec2 map_size{1000, 1000};
+constexpr float tile_size = 16.0F;
+
+// Every quarter of every texture layer is a tile kind
+auto make_tileset() -> std::vector<moonstone::engine::sprite>
+{
+	std::vector<moonstone::engine::sprite> tileset;
+	for (std::uint32_t layer = 0; layer < 3; ++layer)
+	{
+		for (const glm::vec2 corner :
+			 {glm::vec2{0.0F, 0.0F},
+			  glm::vec2{0.5F, 0.0F},
+			  glm::vec2{0.0F, 0.5F},
+			  glm::vec2{0.5F, 0.5F}})
+		{
+			tileset.push_back({.uv_rect = {corner, corner + 0.5F},
+							   .layer = layer});
+		}
+	}
+	return tileset;
+}
+} // namespace
+
+export namespace moonstone::scenes
+{
+// A million tiles, drawn a chunk at a time and only where the camera looks
+class tilemap : public moonstone::scene
+{
+	engine::tilemap m_map{map_size, tile_size, make_tileset()};
+	engine::camera m_camera;
+	renderer::asset_handle<renderer::shader> m_shader;
+	renderer::asset_handle<renderer::texture_array<256, 256>> m_textures;
+	renderer::renderer& m_renderer;
+	std::mt19937 m_random{4321};
+	int m_edits_per_update{0};
+
+	void generate()
+	{
+		for (std::uint32_t y = 0; y < map_size.y; ++y)
+		{
+			for (std::uint32_t x = 0; x < map_size.x; ++x)
+			{
+				// Bands of kinds with a few holes, nothing clever
+				const auto kind = ((x / 7) + (y / 5) + ((x * y) % 3)) % 12;
+				const bool hole = (x ^ y) % 11 == 0;
+				this->m_map.set({x, y},
+								hole ? engine::tile{0}
+									 : static_cast<engine::tile>(kind + 1));
+			}
+		}
+	}
+
+	// Repaints random tiles in view, each only rewrites its own vertices
+	void edit_visible(std::size_t amount)
+	{
+		const auto view = this->m_camera.visible_bounds();
+		const auto low = glm::max(view.min / tile_size, glm::vec2{0.0F});
+		const auto high = glm::min(view.max / tile_size,
+								   glm::vec2{map_size} - 1.0F);
+		if (low.x > high.x || low.y > high.y)
+		{
+			return;
+		}
+		std::uniform_real_distribution<float> x{low.x, high.x};
+		std::uniform_real_distribution<float> y{low.y, high.y};
+		std::uniform_int_distribution<engine::tile> kind{0, 12};
+		for (std::size_t i = 0; i < amount; ++i)
+		{
+			this->m_map.set(glm::uvec2{glm::vec2{x(this->m_random),
+												 y(this->m_random)}},
+							kind(this->m_random));
+		}
+	}
+
+public:
+	static constexpr const char* s_name = "Tilemap";
+
+	static void preload(renderer::asset_cache& assets)
+	{
+		preload_sprite_assets(assets);
+	}
+
+	tilemap(renderer::renderer& renderer, renderer::asset_cache& assets) :
+		m_shader{assets.get_shader("shader.vert", "shader.frag")},
+		m_textures{get_sprite_textures(assets)},
+		m_renderer{renderer}
+	{
+		this->generate();
+		this->m_camera.set_position({400.0F, 400.0F});
+		auto err = setup_sprite_shader(*this->m_shader);
+		if (!err.has_value())
+		{
+			throw std::runtime_error(err.error().format());
+		}
+	}
+	~tilemap() override = default;
+
+	error::result<> on_update(float delta_time) override
+	{
+		this->edit_visible(static_cast<std::size_t>(this->m_edits_per_update));
+		return {};
+	}
+
+	error::result<> on_render(float alpha) override
+	{
+		Try(this->m_textures->bind());
+		for (std::uint32_t layer = 0; layer < 3; ++layer)
+		{
+			this->m_textures->mark_layer_used(layer);
+		}
+		Try(this->m_camera.apply(this->m_renderer));
+		Try(this->m_renderer.push_draw_block(draw_block{}));
+		Try(this->m_map.draw(this->m_camera.visible_bounds(), *this->m_shader));
+		return {};
+	}
+
+	error::result<> on_imgui_render() override
+	{
+		const auto stats = this->m_map.get_stats();
+		ImGui::Text("%zu visible, %zu resident of %zu chunks",
+					stats.visible_chunks,
+					stats.resident_chunks,
+					stats.total_chunks);
+		auto position = this->m_camera.get_position();
+		auto zoom = this->m_camera.get_zoom();
+		const auto world = glm::vec2{map_size} * tile_size;
+		if (ImGui::SliderFloat2("Camera", &position.x, 0.0F, world.x))
+		{
+			this->m_camera.set_position(position);
+		}
+		if (ImGui::SliderFloat("Zoom", &zoom, 0.25F, 4.0F))
+		{
+			this->m_camera.set_zoom(zoom);
+		}
+		ImGui::SliderInt(
+			"Edits per update", &this->m_edits_per_update, 0, 1000);
+		return {};
+	}
+
+	[[nodiscard]] const char* get_name() const override
+	{
+		return s_name;
+	}
+
+	tilemap(const tilemap&) = delete;
+	tilemap(tilemap&&) = delete;
+	tilemap& operator=(const tilemap&) = delete;
+	tilemap& operator=(tilemap&&) = delete;
+};
+} // namespace moonstone::scenes
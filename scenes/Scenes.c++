@@ -1,4 +1,10 @@
 export module scenes;
 
+export import :common;
 export import :texture;
 export import :clear_color;
+export import :sprites;
+export import :tilemap;
+export import :text;
+export import :particles;
+export import :animation;
@@ -0,0 +1,9 @@
+// Shared by every program, filled by the renderer once per frame
+layout(std140, binding = 0) uniform frame_globals
+{
+    mat4 u_view;
+    mat4 u_projection;
+    mat4 u_view_projection;
+    vec4 u_viewport;
+    vec4 u_time;
+};
@@ -0,0 +1,19 @@
+#version 460 core
+
+// Permutations:
+//   PREMULTIPLIED  for windows blending with GL_ONE, scales rgb by alpha
+
+layout(location = 0) out vec4 color;
+
+layout(location = 0) in vec2 v_corner;
+layout(location = 1) in vec4 v_tint;
+
+void main()
+{
+    // Soft disc, fully transparent at the quad's inscribed circle
+    float falloff = clamp(1.0 - length(v_corner) * 2.0, 0.0, 1.0);
+    color = vec4(v_tint.rgb, v_tint.a * falloff);
+#ifdef PREMULTIPLIED
+    color.rgb *= color.a;
+#endif
+}
@@ -0,0 +1,26 @@
+#version 460 core
+
+// Per vertex, a corner of the unit quad centered on the origin
+layout(location = 0) in vec2 corner;
+// Per instance
+layout(location = 1) in vec2 center;
+layout(location = 2) in float size;
+layout(location = 3) in vec4 tint;
+
+layout(location = 0) out vec2 v_corner;
+layout(location = 1) out vec4 v_tint;
+
+#include "frame_globals.glsl"
+
+layout(std140, binding = 1) uniform draw_block
+{
+    mat4 u_model;
+};
+
+void main()
+{
+    gl_Position = u_view_projection * u_model *
+                  vec4(center + corner * size, 0.0, 1.0);
+    v_corner = corner;
+    v_tint = tint;
+}
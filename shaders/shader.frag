@@ -1,5 +1,9 @@
 #version 460 core
 
+// Permutations:
+//   SINGLE_LAYER <n>  every draw samples layer n, the coordinate's z is unused
+//   NO_ALPHA          opaque output, skips blending the texel's alpha
+
 layout(location = 0) out vec4 color;
 
 uniform sampler2D u_texture;
@@ -9,5 +13,15 @@ layout(location = 0) in vec3 v_texture_coordinate;
 
 void main()
 {
-    color = vec4(texture(u_textureArray, v_texture_coordinate));
+#ifdef SINGLE_LAYER
+    vec4 texel = texture(u_textureArray,
+                         vec3(v_texture_coordinate.xy, SINGLE_LAYER));
+#else
+    vec4 texel = texture(u_textureArray, v_texture_coordinate);
+#endif
+#ifdef NO_ALPHA
+    color = vec4(texel.rgb, 1.0);
+#else
+    color = texel;
+#endif
 }
@@ -5,10 +5,16 @@ layout(location = 1) in vec3 texture_coordinate;
 layout(location = 2) in vec2 position;
 
 layout(location = 0) out vec3 v_texture_coordinate;
-uniform mat4 u_model_view_projection;
+
+#include "frame_globals.glsl"
+
+layout(std140, binding = 1) uniform draw_block
+{
+    mat4 u_model;
+};
 
 void main()
 {
-    gl_Position = u_model_view_projection * vec4(position.xy, 0.0, 1.0);
+    gl_Position = u_view_projection * u_model * vec4(position.xy, 0.0, 1.0);
     v_texture_coordinate = texture_coordinate;
 }
@@ -0,0 +1,427 @@
+module;
+
+#include "Try.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <expected>
+#include <fcntl.h>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#ifdef MOONSTONE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+#ifdef MOONSTONE_ZSTD
+#include <zstd.h>
+#endif
+
+export module moonstone:asset_pack;
+
+import :hash;
+import :error;
+
+// Layout of a .pack file, all little endian:
+//   pack_header
+//   payloads, each starting on a multiple of header.alignment
+//   pack_entry[entry_count], sorted by hash
+//   names, not terminated, referenced by the entries
+export namespace moonstone
+{
+enum class pack_compression : std::uint8_t
+{
+	none,
+	lz4,
+	zstd
+};
+
+struct pack_header
+{
+	std::array<char, 4> magic{'M', 'S', 'P', 'K'};
+	std::uint32_t version{1};
+	std::uint32_t entry_count{};
+	std::uint32_t alignment{};
+	std::uint64_t index_offset{};
+	std::uint64_t names_offset{};
+};
+
+struct pack_entry
+{
+	std::uint64_t hash{};
+	std::uint64_t offset{};
+	std::uint64_t stored_size{};
+	std::uint64_t size{};
+	std::uint32_t name_offset{};
+	std::uint32_t name_length{};
+	pack_compression compression{};
+	std::array<std::uint8_t, 7> padding{};
+};
+static_assert(sizeof(pack_entry) == 48);
+} // namespace moonstone
+
+namespace moonstone
+{
+auto pack_error(std::string message) -> error::gl_error
+{
+	return error::gl_error{
+		"ASSET PACK", {}, "ERROR", 0, "HIGH", std::move(message)};
+}
+
+// Whether [offset, offset + length) lies in a file of `size` bytes, without
+// the sum overflowing
+auto fits(std::uint64_t offset, std::uint64_t length, std::size_t size) -> bool
+{
+	return offset <= size && length <= size - offset;
+}
+
+// Every range an entry points at is inside the mapping, so reading its name
+// or payload later can't run past the end. Payloads also start where the
+// header's alignment says they do.
+auto valid_entry(const pack_entry& entry, const pack_header& header,
+				 std::size_t size) -> bool
+{
+	// names_offset was checked to be in the file, adding a 32 bit offset
+	// to it can't wrap
+	return fits(entry.offset, entry.stored_size, size) &&
+		   entry.offset % header.alignment == 0 &&
+		   fits(header.names_offset + entry.name_offset,
+				entry.name_length,
+				size) &&
+		   entry.compression <= pack_compression::zstd &&
+		   (entry.compression != pack_compression::none ||
+			entry.stored_size == entry.size);
+}
+
+auto compress(std::span<const std::byte> bytes, pack_compression compression,
+			  int level) -> std::optional<std::vector<std::byte>>
+{
+	switch (compression)
+	{
+	case pack_compression::none:
+		return std::nullopt;
+	case pack_compression::lz4:
+	{
+#ifdef MOONSTONE_LZ4
+		std::vector<std::byte> out(static_cast<std::size_t>(
+			LZ4_compressBound(static_cast<int>(bytes.size()))));
+		const int size =
+			LZ4_compress_HC(reinterpret_cast<const char*>(bytes.data()),
+							reinterpret_cast<char*>(out.data()),
+							static_cast<int>(bytes.size()),
+							static_cast<int>(out.size()),
+							level);
+		if (size <= 0)
+		{
+			return std::nullopt;
+		}
+		out.resize(static_cast<std::size_t>(size));
+		return out;
+#else
+		return std::nullopt;
+#endif
+	}
+	case pack_compression::zstd:
+	{
+#ifdef MOONSTONE_ZSTD
+		std::vector<std::byte> out(ZSTD_compressBound(bytes.size()));
+		const auto size = ZSTD_compress(
+			out.data(), out.size(), bytes.data(), bytes.size(), level);
+		if (ZSTD_isError(size) != 0)
+		{
+			return std::nullopt;
+		}
+		out.resize(size);
+		return out;
+#else
+		return std::nullopt;
+#endif
+	}
+	}
+	return std::nullopt;
+}
+} // namespace moonstone
+
+export namespace moonstone
+{
+// A whole pack mapped read only. Looking a file up is a binary search over
+// the index and reading an uncompressed entry is a pointer offset into the
+// mapping.
+class asset_pack
+{
+	std::shared_ptr<const std::byte> m_mapping;
+	std::size_t m_size{0};
+	std::filesystem::path m_path;
+
+	asset_pack(std::shared_ptr<const std::byte> mapping, std::size_t size,
+			   std::filesystem::path path) :
+		m_mapping{std::move(mapping)},
+		m_size{size},
+		m_path{std::move(path)}
+	{
+	}
+
+	[[nodiscard]] const pack_header& header() const
+	{
+		return *reinterpret_cast<const pack_header*>(this->m_mapping.get());
+	}
+
+public:
+	static auto open(const std::filesystem::path& path)
+		-> error::result<asset_pack>
+	{
+		const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+		{
+			return std::unexpected(pack_error(
+				std::format("{}: {}",
+							path.string(),
+							std::generic_category().message(errno))));
+		}
+		struct stat status{};
+		if (fstat(fd, &status) != 0)
+		{
+			const int error_number = errno;
+			close(fd);
+			return std::unexpected(pack_error(
+				std::format("{}: {}",
+							path.string(),
+							std::generic_category().message(error_number))));
+		}
+		const auto size = static_cast<std::size_t>(status.st_size);
+		void* data = size < sizeof(pack_header)
+						 ? MAP_FAILED
+						 : mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED)
+		{
+			return std::unexpected(
+				pack_error(std::format("{}: can't map", path.string())));
+		}
+		std::shared_ptr<const std::byte> mapping{
+			static_cast<const std::byte*>(data),
+			[size](const std::byte* pointer) {
+				munmap(const_cast<std::byte*>(pointer), size);
+			}};
+		asset_pack pack{std::move(mapping), size, path};
+		const auto& header = pack.header();
+		// Can't overflow, the count is 32 bits
+		const auto index_size =
+			static_cast<std::uint64_t>(header.entry_count) * sizeof(pack_entry);
+		if (header.magic != pack_header{}.magic ||
+			header.version != pack_header{}.version ||
+			!fits(header.index_offset, index_size, size) ||
+			header.names_offset > size ||
+			!std::has_single_bit(header.alignment))
+		{
+			return std::unexpected(
+				pack_error(std::format("{}: not a pack", path.string())));
+		}
+		for (const auto& entry : pack.entries())
+		{
+			if (!valid_entry(entry, header, size))
+			{
+				return std::unexpected(pack_error(std::format(
+					"{}: entry out of bounds", path.string())));
+			}
+		}
+		return pack;
+	}
+
+	[[nodiscard]] std::span<const pack_entry> entries() const
+	{
+		const auto* index =
+			this->m_mapping.get() + this->header().index_offset;
+		return {reinterpret_cast<const pack_entry*>(index),
+				this->header().entry_count};
+	}
+
+	[[nodiscard]] std::string_view name(const pack_entry& entry) const
+	{
+		return {reinterpret_cast<const char*>(this->m_mapping.get() +
+											  this->header().names_offset +
+											  entry.name_offset),
+				entry.name_length};
+	}
+
+	[[nodiscard]] auto find(std::string_view path) const -> const pack_entry*
+	{
+		const auto hash = hash_string(path);
+		const auto entries = this->entries();
+		auto iterator =
+			std::ranges::lower_bound(entries, hash, {}, &pack_entry::hash);
+		// Equal hashes are next to each other, the name settles collisions
+		for (; iterator != entries.end() && iterator->hash == hash; ++iterator)
+		{
+			if (this->name(*iterator) == path)
+			{
+				return &*iterator;
+			}
+		}
+		return nullptr;
+	}
+
+	// The stored bytes, still compressed if the entry is
+	[[nodiscard]] std::span<const std::byte> stored(
+		const pack_entry& entry) const
+	{
+		return {this->m_mapping.get() + entry.offset, entry.stored_size};
+	}
+
+	[[nodiscard]] auto decompress(const pack_entry& entry) const
+		-> error::result<std::vector<std::byte>>
+	{
+		const auto source = this->stored(entry);
+		std::vector<std::byte> bytes(entry.size);
+		switch (entry.compression)
+		{
+		case pack_compression::none:
+			std::ranges::copy(source, bytes.begin());
+			return bytes;
+		case pack_compression::lz4:
+#ifdef MOONSTONE_LZ4
+			if (LZ4_decompress_safe(
+					reinterpret_cast<const char*>(source.data()),
+					reinterpret_cast<char*>(bytes.data()),
+					static_cast<int>(source.size()),
+					static_cast<int>(bytes.size())) ==
+				static_cast<int>(bytes.size()))
+			{
+				return bytes;
+			}
+#endif
+			break;
+		case pack_compression::zstd:
+#ifdef MOONSTONE_ZSTD
+			if (ZSTD_decompress(bytes.data(),
+								bytes.size(),
+								source.data(),
+								source.size()) == bytes.size())
+			{
+				return bytes;
+			}
+#endif
+			break;
+		}
+		return std::unexpected(pack_error(
+			std::format("{}: can't decompress {} from {}",
+						this->m_path.string(),
+						this->name(entry),
+						static_cast<int>(entry.compression))));
+	}
+
+	// Keeps the mapping alive for as long as the views into it are used
+	[[nodiscard]] std::shared_ptr<const std::byte> get_mapping() const
+	{
+		return this->m_mapping;
+	}
+	[[nodiscard]] const std::filesystem::path& get_path() const
+	{
+		return this->m_path;
+	}
+};
+
+// Builds a pack from named buffers, used by the `pack` tool
+class pack_writer
+{
+	struct file
+	{
+		std::string name;
+		std::vector<std::byte> bytes;
+	};
+	std::vector<file> m_files;
+
+public:
+	void add(std::string name, std::vector<std::byte> bytes)
+	{
+		this->m_files.push_back({std::move(name), std::move(bytes)});
+	}
+
+	// Entries only keep the compressed form when it's actually smaller, so
+	// already compressed images are stored as they are
+	auto write(const std::filesystem::path& path,
+			   pack_compression compression = pack_compression::none,
+			   int level = 0, std::uint32_t alignment = 64)
+		-> error::result<std::uint64_t>
+	{
+		// Zero or anything else would break align() and what open() checks
+		if (!std::has_single_bit(alignment))
+		{
+			return std::unexpected(
+				pack_error(std::format("{}: alignment {} isn't a power of two",
+									   path.string(),
+									   alignment)));
+		}
+		std::ofstream out{path, std::ios::binary | std::ios::trunc};
+		if (!out)
+		{
+			return std::unexpected(
+				pack_error(std::format("{}: can't write", path.string())));
+		}
+		auto align = [&](std::uint64_t offset) {
+			return (offset + alignment - 1) / alignment * alignment;
+		};
+		std::vector<pack_entry> entries;
+		std::string names;
+		std::uint64_t offset = align(sizeof(pack_header));
+		out.seekp(static_cast<std::streamoff>(offset));
+		for (const auto& file : this->m_files)
+		{
+			pack_entry entry{.hash = hash_string(file.name),
+							 .offset = offset,
+							 .size = file.bytes.size(),
+							 .name_offset =
+								 static_cast<std::uint32_t>(names.size()),
+							 .name_length =
+								 static_cast<std::uint32_t>(file.name.size())};
+			names += file.name;
+			auto compressed = compress(file.bytes, compression, level);
+			const bool smaller = compressed.has_value() &&
+								 compressed->size() < file.bytes.size();
+			const auto& stored = smaller ? *compressed : file.bytes;
+			entry.compression = smaller ? compression : pack_compression::none;
+			entry.stored_size = stored.size();
+			out.write(reinterpret_cast<const char*>(stored.data()),
+					  static_cast<std::streamsize>(stored.size()));
+			offset = align(offset + stored.size());
+			out.seekp(static_cast<std::streamoff>(offset));
+			entries.push_back(entry);
+		}
+		std::ranges::sort(entries, {}, &pack_entry::hash);
+
+		pack_header header{.entry_count =
+							   static_cast<std::uint32_t>(entries.size()),
+						   .alignment = alignment,
+						   .index_offset = offset,
+						   .names_offset =
+							   offset + (entries.size() * sizeof(pack_entry))};
+		out.write(reinterpret_cast<const char*>(entries.data()),
+				  static_cast<std::streamsize>(entries.size() *
+											   sizeof(pack_entry)));
+		out.write(names.data(), static_cast<std::streamsize>(names.size()));
+		out.seekp(0);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		if (!out)
+		{
+			return std::unexpected(
+				pack_error(std::format("{}: write failed", path.string())));
+		}
+		return header.names_offset + names.size();
+	}
+};
+} // namespace moonstone
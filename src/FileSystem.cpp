@@ -0,0 +1,656 @@
+module;
+
+#include "Try.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <expected>
+#include <fcntl.h>
+#include <filesystem>
+#include <format>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <ranges>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#ifdef MOONSTONE_IO_URING
+#include <liburing.h>
+#endif
+
+export module moonstone:file_system;
+
+import :error;
+import :asset_pack;
+
+namespace moonstone
+{
+auto file_error(const std::string& path, int error_number) -> error::gl_error
+{
+	return error::gl_error{
+		"FILE SYSTEM",
+		{},
+		"ERROR",
+		0,
+		"HIGH",
+		std::format("{}: {}",
+					path,
+					std::generic_category().message(error_number))};
+}
+} // namespace moonstone
+
+export namespace moonstone
+{
+enum class read_method : unsigned char
+{
+	mapped,
+	io_uring,
+	thread_pool,
+	pack
+};
+
+struct file_load
+{
+	std::string path;
+	std::size_t bytes{};
+	std::chrono::nanoseconds latency{};
+	read_method method{};
+};
+
+struct file_system_stats
+{
+	std::uint64_t loads{};
+	std::uint64_t bytes{};
+	std::chrono::nanoseconds total_latency{};
+	file_load slowest;
+	read_method async_method{};
+};
+
+// Read only view of a whole file. The storage is whatever keeps the bytes
+// alive: the file's own mapping, a pack's mapping or a decompressed copy.
+class mapped_file
+{
+	std::shared_ptr<const void> m_storage;
+	const std::byte* m_data{nullptr};
+	std::size_t m_size{0};
+
+public:
+	mapped_file() = default;
+	mapped_file(std::shared_ptr<const void> storage, const std::byte* data,
+				std::size_t size) :
+		m_storage{std::move(storage)},
+		m_data{data},
+		m_size{size}
+	{
+	}
+	~mapped_file() = default;
+
+	[[nodiscard]] std::span<const std::byte> bytes() const
+	{
+		return {this->m_data, this->m_size};
+	}
+	[[nodiscard]] std::string_view text() const
+	{
+		return {reinterpret_cast<const char*>(this->m_data), this->m_size};
+	}
+	[[nodiscard]] std::size_t size() const
+	{
+		return this->m_size;
+	}
+
+	mapped_file(mapped_file&&) noexcept = default;
+	mapped_file& operator=(mapped_file&&) noexcept = default;
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+};
+
+using file_buffer = std::vector<std::byte>;
+using file_future = std::future<error::result<file_buffer>>;
+
+// Every asset and shader read goes through here. Paths are virtual, mounted
+// packs are searched first (latest mount wins), then the first component
+// names a directory mount ("assets/x.png" -> <assets mount>/x.png). map()
+// is the synchronous zero copy path, read_batch() copies into owned buffers
+// using io_uring when the kernel allows it and a small thread pool otherwise.
+// Each load's latency is recorded.
+class file_system
+{
+	static constexpr std::size_t s_recent_loads = 256;
+	static constexpr unsigned s_ring_entries = 64;
+	// Failed waits in a row before the reaper gives up on the ring
+	static constexpr int s_wait_retries = 8;
+
+	struct read_request
+	{
+		std::string path;
+		int fd{-1};
+		file_buffer buffer;
+		std::size_t offset{0};
+		std::chrono::steady_clock::time_point start;
+		std::promise<error::result<file_buffer>> promise;
+	};
+
+	std::unordered_map<std::string, std::filesystem::path> m_mounts;
+	std::vector<asset_pack> m_packs;
+
+	std::mutex m_stats_mutex;
+	std::vector<file_load> m_recent;
+	std::size_t m_recent_next{0};
+	file_system_stats m_stats;
+
+#ifdef MOONSTONE_IO_URING
+	io_uring m_ring{};
+	bool m_ring_ready{false};
+	// Set when the reaper gave up, reads use the thread pool from then on
+	bool m_ring_failed{false};
+	std::mutex m_ring_mutex;
+	// Submitted reads, the ring owns them until their completion comes back
+	std::vector<read_request*> m_in_flight;
+	std::jthread m_reaper;
+#endif
+	std::mutex m_jobs_mutex;
+	std::condition_variable_any m_jobs_ready;
+	std::deque<std::unique_ptr<read_request>> m_jobs;
+	std::vector<std::jthread> m_workers;
+
+	void record(std::string path, std::size_t bytes,
+				std::chrono::steady_clock::time_point start, read_method method)
+	{
+		file_load load{std::move(path),
+					   bytes,
+					   std::chrono::steady_clock::now() - start,
+					   method};
+		const std::scoped_lock lock{this->m_stats_mutex};
+		++this->m_stats.loads;
+		this->m_stats.bytes += bytes;
+		this->m_stats.total_latency += load.latency;
+		if (load.latency > this->m_stats.slowest.latency)
+		{
+			this->m_stats.slowest = load;
+		}
+		if (this->m_recent.size() < s_recent_loads)
+		{
+			this->m_recent.push_back(std::move(load));
+		}
+		else
+		{
+			this->m_recent[this->m_recent_next] = std::move(load);
+		}
+		this->m_recent_next = (this->m_recent_next + 1) % s_recent_loads;
+	}
+
+	void complete(std::unique_ptr<read_request> request, read_method method)
+	{
+		close(request->fd);
+		this->record(
+			request->path, request->buffer.size(), request->start, method);
+		request->promise.set_value(std::move(request->buffer));
+	}
+
+	void fail(std::unique_ptr<read_request> request, int error_number)
+	{
+		close(request->fd);
+		request->promise.set_value(
+			std::unexpected(file_error(request->path, error_number)));
+	}
+
+	auto find_in_packs(const std::string& path) const
+		-> std::pair<const asset_pack*, const pack_entry*>
+	{
+		for (const auto& pack : this->m_packs | std::views::reverse)
+		{
+			if (const auto* entry = pack.find(path))
+			{
+				return {&pack, entry};
+			}
+		}
+		return {nullptr, nullptr};
+	}
+
+	auto open_request(const std::string& path)
+		-> error::result<std::unique_ptr<read_request>>
+	{
+		auto request = std::make_unique<read_request>();
+		request->path = path;
+		request->start = std::chrono::steady_clock::now();
+		request->fd = open(this->resolve(path).c_str(), O_RDONLY | O_CLOEXEC);
+		if (request->fd < 0)
+		{
+			return std::unexpected(file_error(path, errno));
+		}
+		struct stat status{};
+		if (fstat(request->fd, &status) != 0)
+		{
+			const int error_number = errno;
+			close(request->fd);
+			return std::unexpected(file_error(path, error_number));
+		}
+		request->buffer.resize(static_cast<std::size_t>(status.st_size));
+		return request;
+	}
+
+	void work(const std::stop_token& stop)
+	{
+		while (true)
+		{
+			std::unique_ptr<read_request> request;
+			{
+				std::unique_lock lock{this->m_jobs_mutex};
+				if (!this->m_jobs_ready.wait(
+						lock, stop, [this] { return !this->m_jobs.empty(); }))
+				{
+					return;
+				}
+				request = std::move(this->m_jobs.front());
+				this->m_jobs.pop_front();
+			}
+			while (request->offset < request->buffer.size())
+			{
+				const auto length =
+					pread(request->fd,
+						  request->buffer.data() + request->offset,
+						  request->buffer.size() - request->offset,
+						  static_cast<off_t>(request->offset));
+				if (length <= 0)
+				{
+					break;
+				}
+				request->offset += static_cast<std::size_t>(length);
+			}
+			if (request->offset < request->buffer.size())
+			{
+				this->fail(std::move(request), errno != 0 ? errno : EIO);
+				continue;
+			}
+			this->complete(std::move(request), read_method::thread_pool);
+		}
+	}
+
+#ifdef MOONSTONE_IO_URING
+	// Expects m_ring_mutex to be held, the ring owns the request until its
+	// completion comes back
+	void queue_read(read_request* request)
+	{
+		io_uring_sqe* sqe = io_uring_get_sqe(&this->m_ring);
+		if (sqe == nullptr)
+		{
+			io_uring_submit(&this->m_ring);
+			sqe = io_uring_get_sqe(&this->m_ring);
+		}
+		io_uring_prep_read(sqe,
+						   request->fd,
+						   request->buffer.data() + request->offset,
+						   request->buffer.size() - request->offset,
+						   request->offset);
+		io_uring_sqe_set_data(sqe, request);
+	}
+
+	// The ring stopped handing out completions. The reads in flight fail,
+	// but the kernel may still write into their buffers so they're only
+	// freed after the ring is torn down.
+	void abandon_ring(int error_number)
+	{
+		{
+			const std::scoped_lock lock{this->m_ring_mutex};
+			this->m_ring_failed = true;
+			for (auto* request : this->m_in_flight)
+			{
+				request->promise.set_value(
+					std::unexpected(file_error(request->path, error_number)));
+			}
+		}
+		{
+			const std::scoped_lock lock{this->m_stats_mutex};
+			this->m_stats.async_method = read_method::thread_pool;
+		}
+		this->start_workers();
+	}
+
+	void reap()
+	{
+		int failures = 0;
+		while (true)
+		{
+			io_uring_cqe* cqe = nullptr;
+			if (const int error = io_uring_wait_cqe(&this->m_ring, &cqe);
+				error < 0)
+			{
+				// A signal interrupting the wait isn't a failure of the ring
+				if (error == -EINTR)
+				{
+					continue;
+				}
+				if (++failures < s_wait_retries)
+				{
+					continue;
+				}
+				this->abandon_ring(-error);
+				return;
+			}
+			failures = 0;
+			auto* data = static_cast<read_request*>(io_uring_cqe_get_data(cqe));
+			const int result = cqe->res;
+			io_uring_cqe_seen(&this->m_ring, cqe);
+			// The drained nop from the destructor
+			if (data == nullptr)
+			{
+				return;
+			}
+			std::unique_ptr<read_request> request{data};
+			if (result > 0)
+			{
+				request->offset += static_cast<std::size_t>(result);
+			}
+			if (result > 0 && request->offset < request->buffer.size())
+			{
+				// Short read, queue the rest
+				const std::scoped_lock lock{this->m_ring_mutex};
+				this->queue_read(request.release());
+				io_uring_submit(&this->m_ring);
+				continue;
+			}
+			{
+				const std::scoped_lock lock{this->m_ring_mutex};
+				std::erase(this->m_in_flight, request.get());
+			}
+			if (result < 0)
+			{
+				this->fail(std::move(request), -result);
+				continue;
+			}
+			if (request->offset < request->buffer.size())
+			{
+				this->fail(std::move(request), EIO);
+				continue;
+			}
+			this->complete(std::move(request), read_method::io_uring);
+		}
+	}
+#endif
+
+	void start_workers()
+	{
+		const auto count =
+			std::clamp(std::thread::hardware_concurrency(), 1U, 4U);
+		for (unsigned i = 0; i < count; ++i)
+		{
+			this->m_workers.emplace_back(
+				[this](const std::stop_token& stop) { this->work(stop); });
+		}
+	}
+
+	void start_async()
+	{
+#ifdef MOONSTONE_IO_URING
+		// Can fail at runtime (old kernel, disabled by seccomp...)
+		this->m_ring_ready =
+			io_uring_queue_init(s_ring_entries, &this->m_ring, 0) == 0;
+		if (this->m_ring_ready)
+		{
+			this->m_stats.async_method = read_method::io_uring;
+			this->m_reaper = std::jthread{[this] { this->reap(); }};
+			return;
+		}
+#endif
+		this->m_stats.async_method = read_method::thread_pool;
+		this->start_workers();
+	}
+
+public:
+	file_system()
+	{
+		this->mount("assets", "assets");
+		this->mount("shaders", "shaders");
+		this->start_async();
+	}
+	~file_system()
+	{
+#ifdef MOONSTONE_IO_URING
+		if (this->m_ring_ready)
+		{
+			{
+				// Drained, so it only completes after every read in flight
+				const std::scoped_lock lock{this->m_ring_mutex};
+				if (!this->m_ring_failed)
+				{
+					io_uring_sqe* sqe = io_uring_get_sqe(&this->m_ring);
+					if (sqe == nullptr)
+					{
+						io_uring_submit(&this->m_ring);
+						sqe = io_uring_get_sqe(&this->m_ring);
+					}
+					io_uring_prep_nop(sqe);
+					io_uring_sqe_set_data(sqe, nullptr);
+					sqe->flags |= IOSQE_IO_DRAIN;
+					io_uring_submit(&this->m_ring);
+				}
+			}
+			this->m_reaper.join();
+			io_uring_queue_exit(&this->m_ring);
+			// Left behind by abandon_ring, already failed
+			for (auto* request : this->m_in_flight)
+			{
+				const std::unique_ptr<read_request> owned{request};
+				close(owned->fd);
+			}
+		}
+#endif
+		for (auto& worker : this->m_workers)
+		{
+			worker.request_stop();
+		}
+		this->m_jobs_ready.notify_all();
+	}
+
+	void mount(const std::string& name, std::filesystem::path directory)
+	{
+		this->m_mounts.insert_or_assign(name, std::move(directory));
+	}
+
+	auto mount_pack(const std::filesystem::path& path) -> error::result<>
+	{
+		this->m_packs.push_back(Try(asset_pack::open(path)));
+		return {};
+	}
+
+	[[nodiscard]] auto resolve(const std::string& path) const
+		-> std::filesystem::path
+	{
+		const auto separator = path.find('/');
+		auto mount = this->m_mounts.find(path.substr(0, separator));
+		if (mount == this->m_mounts.end() || separator == std::string::npos)
+		{
+			return path;
+		}
+		return mount->second / path.substr(separator + 1);
+	}
+
+	[[nodiscard]] bool exists(const std::string& path) const
+	{
+		if (this->find_in_packs(path).first != nullptr)
+		{
+			return true;
+		}
+		std::error_code ignored;
+		return std::filesystem::is_regular_file(this->resolve(path), ignored);
+	}
+
+	// The pages are populated up front so decoding right after doesn't fault
+	// its way through the file
+	auto map(const std::string& path) -> error::result<mapped_file>
+	{
+		const auto start = std::chrono::steady_clock::now();
+		if (auto [pack, entry] = this->find_in_packs(path); pack != nullptr)
+		{
+			if (entry->compression == pack_compression::none)
+			{
+				const auto stored = pack->stored(*entry);
+				this->record(path, stored.size(), start, read_method::pack);
+				return mapped_file{
+					pack->get_mapping(), stored.data(), stored.size()};
+			}
+			auto bytes = std::make_shared<const std::vector<std::byte>>(
+				Try(pack->decompress(*entry)));
+			this->record(path, bytes->size(), start, read_method::pack);
+			const auto* data = bytes->data();
+			const auto size = bytes->size();
+			return mapped_file{std::move(bytes), data, size};
+		}
+		const int fd = open(this->resolve(path).c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+		{
+			return std::unexpected(file_error(path, errno));
+		}
+		struct stat status{};
+		if (fstat(fd, &status) != 0)
+		{
+			const int error_number = errno;
+			close(fd);
+			return std::unexpected(file_error(path, error_number));
+		}
+		const auto size = static_cast<std::size_t>(status.st_size);
+		if (size == 0)
+		{
+			close(fd);
+			this->record(path, 0, start, read_method::mapped);
+			return mapped_file{};
+		}
+		void* data = mmap(
+			nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+		const int error_number = errno;
+		close(fd);
+		if (data == MAP_FAILED)
+		{
+			return std::unexpected(file_error(path, error_number));
+		}
+		this->record(path, size, start, read_method::mapped);
+		std::shared_ptr<const void> mapping{
+			data, [size](const void* pointer) {
+				munmap(const_cast<void*>(pointer), size);
+			}};
+		return mapped_file{
+			std::move(mapping), static_cast<const std::byte*>(data), size};
+	}
+
+	auto read_text(const std::string& path) -> error::result<std::string>
+	{
+		const auto file = Try(this->map(path));
+		return std::string{file.text()};
+	}
+
+	// All the reads are queued before anything is submitted so io_uring gets
+	// them in one system call
+	auto read_batch(std::span<const std::string> paths)
+		-> std::vector<file_future>
+	{
+		const auto method = this->get_stats().async_method;
+		std::vector<file_future> futures;
+		futures.reserve(paths.size());
+		std::vector<std::unique_ptr<read_request>> requests;
+		for (const auto& path : paths)
+		{
+			// Already in memory, there's nothing to wait for
+			if (this->find_in_packs(path).first != nullptr)
+			{
+				std::promise<error::result<file_buffer>> packed;
+				auto file = this->map(path);
+				if (file.has_value())
+				{
+					const auto bytes = file->bytes();
+					packed.set_value(file_buffer{bytes.begin(), bytes.end()});
+				}
+				else
+				{
+					packed.set_value(std::unexpected(std::move(file).error()));
+				}
+				futures.push_back(packed.get_future());
+				continue;
+			}
+			auto request = this->open_request(path);
+			if (!request.has_value())
+			{
+				std::promise<error::result<file_buffer>> failed;
+				failed.set_value(std::unexpected(std::move(request).error()));
+				futures.push_back(failed.get_future());
+				continue;
+			}
+			futures.push_back((*request)->promise.get_future());
+			if ((*request)->buffer.empty())
+			{
+				this->complete(std::move(*request), method);
+				continue;
+			}
+			requests.push_back(std::move(*request));
+		}
+#ifdef MOONSTONE_IO_URING
+		{
+			const std::scoped_lock lock{this->m_ring_mutex};
+			if (this->m_ring_ready && !this->m_ring_failed)
+			{
+				for (auto& request : requests)
+				{
+					this->m_in_flight.push_back(request.get());
+					this->queue_read(request.release());
+				}
+				io_uring_submit(&this->m_ring);
+				return futures;
+			}
+		}
+#endif
+		{
+			const std::scoped_lock lock{this->m_jobs_mutex};
+			for (auto& request : requests)
+			{
+				this->m_jobs.push_back(std::move(request));
+			}
+		}
+		this->m_jobs_ready.notify_all();
+		return futures;
+	}
+
+	[[nodiscard]] auto get_stats() -> file_system_stats
+	{
+		const std::scoped_lock lock{this->m_stats_mutex};
+		return this->m_stats;
+	}
+	// The last loads, oldest first
+	[[nodiscard]] auto get_recent_loads() -> std::vector<file_load>
+	{
+		const std::scoped_lock lock{this->m_stats_mutex};
+		std::vector<file_load> loads;
+		loads.reserve(this->m_recent.size());
+		for (std::size_t i = 0; i < this->m_recent.size(); ++i)
+		{
+			loads.push_back(this->m_recent[(this->m_recent_next + i) %
+										   this->m_recent.size()]);
+		}
+		return loads;
+	}
+
+	file_system(const file_system&) = delete;
+	file_system(file_system&&) = delete;
+	file_system& operator=(const file_system&) = delete;
+	file_system& operator=(file_system&&) = delete;
+};
+
+// The one instance everything loads through
+auto files() -> file_system&
+{
+	static file_system instance;
+	return instance;
+}
+} // namespace moonstone
@@ -0,0 +1,143 @@
+module;
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <thread>
+#include <vector>
+
+export module moonstone:frame_arena;
+
+export namespace moonstone
+{
+struct frame_arena_stats
+{
+	std::size_t capacity{};
+	// Bytes handed out so far this frame
+	std::size_t used{};
+	// Highest `used` seen at a reset, what the capacity should be tuned to
+	std::size_t peak{};
+	// Requests that didn't fit and went to the upstream resource instead
+	std::uint64_t overflows{};
+	std::size_t overflow_bytes{};
+};
+
+// Linear allocator for memory that only lives until the end of the frame.
+// Allocating is a pointer bump, deallocating does nothing and reset() at the
+// end of the frame takes everything back at once. Only the thread that
+// created it bumps the arena, other threads and requests that don't fit are
+// passed to the upstream resource, so nothing fails when it's too small.
+class frame_arena : public std::pmr::memory_resource
+{
+	std::unique_ptr<std::byte[]> m_buffer;
+	std::size_t m_capacity;
+	std::size_t m_used{0};
+	std::size_t m_peak{0};
+	std::uint64_t m_overflows{0};
+	std::size_t m_overflow_bytes{0};
+	std::pmr::memory_resource* m_upstream;
+	std::thread::id m_owner{std::this_thread::get_id()};
+
+	[[nodiscard]] bool owns(const void* pointer) const
+	{
+		const auto* byte = static_cast<const std::byte*>(pointer);
+		return byte >= this->m_buffer.get() &&
+			   byte < this->m_buffer.get() + this->m_capacity;
+	}
+
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override
+	{
+		if (std::this_thread::get_id() == this->m_owner)
+		{
+			const auto base = reinterpret_cast<std::uintptr_t>(
+				this->m_buffer.get());
+			const auto start = (base + this->m_used + alignment - 1) &
+							   ~(static_cast<std::uintptr_t>(alignment) - 1);
+			const auto end = start - base + bytes;
+			if (end <= this->m_capacity)
+			{
+				this->m_used = end;
+				return reinterpret_cast<void*>(start);
+			}
+			++this->m_overflows;
+			this->m_overflow_bytes += bytes;
+		}
+		return this->m_upstream->allocate(bytes, alignment);
+	}
+
+	void do_deallocate(void* pointer, std::size_t bytes,
+					   std::size_t alignment) override
+	{
+		if (!this->owns(pointer))
+		{
+			this->m_upstream->deallocate(pointer, bytes, alignment);
+		}
+	}
+
+	[[nodiscard]] bool do_is_equal(
+		const std::pmr::memory_resource& other) const noexcept override
+	{
+		return this == &other;
+	}
+
+public:
+	explicit frame_arena(std::size_t capacity = 1024UZ * 1024,
+						 std::pmr::memory_resource* upstream =
+							 std::pmr::new_delete_resource()) :
+		m_buffer{std::make_unique<std::byte[]>(capacity)},
+		m_capacity{capacity},
+		m_upstream{upstream}
+	{
+	}
+	~frame_arena() override = default;
+
+	// The arena is created by whoever calls frame_memory() first, the render
+	// thread claims it at startup
+	void bind_to_current_thread()
+	{
+		this->m_owner = std::this_thread::get_id();
+	}
+
+	// Everything allocated from the arena this frame must be dead by now
+	void reset()
+	{
+		this->m_peak = std::max(
+			this->m_peak, this->m_used + this->m_overflow_bytes);
+		this->m_used = 0;
+		this->m_overflow_bytes = 0;
+	}
+
+	[[nodiscard]] frame_arena_stats get_stats() const
+	{
+		return {.capacity = this->m_capacity,
+				.used = this->m_used,
+				.peak = this->m_peak,
+				.overflows = this->m_overflows,
+				.overflow_bytes = this->m_overflow_bytes};
+	}
+
+	frame_arena(const frame_arena&) = delete;
+	frame_arena(frame_arena&&) = delete;
+	frame_arena& operator=(const frame_arena&) = delete;
+	frame_arena& operator=(frame_arena&&) = delete;
+};
+
+// The arena of the render thread, reset by main at the end of every frame
+auto frame_memory() -> frame_arena&
+{
+	static frame_arena instance{};
+	return instance;
+}
+
+// Scratch vector that goes away with the frame
+template <typename T>
+using frame_vector = std::pmr::vector<T>;
+
+template <typename T>
+auto make_frame_vector() -> frame_vector<T>
+{
+	return frame_vector<T>{&frame_memory()};
+}
+} // namespace moonstone
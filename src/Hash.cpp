@@ -0,0 +1,36 @@
+module;
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+export module moonstone:hash;
+
+export namespace moonstone
+{
+// FNV-1a, used to key cached assets by their content
+constexpr std::uint64_t hash_seed = 0xcbf29ce484222325ULL;
+constexpr auto hash_bytes(std::span<const std::byte> bytes,
+						  std::uint64_t seed = hash_seed) -> std::uint64_t
+{
+	std::uint64_t hash = seed;
+	for (auto byte : bytes)
+	{
+		hash ^= std::to_integer<std::uint64_t>(byte);
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+constexpr auto hash_string(std::string_view string,
+						   std::uint64_t seed = hash_seed) -> std::uint64_t
+{
+	std::uint64_t hash = seed;
+	for (auto character : string)
+	{
+		hash ^= static_cast<unsigned char>(character);
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+} // namespace moonstone
@@ -0,0 +1,524 @@
+module;
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stop_token>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+export module moonstone:jobs;
+
+namespace moonstone
+{
+class job_system;
+} // namespace moonstone
+
+export namespace moonstone
+{
+// Counts the jobs started with it that haven't finished yet. Waiting on it
+// is how one piece of work depends on another.
+class job_counter
+{
+	std::atomic<std::uint32_t> m_pending{0};
+
+	friend class job_system;
+
+public:
+	job_counter() = default;
+	~job_counter() = default;
+
+	[[nodiscard]] bool done() const
+	{
+		return this->m_pending.load(std::memory_order_acquire) == 0;
+	}
+
+	job_counter(const job_counter&) = delete;
+	job_counter(job_counter&&) = delete;
+	job_counter& operator=(const job_counter&) = delete;
+	job_counter& operator=(job_counter&&) = delete;
+};
+
+struct job_stats
+{
+	std::uint64_t executed{};
+	// Taken from another worker's deque
+	std::uint64_t stolen{};
+	// Ran on the submitting thread because the pool or deque was full
+	std::uint64_t inlined{};
+	// Submitted from threads that aren't workers
+	std::uint64_t injected{};
+};
+} // namespace moonstone
+
+namespace moonstone
+{
+struct job
+{
+	// Enough for a lambda capturing a handful of references, bigger
+	// callables are boxed on the heap
+	static constexpr std::size_t s_storage = 64;
+
+	alignas(std::max_align_t) std::array<std::byte, s_storage> storage{};
+	// Runs the callable and destroys it
+	void (*invoke)(job&){nullptr};
+	job_counter* counter{nullptr};
+	// Jobs from non worker threads are allocated one by one
+	bool heap{false};
+	std::atomic<bool> free{true};
+};
+
+template <typename F>
+void emplace_job(job& target, F&& work)
+{
+	using callable = std::decay_t<F>;
+	if constexpr (sizeof(callable) <= job::s_storage &&
+				  alignof(callable) <= alignof(std::max_align_t))
+	{
+		::new (target.storage.data()) callable(std::forward<F>(work));
+		target.invoke = [](job& self) {
+			auto* stored =
+				std::launder(reinterpret_cast<callable*>(self.storage.data()));
+			(*stored)();
+			stored->~callable();
+		};
+	}
+	else
+	{
+		emplace_job(target,
+					[boxed = std::make_unique<callable>(
+						 std::forward<F>(work))] { (*boxed)(); });
+	}
+}
+
+// Chase-Lev deque with a fixed capacity. The owning worker pushes and pops
+// at the bottom without contention, thieves CAS the top.
+class work_deque
+{
+	static constexpr std::int64_t s_capacity = 1024;
+	static constexpr std::int64_t s_mask = s_capacity - 1;
+
+	alignas(64) std::atomic<std::int64_t> m_top{0};
+	alignas(64) std::atomic<std::int64_t> m_bottom{0};
+	std::array<std::atomic<job*>, s_capacity> m_items{};
+
+public:
+	// Owner only, false when full
+	bool push(job* item)
+	{
+		const auto bottom = this->m_bottom.load(std::memory_order_relaxed);
+		const auto top = this->m_top.load(std::memory_order_acquire);
+		if (bottom - top >= s_capacity)
+		{
+			return false;
+		}
+		this->m_items.at(bottom & s_mask).store(item,
+												std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		this->m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Owner only, newest first
+	auto pop() -> job*
+	{
+		const auto bottom = this->m_bottom.load(std::memory_order_relaxed) - 1;
+		this->m_bottom.store(bottom, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		auto top = this->m_top.load(std::memory_order_relaxed);
+		if (top > bottom)
+		{
+			this->m_bottom.store(bottom + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		auto* item =
+			this->m_items.at(bottom & s_mask).load(std::memory_order_relaxed);
+		if (top == bottom)
+		{
+			// Last one, race the thieves for it
+			if (!this->m_top.compare_exchange_strong(
+					top,
+					top + 1,
+					std::memory_order_seq_cst,
+					std::memory_order_relaxed))
+			{
+				item = nullptr;
+			}
+			this->m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		}
+		return item;
+	}
+
+	// Any thread, oldest first
+	auto steal() -> job*
+	{
+		auto top = this->m_top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		const auto bottom = this->m_bottom.load(std::memory_order_acquire);
+		if (top >= bottom)
+		{
+			return nullptr;
+		}
+		auto* item =
+			this->m_items.at(top & s_mask).load(std::memory_order_relaxed);
+		if (!this->m_top.compare_exchange_strong(top,
+												 top + 1,
+												 std::memory_order_seq_cst,
+												 std::memory_order_relaxed))
+		{
+			return nullptr;
+		}
+		return item;
+	}
+};
+
+struct alignas(64) worker_state
+{
+	static constexpr std::uint32_t s_pool_size = 1024;
+
+	work_deque deque;
+	// Handed out round robin, a slot still in flight makes the submitter run
+	// the job inline instead of waiting for it
+	std::unique_ptr<job[]> pool{std::make_unique<job[]>(s_pool_size)};
+	std::uint32_t next_job{0};
+	std::uint32_t random{0x9E3779B9U};
+};
+
+struct thread_binding
+{
+	const job_system* system{nullptr};
+	worker_state* state{nullptr};
+};
+thread_local thread_binding current_binding{};
+thread_local std::uint32_t outsider_random{0x2545F491U};
+
+inline auto next_random(std::uint32_t& state) -> std::uint32_t
+{
+	state ^= state << 13U;
+	state ^= state >> 17U;
+	state ^= state << 5U;
+	return state;
+}
+} // namespace moonstone
+
+export namespace moonstone
+{
+// Work stealing scheduler. Every worker owns a deque, runs its own jobs
+// newest first and steals the oldest ones from others when it runs out.
+// Slot 0 belongs to the thread that calls bind_to_current_thread(), the
+// render thread, so it helps out while it waits. Other threads can still
+// submit, their jobs go through a shared queue. Jobs shouldn't throw.
+class job_system
+{
+	std::vector<std::unique_ptr<worker_state>> m_states;
+	std::vector<std::jthread> m_threads;
+	std::mutex m_injected_mutex;
+	std::deque<job*> m_injected;
+	std::atomic<std::size_t> m_injected_count{0};
+	// Bumped on every submit, sleeping workers wait on it
+	std::atomic<std::uint32_t> m_epoch{0};
+	std::atomic<std::uint32_t> m_sleeping{0};
+	std::atomic<std::uint64_t> m_executed{0};
+	std::atomic<std::uint64_t> m_stolen{0};
+	std::atomic<std::uint64_t> m_inlined{0};
+	std::atomic<std::uint64_t> m_injected_total{0};
+	// Shared by the jobs nobody waits on
+	job_counter m_detached;
+
+	[[nodiscard]] auto self() const -> worker_state*
+	{
+		return current_binding.system == this ? current_binding.state
+											   : nullptr;
+	}
+
+	// Pairs with the sleep in run(). Each side stores then loads the other's
+	// variable, only seq_cst keeps both loads from reading the old values,
+	// which would skip the notify while the worker sleeps on a stale epoch.
+	void wake()
+	{
+		this->m_epoch.fetch_add(1, std::memory_order_seq_cst);
+		if (this->m_sleeping.load(std::memory_order_seq_cst) > 0)
+		{
+			this->m_epoch.notify_one();
+		}
+	}
+
+	void execute(job* item)
+	{
+		item->invoke(*item);
+		auto* counter = item->counter;
+		if (item->heap)
+		{
+			delete item;
+		}
+		else
+		{
+			item->free.store(true, std::memory_order_release);
+		}
+		this->m_executed.fetch_add(1, std::memory_order_relaxed);
+		counter->m_pending.fetch_sub(1, std::memory_order_acq_rel);
+	}
+
+	auto take_injected() -> job*
+	{
+		if (this->m_injected_count.load(std::memory_order_acquire) == 0)
+		{
+			return nullptr;
+		}
+		const std::scoped_lock lock{this->m_injected_mutex};
+		if (this->m_injected.empty())
+		{
+			return nullptr;
+		}
+		auto* item = this->m_injected.front();
+		this->m_injected.pop_front();
+		this->m_injected_count.fetch_sub(1, std::memory_order_release);
+		return item;
+	}
+
+	auto find_job(worker_state* owner) -> job*
+	{
+		if (owner != nullptr)
+		{
+			if (auto* item = owner->deque.pop())
+			{
+				return item;
+			}
+		}
+		if (auto* item = this->take_injected())
+		{
+			return item;
+		}
+		auto& random = owner != nullptr ? owner->random : outsider_random;
+		const auto count = this->m_states.size();
+		const auto first = next_random(random) % count;
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			auto& victim = *this->m_states.at((first + i) % count);
+			if (&victim == owner)
+			{
+				continue;
+			}
+			if (auto* item = victim.deque.steal())
+			{
+				this->m_stolen.fetch_add(1, std::memory_order_relaxed);
+				return item;
+			}
+		}
+		return nullptr;
+	}
+
+	void work(const std::stop_token& stop, std::size_t index)
+	{
+		current_binding = {this, this->m_states.at(index).get()};
+		constexpr int spins_before_sleep = 64;
+		int spins = 0;
+		while (!stop.stop_requested())
+		{
+			if (auto* item = this->find_job(current_binding.state))
+			{
+				this->execute(item);
+				spins = 0;
+				continue;
+			}
+			if (++spins < spins_before_sleep)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			// Anything submitted after this load changes the epoch, so the
+			// wait below can't miss it
+			const auto epoch = this->m_epoch.load(std::memory_order_acquire);
+			if (stop.stop_requested())
+			{
+				break;
+			}
+			if (auto* item = this->find_job(current_binding.state))
+			{
+				this->execute(item);
+				spins = 0;
+				continue;
+			}
+			// seq_cst, see wake()
+			this->m_sleeping.fetch_add(1, std::memory_order_seq_cst);
+			this->m_epoch.wait(epoch, std::memory_order_seq_cst);
+			this->m_sleeping.fetch_sub(1, std::memory_order_acq_rel);
+			spins = 0;
+		}
+		current_binding = {};
+	}
+
+public:
+	// `workers` background threads, on top of the bound thread. At least
+	// one, so work handed off by the bound thread always gets picked up.
+	explicit job_system(std::size_t workers =
+							std::max(2U, std::thread::hardware_concurrency()) -
+							1)
+	{
+		this->m_states.reserve(workers + 1);
+		for (std::size_t i = 0; i <= workers; ++i)
+		{
+			this->m_states.push_back(std::make_unique<worker_state>());
+			this->m_states.back()->random += static_cast<std::uint32_t>(i);
+		}
+		this->m_threads.reserve(workers);
+		for (std::size_t i = 1; i <= workers; ++i)
+		{
+			this->m_threads.emplace_back(
+				[this, i](const std::stop_token& stop) {
+					this->work(stop, i);
+				});
+		}
+	}
+
+	~job_system()
+	{
+		for (auto& thread : this->m_threads)
+		{
+			thread.request_stop();
+		}
+		this->m_epoch.fetch_add(1, std::memory_order_release);
+		this->m_epoch.notify_all();
+		this->m_threads.clear();
+		// Nobody is left to run what's still queued, do it here so every
+		// callable is destroyed and every counter reaches zero
+		while (auto* item = this->find_job(nullptr))
+		{
+			this->execute(item);
+		}
+		if (current_binding.system == this)
+		{
+			current_binding = {};
+		}
+	}
+
+	// Once, at startup, from the thread that will wait on most jobs
+	void bind_to_current_thread()
+	{
+		current_binding = {this, this->m_states.front().get()};
+	}
+
+	template <typename F>
+	void run(F&& work, job_counter& counter)
+	{
+		counter.m_pending.fetch_add(1, std::memory_order_relaxed);
+		auto* owner = this->self();
+		if (owner == nullptr)
+		{
+			auto* item = new job{};
+			item->heap = true;
+			item->counter = &counter;
+			emplace_job(*item, std::forward<F>(work));
+			{
+				const std::scoped_lock lock{this->m_injected_mutex};
+				this->m_injected.push_back(item);
+				this->m_injected_count.fetch_add(1, std::memory_order_release);
+			}
+			this->m_injected_total.fetch_add(1, std::memory_order_relaxed);
+			this->wake();
+			return;
+		}
+		auto& item = owner->pool[owner->next_job++ % worker_state::s_pool_size];
+		if (!item.free.load(std::memory_order_acquire))
+		{
+			this->m_inlined.fetch_add(1, std::memory_order_relaxed);
+			std::forward<F>(work)();
+			counter.m_pending.fetch_sub(1, std::memory_order_acq_rel);
+			return;
+		}
+		item.free.store(false, std::memory_order_relaxed);
+		item.counter = &counter;
+		emplace_job(item, std::forward<F>(work));
+		if (!owner->deque.push(&item))
+		{
+			this->m_inlined.fetch_add(1, std::memory_order_relaxed);
+			this->execute(&item);
+			return;
+		}
+		this->wake();
+	}
+
+	// Fire and forget, for work that reports back some other way
+	template <typename F>
+	void run(F&& work)
+	{
+		this->run(std::forward<F>(work), this->m_detached);
+	}
+
+	// Runs other jobs until the counter reaches zero
+	void wait(const job_counter& counter)
+	{
+		auto* owner = this->self();
+		while (!counter.done())
+		{
+			if (auto* item = this->find_job(owner))
+			{
+				this->execute(item);
+			}
+			else
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	// Splits [begin, end) into pieces of `grain` and calls body(first, last)
+	// for each of them in parallel. The caller runs the first piece and
+	// helps with the rest, it returns once all of them are done.
+	template <typename F>
+	void parallel_for(std::size_t begin, std::size_t end, std::size_t grain,
+					  F&& body)
+	{
+		if (begin >= end)
+		{
+			return;
+		}
+		grain = std::max<std::size_t>(grain, 1);
+		const auto pieces = (end - begin + grain - 1) / grain;
+		job_counter counter;
+		for (std::size_t i = 1; i < pieces; ++i)
+		{
+			const auto first = begin + i * grain;
+			const auto last = std::min(first + grain, end);
+			this->run([&body, first, last] { body(first, last); }, counter);
+		}
+		body(begin, std::min(begin + grain, end));
+		this->wait(counter);
+	}
+
+	// Including the bound thread
+	[[nodiscard]] std::size_t worker_count() const
+	{
+		return this->m_states.size();
+	}
+
+	[[nodiscard]] job_stats get_stats() const
+	{
+		return {
+			.executed = this->m_executed.load(std::memory_order_relaxed),
+			.stolen = this->m_stolen.load(std::memory_order_relaxed),
+			.inlined = this->m_inlined.load(std::memory_order_relaxed),
+			.injected = this->m_injected_total.load(std::memory_order_relaxed)};
+	}
+
+	job_system(const job_system&) = delete;
+	job_system(job_system&&) = delete;
+	job_system& operator=(const job_system&) = delete;
+	job_system& operator=(job_system&&) = delete;
+};
+
+// The scheduler everything shares, main binds the render thread to it
+auto jobs() -> job_system&
+{
+	static job_system instance{};
+	return instance;
+}
+} // namespace moonstone
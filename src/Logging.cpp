@@ -1,25 +1,539 @@
 module;
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <format>
 #include <fstream>
 #include <ios>
-#include <iostream>
+#include <iterator>
 #include <memory>
+#include <mutex>
 #include <print>
+#include <span>
+#include <stop_token>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
 
 export module moonstone:logging;
 
+import :memory_tracking;
+
+export namespace moonstone
+{
+enum class log_level : std::uint8_t
+{
+	trace,
+	info,
+	warn,
+	error
+};
+
+// A format string usable as a template argument, so every call site gets its
+// own static log_site and a record only has to carry a pointer to it
+template <std::size_t N>
+struct log_format
+{
+	std::array<char, N> text{};
+
+	consteval log_format(const char (&literal)[N])
+	{
+		std::ranges::copy(literal, this->text.begin());
+	}
+	[[nodiscard]] constexpr std::string_view view() const
+	{
+		return {this->text.data(), N - 1};
+	}
+};
+
+struct log_site
+{
+	log_level level;
+	std::string_view format;
+	// Decodes the payload back into the call's argument types and formats it
+	void (*write)(const log_site&, std::span<const std::byte>, std::string&);
+};
+
+// Fixed size so the rings are plain arrays, strings longer than what's left
+// of the payload are cut
+struct alignas(64) log_record
+{
+	const log_site* site{nullptr};
+	std::int64_t time{};
+	std::array<std::byte, 240> payload{};
+};
+static_assert(sizeof(log_record) == 256);
+} // namespace moonstone
+
+namespace moonstone
+{
+using log_clock = std::chrono::steady_clock;
+
+// Single producer (the thread that owns it), single consumer (the writer).
+// A full ring drops the record instead of waiting.
+class log_ring
+{
+	static constexpr std::size_t s_capacity = 1024;
+
+	std::unique_ptr<log_record[]> m_records{
+		std::make_unique<log_record[]>(s_capacity)};
+	alignas(64) std::atomic<std::size_t> m_head{0};
+	std::size_t m_cached_tail{0};
+	alignas(64) std::atomic<std::size_t> m_tail{0};
+	std::atomic<std::uint64_t> m_dropped{0};
+	std::atomic<bool> m_retired{false};
+	std::uint32_t m_thread;
+
+public:
+	explicit log_ring(std::uint32_t thread) : m_thread{thread}
+	{
+	}
+
+	// Producer side, returns null when the writer is too far behind
+	log_record* claim()
+	{
+		const auto head = this->m_head.load(std::memory_order_relaxed);
+		if (head - this->m_cached_tail == s_capacity)
+		{
+			this->m_cached_tail = this->m_tail.load(std::memory_order_acquire);
+			if (head - this->m_cached_tail == s_capacity)
+			{
+				this->m_dropped.fetch_add(1, std::memory_order_relaxed);
+				return nullptr;
+			}
+		}
+		return &this->m_records[head % s_capacity];
+	}
+	void publish()
+	{
+		this->m_head.fetch_add(1, std::memory_order_release);
+	}
+
+	// Consumer side
+	template <typename F>
+	void drain(F&& consume)
+	{
+		const auto head = this->m_head.load(std::memory_order_acquire);
+		auto tail = this->m_tail.load(std::memory_order_relaxed);
+		for (; tail != head; ++tail)
+		{
+			consume(this->m_records[tail % s_capacity], this->m_thread);
+		}
+		this->m_tail.store(tail, std::memory_order_release);
+	}
+
+	void retire()
+	{
+		this->m_retired.store(true, std::memory_order_release);
+	}
+	[[nodiscard]] bool is_finished() const
+	{
+		return this->m_retired.load(std::memory_order_acquire) &&
+			   this->m_head.load(std::memory_order_acquire) ==
+				   this->m_tail.load(std::memory_order_relaxed);
+	}
+	[[nodiscard]] std::uint64_t take_dropped()
+	{
+		return this->m_dropped.exchange(0, std::memory_order_relaxed);
+	}
+};
+
+class log_rings
+{
+	std::mutex m_mutex;
+	std::vector<std::shared_ptr<log_ring>> m_rings;
+	std::uint32_t m_next_thread{0};
+
+public:
+	auto add() -> std::shared_ptr<log_ring>
+	{
+		const std::scoped_lock lock{this->m_mutex};
+		auto ring = std::make_shared<log_ring>(this->m_next_thread++);
+		this->m_rings.push_back(ring);
+		return ring;
+	}
+
+	// Returns how many records were dropped since the last call
+	template <typename F>
+	auto drain(F&& consume) -> std::uint64_t
+	{
+		const std::scoped_lock lock{this->m_mutex};
+		std::uint64_t dropped = 0;
+		for (const auto& ring : this->m_rings)
+		{
+			ring->drain(consume);
+			dropped += ring->take_dropped();
+		}
+		std::erase_if(this->m_rings,
+					  [](const auto& ring) { return ring->is_finished(); });
+		return dropped;
+	}
+};
+
+auto rings() -> log_rings&
+{
+	static log_rings instance;
+	return instance;
+}
+
+// Registered on the thread's first log, retired when the thread exits so the
+// writer can drop it once it's empty
+struct ring_owner
+{
+	std::shared_ptr<log_ring> ring;
+
+	~ring_owner()
+	{
+		if (this->ring)
+		{
+			this->ring->retire();
+		}
+	}
+};
+
+auto local_ring() -> log_ring&
+{
+	thread_local ring_owner owner;
+	if (!owner.ring)
+	{
+		owner.ring = rings().add();
+	}
+	return *owner.ring;
+}
+
+// How an argument travels through the ring: anything string-like is copied
+// as length + characters, everything else has to be trivially copyable
+template <typename T>
+using log_arg =
+	std::conditional_t<std::is_convertible_v<const T&, std::string_view>,
+					   std::string_view, std::decay_t<T>>;
+
+template <typename T>
+constexpr bool is_text = std::is_same_v<log_arg<T>, std::string_view>;
+
+template <typename T>
+constexpr std::size_t fixed_size()
+{
+	if constexpr (is_text<T>)
+	{
+		return sizeof(std::uint16_t);
+	}
+	else
+	{
+		static_assert(std::is_trivially_copyable_v<T>,
+					  "log arguments are copied as bytes");
+		return sizeof(T);
+	}
+}
+
+// Fixed size arguments are written first so the strings can take whatever
+// is left without pushing anything out
+template <typename T>
+void encode_fixed(std::span<std::byte>& out, const T& value)
+{
+	if constexpr (!is_text<T>)
+	{
+		std::memcpy(out.data(), &value, sizeof(T));
+		out = out.subspan(sizeof(T));
+	}
+}
+
+// Every string still to come keeps room for its length
+template <typename T>
+void encode_text(std::span<std::byte>& out, std::size_t& texts_left,
+				 const T& value)
+{
+	if constexpr (is_text<T>)
+	{
+		const std::string_view text{value};
+		const auto length = static_cast<std::uint16_t>(std::min(
+			text.size(), out.size() - (texts_left * sizeof(std::uint16_t))));
+		--texts_left;
+		std::memcpy(out.data(), &length, sizeof(length));
+		std::memcpy(out.data() + sizeof(length), text.data(), length);
+		out = out.subspan(sizeof(length) + length);
+	}
+}
+
+template <typename T>
+void decode_fixed(std::span<const std::byte>& in, T& value)
+{
+	if constexpr (!std::is_same_v<T, std::string_view>)
+	{
+		std::memcpy(&value, in.data(), sizeof(T));
+		in = in.subspan(sizeof(T));
+	}
+}
+
+template <typename T>
+void decode_text(std::span<const std::byte>& in, T& value)
+{
+	if constexpr (std::is_same_v<T, std::string_view>)
+	{
+		std::uint16_t length = 0;
+		std::memcpy(&length, in.data(), sizeof(length));
+		value = {reinterpret_cast<const char*>(in.data() + sizeof(length)),
+				 length};
+		in = in.subspan(sizeof(length) + length);
+	}
+}
+
+template <typename... Args>
+void write_record(const log_site& site, std::span<const std::byte> payload,
+				  std::string& out)
+{
+	std::tuple<log_arg<Args>...> values;
+	std::apply(
+		[&](auto&... value) {
+			(decode_fixed(payload, value), ...);
+			(decode_text(payload, value), ...);
+		},
+		values);
+	std::apply(
+		[&](auto&... value) {
+			std::vformat_to(std::back_inserter(out),
+							site.format,
+							std::make_format_args(value...));
+		},
+		values);
+}
+
+auto level_name(log_level level) -> std::string_view
+{
+	switch (level)
+	{
+	case log_level::trace:
+		return "TRACE";
+	case log_level::info:
+		return "INFO";
+	case log_level::warn:
+		return "WARN";
+	case log_level::error:
+		return "ERROR";
+	}
+	return "?";
+}
+} // namespace moonstone
+
 export namespace moonstone
 {
-auto setup_logging() -> std::unique_ptr<std::ofstream>
+// Costs a thread_local lookup, a copy of the arguments into the thread's ring
+// and a release store. Formatting and file I/O happen on the log_writer's
+// thread. The format string is checked at compile time like std::format's.
+template <log_level Level, log_format Format, typename... Args>
+void log_message(const Args&... args)
+{
+	static_assert((fixed_size<Args>() + ... + 0) <=
+					  sizeof(log_record::payload),
+				  "too many log arguments for one record");
+	[[maybe_unused]] static constexpr std::format_string<log_arg<Args>...>
+		checked{Format.view()};
+	static constexpr log_site site{
+		Level, Format.view(), &write_record<Args...>};
+
+	auto& ring = local_ring();
+	auto* record = ring.claim();
+	if (record == nullptr)
+	{
+		return;
+	}
+	record->site = &site;
+	record->time = log_clock::now().time_since_epoch().count();
+	std::span<std::byte> out{record->payload};
+	std::size_t texts_left = (std::size_t{is_text<Args>} + ... + 0);
+	(encode_fixed(out, args), ...);
+	(encode_text(out, texts_left, args), ...);
+	ring.publish();
+}
+
+template <log_format Format, typename... Args>
+void log_trace(const Args&... args)
+{
+	log_message<log_level::trace, Format>(args...);
+}
+template <log_format Format, typename... Args>
+void log_info(const Args&... args)
+{
+	log_message<log_level::info, Format>(args...);
+}
+template <log_format Format, typename... Args>
+void log_warn(const Args&... args)
+{
+	log_message<log_level::warn, Format>(args...);
+}
+template <log_format Format, typename... Args>
+void log_error(const Args&... args)
+{
+	log_message<log_level::error, Format>(args...);
+}
+
+// Collects the records of every thread in batches, orders them by time and
+// appends them to the file. Records at `echo` or above also go to stderr.
+class log_writer
+{
+	std::ofstream m_file;
+	std::chrono::milliseconds m_interval;
+	log_level m_echo;
+	std::chrono::system_clock::time_point m_system_start{
+		std::chrono::system_clock::now()};
+	log_clock::time_point m_steady_start{log_clock::now()};
+	std::vector<std::pair<log_record, std::uint32_t>> m_batch;
+	std::string m_text;
+	std::string m_echoed;
+	std::mutex m_flush_mutex;
+	std::jthread m_thread;
+	// The running writer, for flush_logs
+	static inline std::atomic<log_writer*> s_active{nullptr};
+
+	void flush()
+	{
+		const std::scoped_lock lock{this->m_flush_mutex};
+		this->m_batch.clear();
+		const auto dropped = rings().drain(
+			[this](const log_record& record, std::uint32_t thread) {
+				this->m_batch.emplace_back(record, thread);
+			});
+		std::ranges::stable_sort(this->m_batch, {}, [](const auto& entry) {
+			return entry.first.time;
+		});
+
+		this->m_text.clear();
+		this->m_echoed.clear();
+		for (const auto& [record, thread] : this->m_batch)
+		{
+			const auto since_start =
+				log_clock::time_point{log_clock::duration{record.time}} -
+				this->m_steady_start;
+			const auto time = std::chrono::floor<std::chrono::microseconds>(
+				this->m_system_start +
+				std::chrono::duration_cast<std::chrono::system_clock::duration>(
+					since_start));
+			const auto start = this->m_text.size();
+			std::format_to(std::back_inserter(this->m_text),
+						   "{:%F %T} [{}][t{}]: ",
+						   time,
+						   level_name(record.site->level),
+						   thread);
+			record.site->write(*record.site, record.payload, this->m_text);
+			this->m_text += '\n';
+			if (record.site->level >= this->m_echo)
+			{
+				this->m_echoed.append(this->m_text, start);
+			}
+		}
+		if (dropped != 0)
+		{
+			std::format_to(std::back_inserter(this->m_text),
+						   "[LOG]: {} records dropped, a ring was full\n",
+						   dropped);
+		}
+		if (!this->m_text.empty())
+		{
+			this->m_file.write(
+				this->m_text.data(),
+				static_cast<std::streamsize>(this->m_text.size()));
+			this->m_file.flush();
+		}
+		if (!this->m_echoed.empty())
+		{
+			std::fwrite(
+				this->m_echoed.data(), 1, this->m_echoed.size(), stderr);
+		}
+	}
+
+	void run(const std::stop_token& stop)
+	{
+		const memory_scope scope{memory_tag::logging};
+		std::mutex mutex;
+		std::condition_variable_any wake;
+		while (!stop.stop_requested())
+		{
+			{
+				std::unique_lock lock{mutex};
+				wake.wait_for(
+					lock, stop, this->m_interval, [] { return false; });
+			}
+			this->flush();
+		}
+	}
+
+public:
+	explicit log_writer(const std::string& path,
+						std::chrono::milliseconds interval =
+							std::chrono::milliseconds{5},
+						log_level echo = log_level::info) :
+		m_file{path, std::ios::app},
+		m_interval{interval},
+		m_echo{echo}
+	{
+		this->m_file << std::format("\n===================\n{}\n"
+									"===================\n",
+									this->m_system_start);
+		this->m_thread = std::jthread{
+			[this](const std::stop_token& stop) { this->run(stop); }};
+		s_active.store(this, std::memory_order_release);
+	}
+	~log_writer()
+	{
+		this->close();
+	}
+
+	// Stops the thread after writing whatever is still queued
+	void close()
+	{
+		auto* self = this;
+		s_active.compare_exchange_strong(
+			self, nullptr, std::memory_order_acq_rel);
+		if (this->m_thread.joinable())
+		{
+			this->m_thread.request_stop();
+			this->m_thread.join();
+			this->flush();
+		}
+		if (this->m_file.is_open())
+		{
+			this->m_file.close();
+		}
+	}
+
+	static void flush_active()
+	{
+		if (auto* writer = s_active.load(std::memory_order_acquire))
+		{
+			writer->flush();
+		}
+	}
+
+	log_writer(const log_writer&) = delete;
+	log_writer(log_writer&&) = delete;
+	log_writer& operator=(const log_writer&) = delete;
+	log_writer& operator=(log_writer&&) = delete;
+};
+
+// Writes whatever was logged so far right away, for errors that end the
+// process before the writer's next pass
+void flush_logs()
+{
+	log_writer::flush_active();
+}
+
+auto setup_logging() -> std::unique_ptr<log_writer>
 {
-	const std::string file{"log.txt"};
-	auto logging_file = std::make_unique<std::ofstream>(file, std::ios::app);
+	auto writer = std::make_unique<log_writer>("log.txt");
 	auto current = std::chrono::system_clock::now();
 	std::println("\n===================");
 	std::println("{}", current);
 	std::println("===================");
-	return logging_file;
+	return writer;
 }
 } // namespace moonstone
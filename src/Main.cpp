@@ -6,9 +6,16 @@
 * ===============
 */
 
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <filesystem>
 #include <glm/glm.hpp>
 #include <iostream>
+#include <memory>
+#include <print>
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 #include <imgui.h>
@@ -22,6 +29,22 @@ int main()
 	//                    Initialization
 	// =======================================================
 	auto logger = moonstone::setup_logging();
+	moonstone::frame_memory().bind_to_current_thread();
+	moonstone::mark_render_thread();
+	// The render thread is worker 0, it runs jobs while it waits on them
+	moonstone::jobs().bind_to_current_thread();
+	// Tasks that `co_await on_render_thread()` continue in the main loop
+	moonstone::render_tasks().bind_to_current_thread();
+	// Packed builds ship everything in one archive, loose files still work
+	// for anything it doesn't contain
+	if (std::filesystem::exists("game.pack"))
+	{
+		auto mounted = moonstone::files().mount_pack("game.pack");
+		if (!mounted.has_value())
+		{
+			moonstone::log_error<"{}">(mounted.error().format());
+		}
+	}
 	[[maybe_unused]] auto library = glfwInit();
 	const moonstone::window_properties props{.width = 800,
 											 .height = 800,
@@ -31,22 +54,78 @@ int main()
 	moonstone::window window{props};
 	moonstone::external::imgui::init_imgui(window.get_glfw_window());
 	moonstone::renderer::renderer renderer{window};
+	constexpr std::size_t texture_budget = 256UZ * 1024 * 1024;
+	moonstone::renderer::residency_manager residency{texture_budget};
+	moonstone::renderer::asset_cache assets{residency};
+	moonstone::renderer::shader_reloader shader_reloader{window};
+	assets.set_shader_reloader(shader_reloader);
+	// vsync is off, the cap keeps the loop from spinning a whole core
+	float frame_cap = 240.0F;
+	moonstone::engine::frame_clock frame_clock{
+		{.simulation_rate = 60.0, .frame_cap = frame_cap}};
+	moonstone::frame_statistics engine_stats{};
+	// Frames the current scene has been running for, once it's past the
+	// warm up every allocation on this thread is flagged
+	constexpr std::uint32_t warm_up_frames = 120;
+	std::uint32_t settled_frames = 0;
+	const moonstone::scene* settled_scene = nullptr;
 
 	// =======================================================
 	//                       Testing
 	// =======================================================
 
-	moonstone::scenes::clear_color clear_screen_scene{};
-	moonstone::scenes::texture texture_scene{renderer};
-
-	moonstone::scene::register_scene(texture_scene);
-	moonstone::scene::register_scene(clear_screen_scene);
-
-	// =======================================================
-
-	auto& tests = moonstone::scene::registered_scenes;
-	moonstone::scene base_reference{};
-	std::reference_wrapper<moonstone::scene> current_test = base_reference;
+	// Nothing is constructed until it's selected, the registry preloads the
+	// assets of the others in the background meanwhile
+	moonstone::scene_registry tests{};
+	tests.add({.name = moonstone::scenes::texture::s_name,
+			   .preload =
+				   [&assets]() { moonstone::scenes::texture::preload(assets); },
+			   .load = [&renderer, &assets]() {
+				   return moonstone::scenes::texture::load(renderer, assets);
+			   }});
+	tests.add({.name = moonstone::scenes::sprites::s_name,
+			   .preload =
+				   [&assets]() { moonstone::scenes::sprites::preload(assets); },
+			   .create = [&renderer, &assets]() {
+				   return std::make_unique<moonstone::scenes::sprites>(renderer,
+																	   assets);
+			   }});
+	tests.add({.name = moonstone::scenes::tilemap::s_name,
+			   .preload =
+				   [&assets]() { moonstone::scenes::tilemap::preload(assets); },
+			   .create = [&renderer, &assets]() {
+				   return std::make_unique<moonstone::scenes::tilemap>(renderer,
+																	   assets);
+			   }});
+	tests.add({.name = moonstone::scenes::text::s_name,
+			   .preload =
+				   [&assets]() { moonstone::scenes::text::preload(assets); },
+			   .create = [&renderer, &assets]() {
+				   return std::make_unique<moonstone::scenes::text>(renderer,
+																	assets);
+			   }});
+	tests.add({.name = moonstone::scenes::particles::s_name,
+			   .preload =
+				   [&assets]() {
+					   moonstone::scenes::particles::preload(assets);
+				   },
+			   .create = [&renderer, &assets]() {
+				   return std::make_unique<moonstone::scenes::particles>(
+					   renderer, assets);
+			   }});
+	tests.add({.name = moonstone::scenes::animation::s_name,
+			   .preload =
+				   [&assets]() {
+					   moonstone::scenes::animation::preload(assets);
+				   },
+			   .create = [&renderer, &assets]() {
+				   return std::make_unique<moonstone::scenes::animation>(
+					   renderer, assets);
+			   }});
+	tests.add({.name = moonstone::scenes::clear_color::s_name,
+			   .create = []() {
+				   return std::make_unique<moonstone::scenes::clear_color>();
+			   }});
 
 	// =======================================================
 	//                      Main Loop
@@ -54,14 +133,41 @@ int main()
 
 	while (window.loop())
 	{
+		frame_clock.begin_frame();
+		auto frame_result = renderer.begin_frame();
+		if (!frame_result.has_value())
+		{
+			moonstone::log_error<"{}">(frame_result.error().format());
+		}
 		renderer.clear();
-		if (nullptr != current_test.get().get_name())
+		moonstone::render_tasks().resume_all();
+		auto scene_result = tests.update();
+		if (!scene_result.has_value())
+		{
+			moonstone::log_error<"{}">(scene_result.error().format());
+		}
+		auto* current_test = tests.current();
+		if (current_test != settled_scene || tests.loading().has_value())
+		{
+			settled_scene = current_test;
+			settled_frames = 0;
+		}
+		settled_frames = std::min(settled_frames + 1, warm_up_frames);
+		moonstone::set_steady_state(settled_frames >= warm_up_frames);
+		if (nullptr != current_test)
 		{
-			current_test.get().on_update(0.0F);
-			current_test.get().on_render();
+			while (frame_clock.step())
+			{
+				current_test->on_update(frame_clock.get_step());
+			}
+			current_test->on_render(frame_clock.get_alpha());
 		}
 		else
 		{
+			// Nothing to simulate, don't count the time as dropped
+			while (frame_clock.step())
+			{
+			}
 			renderer.clear({0.1F, 0.1F, 0.1F, 0.1F});
 		}
 
@@ -69,16 +175,181 @@ int main()
 		ImGui::Text("OpenGL Test Application");
 		auto framerate = ImGui::GetIO().Framerate;
 		ImGui::Text("Framerate %.2f", framerate);
+		const auto frame_stats = frame_clock.get_stats();
+		ImGui::Text("Frame ms avg %.2f, p50 %.2f, p95 %.2f, p99 %.2f, worst "
+					"%.2f",
+					frame_stats.average,
+					frame_stats.p50,
+					frame_stats.p95,
+					frame_stats.p99,
+					frame_stats.worst);
+		ImGui::Text("Pacing error avg %.3f ms, worst %.3f ms, %llu dropped "
+					"steps",
+					frame_stats.pacing_average,
+					frame_stats.pacing_worst,
+					static_cast<unsigned long long>(frame_stats.dropped_steps));
+		if (ImGui::SliderFloat("Frame cap (0 = off)", &frame_cap, 0.0F, 500.0F))
+		{
+			frame_clock.set_frame_cap(frame_cap);
+		}
+		const auto residency_stats = residency.get_stats();
+		ImGui::Text("Texture memory %.2f / %.2f MiB, %zu evicted, %llu "
+					"evictions",
+					static_cast<double>(residency_stats.resident_bytes) /
+						(1024.0 * 1024.0),
+					static_cast<double>(residency_stats.budget_bytes) /
+						(1024.0 * 1024.0),
+					residency_stats.evicted_count,
+					static_cast<unsigned long long>(residency_stats.evictions));
+		const auto file_stats = moonstone::files().get_stats();
+		using milliseconds = std::chrono::duration<double, std::milli>;
+		const double average_load =
+			file_stats.loads == 0
+				? 0.0
+				: milliseconds{file_stats.total_latency}.count() /
+					  static_cast<double>(file_stats.loads);
+		ImGui::Text("Files loaded %llu (%.2f MiB), %.3f ms avg, slowest %s "
+					"%.3f ms",
+					static_cast<unsigned long long>(file_stats.loads),
+					static_cast<double>(file_stats.bytes) / (1024.0 * 1024.0),
+					average_load,
+					file_stats.slowest.path.c_str(),
+					milliseconds{file_stats.slowest.latency}.count());
+		ImGui::Text("Shader reloads %llu, %llu failed, %zu compiling",
+					static_cast<unsigned long long>(
+						shader_reloader.get_reloads()),
+					static_cast<unsigned long long>(
+						shader_reloader.get_failures()),
+					shader_reloader.get_pending());
+		if (!moonstone::stats_enabled)
+		{
+			ImGui::TextDisabled("Engine stats are off (MOONSTONE_STATS)");
+		}
+		else if (ImGui::CollapsingHeader("Engine stats") &&
+				 ImGui::BeginTable("engine_stats", 5))
+		{
+			ImGui::TableSetupColumn("Counter");
+			ImGui::TableSetupColumn("Last");
+			ImGui::TableSetupColumn("Min");
+			ImGui::TableSetupColumn("Avg");
+			ImGui::TableSetupColumn("P99");
+			ImGui::TableHeadersRow();
+			for (std::size_t i = 0; i < moonstone::counter_count; ++i)
+			{
+				const auto summary =
+					engine_stats.summary(static_cast<moonstone::counter>(i));
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn();
+				ImGui::TextUnformatted(moonstone::counter_names.at(i).data());
+				auto cell = [](std::uint64_t value) {
+					ImGui::TableNextColumn();
+					ImGui::Text("%llu", static_cast<unsigned long long>(value));
+				};
+				cell(summary.last);
+				cell(summary.min);
+				ImGui::TableNextColumn();
+				ImGui::Text("%.1f", summary.average);
+				cell(summary.p99);
+			}
+			ImGui::EndTable();
+			moonstone::error::result<> exported{};
+			if (ImGui::Button("Export CSV"))
+			{
+				exported = engine_stats.write_csv("frame_stats.csv");
+			}
+			ImGui::SameLine();
+			if (ImGui::Button("Export JSON"))
+			{
+				exported = engine_stats.write_json("frame_stats.json");
+			}
+			if (!exported.has_value())
+			{
+				moonstone::log_error<"{}">(exported.error().format());
+			}
+		}
+		const auto job_stats = moonstone::jobs().get_stats();
+		ImGui::Text("Jobs %llu on %zu threads, %llu stolen, %llu inlined",
+					static_cast<unsigned long long>(job_stats.executed),
+					moonstone::jobs().worker_count(),
+					static_cast<unsigned long long>(job_stats.stolen),
+					static_cast<unsigned long long>(job_stats.inlined));
+		const auto arena = moonstone::frame_memory().get_stats();
+		ImGui::Text("Frame arena %zu / %zu KiB, peak %zu KiB, %llu overflows",
+					arena.used / 1024,
+					arena.capacity / 1024,
+					arena.peak / 1024,
+					static_cast<unsigned long long>(arena.overflows));
+		if (!moonstone::tracking_enabled)
+		{
+			ImGui::TextDisabled(
+				"Allocation tracking is off (MOONSTONE_TRACK_ALLOCATIONS)");
+		}
+		else if (ImGui::CollapsingHeader("Memory") &&
+				 ImGui::BeginTable("memory_tags", 5))
+		{
+			ImGui::TableSetupColumn("Tag");
+			ImGui::TableSetupColumn("Live KiB");
+			ImGui::TableSetupColumn("Peak KiB");
+			ImGui::TableSetupColumn("Frame");
+			ImGui::TableSetupColumn("Steady");
+			ImGui::TableHeadersRow();
+			std::uint64_t steady_total = 0;
+			for (std::size_t i = 0; i < moonstone::memory_tag_count; ++i)
+			{
+				const auto tag = moonstone::get_memory_stats(
+					static_cast<moonstone::memory_tag>(i));
+				steady_total += tag.steady_allocations;
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn();
+				ImGui::TextUnformatted(
+					moonstone::memory_tag_names.at(i).data());
+				ImGui::TableNextColumn();
+				ImGui::Text("%zu", tag.live_bytes / 1024);
+				ImGui::TableNextColumn();
+				ImGui::Text("%zu", tag.peak_bytes / 1024);
+				ImGui::TableNextColumn();
+				ImGui::Text(
+					"%llu",
+					static_cast<unsigned long long>(tag.frame_allocations));
+				ImGui::TableNextColumn();
+				ImGui::Text(
+					"%llu",
+					static_cast<unsigned long long>(tag.steady_allocations));
+			}
+			ImGui::EndTable();
+			ImGui::Text("%llu allocations after warm up",
+						static_cast<unsigned long long>(steady_total));
+			if (ImGui::Button("Export memory report"))
+			{
+				// Writing the report allocates, don't flag it
+				moonstone::set_steady_state(false);
+				auto exported =
+					moonstone::write_memory_report("memory_report.json");
+				if (!exported.has_value())
+				{
+					moonstone::log_error<"{}">(exported.error().format());
+				}
+				settled_frames = 0;
+			}
+		}
 		ImGui::Separator();
-		if (current_test.get().get_name() != nullptr)
+		if (current_test != nullptr)
 		{
 			ImGui::Text("Test Properties:");
 			ImGui::Separator();
-			current_test.get().on_imgui_render();
+			current_test->on_imgui_render();
 			ImGui::Separator();
 			if (ImGui::Button("Back"))
 			{
-				current_test = base_reference;
+				tests.select_none();
+			}
+		}
+		else if (auto loading = tests.loading())
+		{
+			ImGui::Text("Loading %s...", tests.name(*loading));
+			if (ImGui::Button("Back"))
+			{
+				tests.select_none();
 			}
 		}
 		else
@@ -86,18 +357,42 @@ int main()
 			ImGui::Text("Tests Available:");
 			ImGui::BeginGroup();
 #pragma unroll 2
-			for (auto& element : tests)
+			for (std::size_t i = 0; i < tests.size(); ++i)
 			{
-				if (ImGui::Button(element.get().get_name()))
+				if (ImGui::Button(tests.name(i)))
+				{
+					tests.select(i);
+				}
+				if (tests.state(i) == moonstone::scene_state::preloaded)
 				{
-					current_test = element;
+					ImGui::SameLine();
+					ImGui::TextDisabled("(preloaded)");
+				}
+				else if (tests.state(i) == moonstone::scene_state::loading)
+				{
+					ImGui::SameLine();
+					ImGui::TextDisabled("(loading)");
 				}
 			}
 			ImGui::EndGroup();
 		}
 
 		moonstone::external::imgui::end_render_imgui();
+		auto residency_result = residency.update();
+		if (!residency_result.has_value())
+		{
+			moonstone::log_error<"{}">(residency_result.error().format());
+		}
+		auto reload_result = shader_reloader.update();
+		if (!reload_result.has_value())
+		{
+			moonstone::log_error<"{}">(reload_result.error().format());
+		}
 		renderer.update_buffers();
+		engine_stats.end_frame();
+		moonstone::frame_memory().reset();
+		moonstone::end_memory_frame();
+		frame_clock.end_frame();
 	}
 	moonstone::external::imgui::cleanup_imgui();
 	logger->close();
@@ -0,0 +1,359 @@
+module;
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <expected>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <new>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+export module moonstone:memory_tracking;
+
+import :error;
+import :stats;
+
+export namespace moonstone
+{
+enum class memory_tag : std::uint8_t
+{
+	untagged,
+	renderer,
+	buffers,
+	textures,
+	shaders,
+	assets,
+	scenes,
+	logging,
+	count
+};
+constexpr std::size_t memory_tag_count = std::to_underlying(memory_tag::count);
+constexpr std::array<std::string_view, memory_tag_count> memory_tag_names{
+	"untagged",
+	"renderer",
+	"buffers",
+	"textures",
+	"shaders",
+	"assets",
+	"scenes",
+	"logging"};
+
+#ifdef MOONSTONE_TRACK_ALLOCATIONS
+constexpr bool tracking_enabled = true;
+#else
+constexpr bool tracking_enabled = false;
+#endif
+
+struct memory_tag_stats
+{
+	std::uint64_t allocations{};
+	std::uint64_t frees{};
+	std::size_t live_bytes{};
+	std::size_t peak_bytes{};
+	// During the last finished frame
+	std::uint64_t frame_allocations{};
+	// Made on the render thread while the loop was marked steady
+	std::uint64_t steady_allocations{};
+};
+
+struct flagged_allocation
+{
+	memory_tag tag{};
+	std::size_t size{};
+	std::uint64_t frame{};
+	// Return address of operator new, resolve with addr2line
+	const void* caller{nullptr};
+};
+} // namespace moonstone
+
+namespace moonstone
+{
+struct tag_counters
+{
+	std::atomic<std::uint64_t> allocations{0};
+	std::atomic<std::uint64_t> frees{0};
+	std::atomic<std::size_t> live_bytes{0};
+	std::atomic<std::size_t> peak_bytes{0};
+	std::atomic<std::uint64_t> frame_allocations{0};
+	std::atomic<std::uint64_t> last_frame_allocations{0};
+	std::atomic<std::uint64_t> steady_allocations{0};
+};
+
+// Nothing in here may allocate, it all runs inside operator new
+std::array<tag_counters, memory_tag_count> tag_totals{};
+thread_local memory_tag current_tag{memory_tag::untagged};
+thread_local bool is_render_thread{false};
+std::atomic<bool> steady_state{false};
+std::atomic<std::uint64_t> tracked_frame{0};
+// Only the render thread flags allocations, so it's the only writer
+constexpr std::size_t flagged_capacity = 64;
+std::array<flagged_allocation, flagged_capacity> flagged{};
+std::uint64_t flagged_count{0};
+
+// Stored in front of every tracked block so delete knows its size and tag
+struct alignas(16) allocation_header
+{
+	std::size_t size;
+	std::uint32_t offset;
+	memory_tag tag;
+};
+
+auto header_size(std::size_t alignment) -> std::size_t
+{
+	return std::max(sizeof(allocation_header), alignment);
+}
+
+void record_allocation(memory_tag tag, std::size_t size, const void* caller)
+{
+	auto& totals = tag_totals.at(std::to_underlying(tag));
+	totals.allocations.fetch_add(1, std::memory_order_relaxed);
+	totals.frame_allocations.fetch_add(1, std::memory_order_relaxed);
+	const auto live =
+		totals.live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+	auto peak = totals.peak_bytes.load(std::memory_order_relaxed);
+	while (live > peak && !totals.peak_bytes.compare_exchange_weak(
+							  peak, live, std::memory_order_relaxed))
+	{
+	}
+	if (is_render_thread && steady_state.load(std::memory_order_relaxed))
+	{
+		totals.steady_allocations.fetch_add(1, std::memory_order_relaxed);
+		flagged.at(flagged_count % flagged_capacity) = {
+			.tag = tag,
+			.size = size,
+			.frame = tracked_frame.load(std::memory_order_relaxed),
+			.caller = caller};
+		++flagged_count;
+	}
+}
+
+void record_free(memory_tag tag, std::size_t size)
+{
+	auto& totals = tag_totals.at(std::to_underlying(tag));
+	totals.frees.fetch_add(1, std::memory_order_relaxed);
+	totals.live_bytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+#ifdef MOONSTONE_TRACK_ALLOCATIONS
+auto tracked_allocate(std::size_t size, std::size_t alignment,
+					  const void* caller) -> void*
+{
+	count(counter::allocations);
+	const auto header = header_size(alignment);
+	const auto total = (size + header + alignment - 1) / alignment * alignment;
+	auto* raw = static_cast<std::byte*>(
+		alignment <= alignof(std::max_align_t)
+			? std::malloc(total)
+			: std::aligned_alloc(alignment, total));
+	if (raw == nullptr)
+	{
+		return nullptr;
+	}
+	auto* user = raw + header;
+	*reinterpret_cast<allocation_header*>(
+		user - sizeof(allocation_header)) = {
+		.size = size,
+		.offset = static_cast<std::uint32_t>(header),
+		.tag = current_tag};
+	record_allocation(current_tag, size, caller);
+	return user;
+}
+
+void tracked_free(void* pointer)
+{
+	if (pointer == nullptr)
+	{
+		return;
+	}
+	auto* user = static_cast<std::byte*>(pointer);
+	const auto header = *reinterpret_cast<const allocation_header*>(
+		user - sizeof(allocation_header));
+	record_free(header.tag, header.size);
+	std::free(user - header.offset);
+}
+#endif
+
+auto memory_error(std::string message) -> error::gl_error
+{
+	return error::gl_error{
+		"MEMORY", {}, "ERROR", 0, "HIGH", std::move(message)};
+}
+} // namespace moonstone
+
+export namespace moonstone
+{
+// Attributes the allocations made on this thread to `tag` until it goes out
+// of scope. Nests, the previous tag comes back after.
+class memory_scope
+{
+	memory_tag m_previous;
+
+public:
+	explicit memory_scope(memory_tag tag) : m_previous{current_tag}
+	{
+		current_tag = tag;
+	}
+	~memory_scope()
+	{
+		current_tag = this->m_previous;
+	}
+
+	memory_scope(const memory_scope&) = delete;
+	memory_scope(memory_scope&&) = delete;
+	memory_scope& operator=(const memory_scope&) = delete;
+	memory_scope& operator=(memory_scope&&) = delete;
+};
+
+// Call from the render thread once at startup
+void mark_render_thread()
+{
+	is_render_thread = true;
+}
+
+// While set, every allocation the render thread makes is flagged. Main sets
+// it once the loop is warmed up, nothing should allocate from then on.
+void set_steady_state(bool steady)
+{
+	steady_state.store(steady, std::memory_order_relaxed);
+}
+
+// Rolls the per frame allocation counts, once per frame
+void end_memory_frame()
+{
+	for (auto& totals : tag_totals)
+	{
+		totals.last_frame_allocations.store(
+			totals.frame_allocations.exchange(0, std::memory_order_relaxed),
+			std::memory_order_relaxed);
+	}
+	tracked_frame.fetch_add(1, std::memory_order_relaxed);
+}
+
+[[nodiscard]] memory_tag_stats get_memory_stats(memory_tag tag)
+{
+	const auto& totals = tag_totals.at(std::to_underlying(tag));
+	return {
+		.allocations = totals.allocations.load(std::memory_order_relaxed),
+		.frees = totals.frees.load(std::memory_order_relaxed),
+		.live_bytes = totals.live_bytes.load(std::memory_order_relaxed),
+		.peak_bytes = totals.peak_bytes.load(std::memory_order_relaxed),
+		.frame_allocations =
+			totals.last_frame_allocations.load(std::memory_order_relaxed),
+		.steady_allocations =
+			totals.steady_allocations.load(std::memory_order_relaxed)};
+}
+
+// The most recent flagged allocations, oldest first. Render thread only.
+[[nodiscard]] auto get_flagged_allocations() -> std::vector<flagged_allocation>
+{
+	const auto kept = std::min<std::uint64_t>(flagged_count, flagged_capacity);
+	std::vector<flagged_allocation> result;
+	result.reserve(kept);
+	for (auto i = flagged_count - kept; i < flagged_count; ++i)
+	{
+		result.push_back(flagged.at(i % flagged_capacity));
+	}
+	return result;
+}
+
+// JSON, so the benchmarks can compare runs and fail on regressions
+error::result<> write_memory_report(const std::filesystem::path& path)
+{
+	std::ofstream out{path, std::ios::trunc};
+	if (!out)
+	{
+		return std::unexpected(
+			memory_error(std::format("{}: can't write", path.string())));
+	}
+	out << std::format("{{\n  \"tracking\": {},\n  \"tags\": {{",
+					   tracking_enabled);
+	std::uint64_t steady_total = 0;
+	for (std::size_t i = 0; i < memory_tag_count; ++i)
+	{
+		const auto stats = get_memory_stats(static_cast<memory_tag>(i));
+		steady_total += stats.steady_allocations;
+		out << std::format(
+			"{}\n    \"{}\": {{\"allocations\": {}, \"frees\": {}, "
+			"\"live_bytes\": {}, \"peak_bytes\": {}, "
+			"\"frame_allocations\": {}, \"steady_allocations\": {}}}",
+			i == 0 ? "" : ",",
+			memory_tag_names.at(i),
+			stats.allocations,
+			stats.frees,
+			stats.live_bytes,
+			stats.peak_bytes,
+			stats.frame_allocations,
+			stats.steady_allocations);
+	}
+	out << std::format("\n  }},\n  \"steady_allocations\": {},\n"
+					   "  \"flagged\": [",
+					   steady_total);
+	bool first = true;
+	for (const auto& allocation : get_flagged_allocations())
+	{
+		out << std::format("{}\n    {{\"tag\": \"{}\", \"size\": {}, "
+						   "\"frame\": {}, \"caller\": \"{}\"}}",
+						   first ? "" : ",",
+						   memory_tag_names.at(
+							   std::to_underlying(allocation.tag)),
+						   allocation.size,
+						   allocation.frame,
+						   allocation.caller);
+		first = false;
+	}
+	out << "\n  ]\n}\n";
+	return {};
+}
+} // namespace moonstone
+
+// Replaceable allocation functions are attached to the global module even
+// when declared here. Opt in only, a default build keeps the system
+// allocator untouched.
+#ifdef MOONSTONE_TRACK_ALLOCATIONS
+void* operator new(std::size_t size)
+{
+	if (void* pointer = moonstone::tracked_allocate(
+			size == 0 ? 1 : size,
+			alignof(std::max_align_t),
+			__builtin_return_address(0)))
+	{
+		return pointer;
+	}
+	throw std::bad_alloc{};
+}
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	if (void* pointer = moonstone::tracked_allocate(
+			size == 0 ? 1 : size,
+			static_cast<std::size_t>(alignment),
+			__builtin_return_address(0)))
+	{
+		return pointer;
+	}
+	throw std::bad_alloc{};
+}
+void operator delete(void* pointer) noexcept
+{
+	moonstone::tracked_free(pointer);
+}
+void operator delete(void* pointer, std::size_t) noexcept
+{
+	moonstone::tracked_free(pointer);
+}
+void operator delete(void* pointer, std::align_val_t) noexcept
+{
+	moonstone::tracked_free(pointer);
+}
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept
+{
+	moonstone::tracked_free(pointer);
+}
+#endif
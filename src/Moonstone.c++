@@ -3,14 +3,29 @@ export module moonstone;
 export import :scene;
 export import :window;
 export import :utility;
+export import :hash;
+export import :file_system;
+export import :asset_pack;
 export import :logging;
+export import :stats;
+export import :frame_arena;
+export import :memory_tracking;
+export import :jobs;
+export import :task;
 export import :error;
 // partitions
 export import external;
 // renderer stuff
 export import :shader;
+export import :shader_preprocessor;
+export import :program_cache;
+export import :shader_reload;
+export import :uniform_buffer;
 export import :texture;
 export import :texture_array;
+export import :mipmap;
+export import :residency;
+export import :asset_cache;
 export import :vertex_element;
 export import :vertex_buffer;
 export import :vertex_array;
@@ -21,4 +36,13 @@ export import :call;
 export import :sync_buffer;
 export import :sync_buffer_connection;
 // engine stuff
+export import :spatial_grid;
+export import :camera;
+export import :tilemap;
+export import :text;
+export import :particles;
+export import :animation;
 export import :quad;
+export import :frame_clock;
+export import :ecs;
+export import :sprites;
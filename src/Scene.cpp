@@ -1,26 +1,39 @@
 module;
 
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <expected>
 #include <functional>
+#include <memory>
+#include <optional>
+#include <string>
 #include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
 
 export module moonstone:scene;
 
 import :error;
+import :memory_tracking;
+import :task;
 
 export namespace moonstone
 {
 class scene
 {
 public:
-	static std::vector<std::reference_wrapper<scene>> registered_scenes;
 	scene() = default;
 	virtual ~scene() = default;
+	// Runs at the fixed simulation rate, delta_time is always the same
 	virtual error::result<> on_update(float delta_time)
 	{
 		return {};
 	};
-	virtual error::result<> on_render()
+	// `alpha` is how far the frame is between the last update and the next
+	// one, for interpolating what moved
+	virtual error::result<> on_render(float alpha)
 	{
 		return {};
 	};
@@ -36,12 +49,269 @@ public:
 	{
 		return nullptr;
 	};
-	static void register_scene(scene& scene)
+};
+
+enum class scene_state
+{
+	unloaded,
+	preloading,
+	preloaded,
+	// The load coroutine is running
+	loading,
+	loaded
+};
+
+// How to build a scene without building it yet. `preload` runs on a worker
+// and should only do CPU work, usually asking the asset_cache to decode what
+// the scene is going to use. `create` runs on the GL thread. `load` replaces
+// `create` for scenes that build themselves across frames, switching
+// between workers and the GL thread as they go.
+struct scene_factory
+{
+	const char* name{nullptr};
+	std::function<void()> preload;
+	std::function<std::unique_ptr<scene>()> create;
+	std::function<task<std::unique_ptr<scene>>()> load;
+};
+
+// Scenes are only constructed the first time they're selected. While one is
+// shown the next unloaded scene is preloaded in the background, so opening it
+// later mostly costs the GL uploads.
+class scene_registry
+{
+	struct entry
 	{
-		registered_scenes.emplace_back(scene);
+		scene_factory factory;
+		scene_state state{scene_state::unloaded};
+		std::optional<task<>> preloading;
+		std::optional<task<std::unique_ptr<scene>>> loading;
+		std::unique_ptr<scene> instance;
+		// Not retried in the background, selecting it again does
+		bool failed{false};
+	};
+
+	std::vector<entry> m_entries;
+	std::optional<std::size_t> m_selected;
+	bool m_background_preload{true};
+
+	static auto scene_error(const entry& failed, std::string_view what)
+		-> error::gl_error
+	{
+		return error::gl_error{"SCENE",
+							   {},
+							   "ERROR",
+							   0,
+							   "HIGH",
+							   std::string{failed.factory.name} + ": " +
+								   std::string{what}};
+	}
+
+	static auto run_preload(std::function<void()> preload) -> task<>
+	{
+		co_await on_workers();
+		const memory_scope scope{memory_tag::assets};
+		preload();
+	}
+
+	void start_preload(entry& target)
+	{
+		target.state = scene_state::preloading;
+		if (!target.factory.preload)
+		{
+			target.state = scene_state::preloaded;
+			return;
+		}
+		target.preloading.emplace(run_preload(target.factory.preload));
+		target.preloading->start();
+	}
+
+	// Clears the selection if it was the one that failed
+	auto fail(entry& failed, std::string_view what) -> error::gl_error
+	{
+		failed.state = scene_state::unloaded;
+		failed.failed = true;
+		if (this->m_selected.has_value() &&
+			&this->m_entries.at(*this->m_selected) == &failed)
+		{
+			this->m_selected.reset();
+		}
+		return scene_error(failed, what);
+	}
+
+	[[nodiscard]] bool is_preloading() const
+	{
+		return std::ranges::any_of(this->m_entries, [](const entry& element) {
+			return element.state == scene_state::preloading;
+		});
+	}
+
+public:
+	explicit scene_registry(bool background_preload = true) :
+		m_background_preload{background_preload}
+	{
+	}
+	~scene_registry()
+	{
+		// Preloads and loads hold references into the asset cache, let them
+		// finish. Loads may be parked on the render thread, which is this one.
+		for (auto& element : this->m_entries)
+		{
+			if (element.loading.has_value())
+			{
+				element.loading->cancel();
+			}
+			while ((element.preloading.has_value() &&
+					!element.preloading->done()) ||
+				   (element.loading.has_value() && !element.loading->done()))
+			{
+				render_tasks().resume_all();
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	void add(scene_factory factory)
+	{
+		this->m_entries.push_back({.factory = std::move(factory)});
 	}
-};
 
+	// The scene becomes current once update has created it
+	void select(std::size_t index)
+	{
+		this->m_selected = index;
+		auto& target = this->m_entries.at(index);
+		target.failed = false;
+		if (target.state == scene_state::unloaded)
+		{
+			this->start_preload(target);
+		}
+	}
+	void select_none()
+	{
+		this->m_selected.reset();
+	}
+
+	// Called once per frame from the GL thread
+	error::result<> update()
+	{
+		for (auto& element : this->m_entries)
+		{
+			if (element.state == scene_state::preloading &&
+				(!element.preloading.has_value() ||
+				 element.preloading->done()))
+			{
+				element.state = scene_state::preloaded;
+				try
+				{
+					if (element.preloading.has_value())
+					{
+						element.preloading->get();
+					}
+					element.preloading.reset();
+				}
+				catch (const std::exception& exception)
+				{
+					element.preloading.reset();
+					return std::unexpected(
+						this->fail(element, exception.what()));
+				}
+			}
+			if (element.state == scene_state::loading &&
+				element.loading->done())
+			{
+				try
+				{
+					element.instance = element.loading->get();
+					element.state = scene_state::loaded;
+					element.loading.reset();
+				}
+				catch (const std::exception& exception)
+				{
+					element.loading.reset();
+					return std::unexpected(
+						this->fail(element, exception.what()));
+				}
+			}
+		}
+
+		if (this->m_selected.has_value())
+		{
+			auto& selected = this->m_entries.at(*this->m_selected);
+			if (selected.state == scene_state::preloaded &&
+				selected.factory.load)
+			{
+				const memory_scope scope{memory_tag::scenes};
+				selected.state = scene_state::loading;
+				selected.loading.emplace(selected.factory.load());
+				selected.loading->start();
+			}
+			else if (selected.state == scene_state::preloaded)
+			{
+				try
+				{
+					const memory_scope scope{memory_tag::scenes};
+					selected.instance = selected.factory.create();
+					selected.state = scene_state::loaded;
+				}
+				catch (const std::exception& exception)
+				{
+					return std::unexpected(
+						this->fail(selected, exception.what()));
+				}
+			}
+		}
+
+		// One background preload at a time so it doesn't fight the selected
+		// scene for the disk
+		if (this->m_background_preload && !this->is_preloading())
+		{
+			auto next =
+				std::ranges::find_if(this->m_entries, [](const entry& element) {
+					return element.state == scene_state::unloaded &&
+						   !element.failed;
+				});
+			if (next != this->m_entries.end())
+			{
+				this->start_preload(*next);
+			}
+		}
+		return {};
+	}
+
+	// Null while nothing is selected or the selection is still loading
+	[[nodiscard]] scene* current() const
+	{
+		if (!this->m_selected.has_value())
+		{
+			return nullptr;
+		}
+		return this->m_entries.at(*this->m_selected).instance.get();
+	}
+	// The selected scene while it isn't ready to be shown
+	[[nodiscard]] std::optional<std::size_t> loading() const
+	{
+		if (this->m_selected.has_value() && this->current() == nullptr)
+		{
+			return this->m_selected;
+		}
+		return std::nullopt;
+	}
+	[[nodiscard]] std::size_t size() const
+	{
+		return this->m_entries.size();
+	}
+	[[nodiscard]] const char* name(std::size_t index) const
+	{
+		return this->m_entries.at(index).factory.name;
+	}
+	[[nodiscard]] scene_state state(std::size_t index) const
+	{
+		return this->m_entries.at(index).state;
+	}
+
+	scene_registry(const scene_registry&) = delete;
+	scene_registry(scene_registry&&) = delete;
+	scene_registry& operator=(const scene_registry&) = delete;
+	scene_registry& operator=(scene_registry&&) = delete;
+};
 } // namespace moonstone
-std::vector<std::reference_wrapper<moonstone::scene>>
-	moonstone::scene::registered_scenes{};
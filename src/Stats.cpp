@@ -0,0 +1,253 @@
+module;
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+export module moonstone:stats;
+
+import :error;
+import :frame_arena;
+
+export namespace moonstone
+{
+enum class counter : std::uint8_t
+{
+	draw_calls,
+	// Distinct vertices the draws can reference, the index range
+	vertices,
+	indices,
+	gl_calls,
+	bytes_uploaded,
+	texture_binds,
+	// Only binds that change the current program
+	program_switches,
+	// Only counted with MOONSTONE_TRACK_ALLOCATIONS, which replaces
+	// operator new
+	allocations,
+	// Sprites the spatial index left out of the batch
+	culled,
+	count
+};
+constexpr std::size_t counter_count = std::to_underlying(counter::count);
+constexpr std::array<std::string_view, counter_count> counter_names{
+	"draw_calls",
+	"vertices",
+	"indices",
+	"gl_calls",
+	"bytes_uploaded",
+	"texture_binds",
+	"program_switches",
+	"allocations",
+	"culled"};
+
+#ifdef MOONSTONE_STATS
+constexpr bool stats_enabled = true;
+#else
+constexpr bool stats_enabled = false;
+#endif
+} // namespace moonstone
+
+namespace moonstone
+{
+// One cache line each, threads bumping different counters (the render
+// thread's gl_calls, a loader's allocations) don't false share
+struct alignas(64) padded_counter
+{
+	std::atomic<std::uint64_t> value{0};
+};
+
+// The frame being recorded. Relaxed atomics since allocations are counted
+// from every thread.
+std::array<padded_counter, counter_count> current_counters{};
+
+auto stats_error(std::string message) -> error::gl_error
+{
+	return error::gl_error{
+		"STATS", {}, "ERROR", 0, "HIGH", std::move(message)};
+}
+} // namespace moonstone
+
+export namespace moonstone
+{
+// Empty without MOONSTONE_STATS, so call sites cost nothing in those builds
+inline void count([[maybe_unused]] counter which,
+				  [[maybe_unused]] std::uint64_t amount = 1)
+{
+#ifdef MOONSTONE_STATS
+	current_counters.at(std::to_underlying(which))
+		.value.fetch_add(amount, std::memory_order_relaxed);
+#endif
+}
+
+struct counter_summary
+{
+	std::uint64_t last{};
+	std::uint64_t min{};
+	std::uint64_t max{};
+	std::uint64_t p99{};
+	double average{};
+};
+
+// Keeps the counters of the last `frames` frames
+class frame_statistics
+{
+	using frame = std::array<std::uint64_t, counter_count>;
+
+	std::vector<frame> m_frames;
+	std::vector<std::uint64_t> m_numbers;
+	std::size_t m_next{0};
+	std::size_t m_recorded{0};
+	std::uint64_t m_frame_number{0};
+
+	// Oldest first
+	template <typename F>
+	void for_each_frame(F&& visit) const
+	{
+		const auto capacity = this->m_frames.size();
+		const auto first =
+			(this->m_next + capacity - this->m_recorded) % capacity;
+		for (std::size_t i = 0; i < this->m_recorded; ++i)
+		{
+			const auto index = (first + i) % capacity;
+			visit(this->m_numbers.at(index), this->m_frames.at(index));
+		}
+	}
+
+public:
+	explicit frame_statistics(std::size_t frames = 240) :
+		m_frames(frames),
+		m_numbers(frames)
+	{
+	}
+
+	// Closes the current frame and starts counting the next one
+	void end_frame()
+	{
+		if constexpr (!stats_enabled)
+		{
+			return;
+		}
+		auto& slot = this->m_frames.at(this->m_next);
+		for (std::size_t i = 0; i < counter_count; ++i)
+		{
+			slot.at(i) = current_counters.at(i).value.exchange(
+				0, std::memory_order_relaxed);
+		}
+		this->m_numbers.at(this->m_next) = this->m_frame_number++;
+		this->m_next = (this->m_next + 1) % this->m_frames.size();
+		this->m_recorded =
+			std::min(this->m_recorded + 1, this->m_frames.size());
+	}
+
+	[[nodiscard]] counter_summary summary(counter which) const
+	{
+		counter_summary result;
+		if (this->m_recorded == 0)
+		{
+			return result;
+		}
+		const auto index = std::to_underlying(which);
+		auto values = make_frame_vector<std::uint64_t>();
+		values.reserve(this->m_recorded);
+		this->for_each_frame([&](std::uint64_t, const frame& counters) {
+			values.push_back(counters.at(index));
+		});
+		result.last = values.back();
+		std::uint64_t total = 0;
+		for (const auto value : values)
+		{
+			total += value;
+		}
+		result.average =
+			static_cast<double>(total) / static_cast<double>(values.size());
+		std::ranges::sort(values);
+		result.min = values.front();
+		result.max = values.back();
+		result.p99 = values.at((values.size() - 1) * 99 / 100);
+		return result;
+	}
+
+	[[nodiscard]] std::size_t size() const
+	{
+		return this->m_recorded;
+	}
+
+	error::result<> write_csv(const std::filesystem::path& path) const
+	{
+		std::ofstream out{path, std::ios::trunc};
+		if (!out)
+		{
+			return std::unexpected(
+				stats_error(std::format("{}: can't write", path.string())));
+		}
+		out << "frame";
+		for (const auto name : counter_names)
+		{
+			out << ',' << name;
+		}
+		out << '\n';
+		this->for_each_frame([&](std::uint64_t number, const frame& counters) {
+			out << number;
+			for (const auto value : counters)
+			{
+				out << ',' << value;
+			}
+			out << '\n';
+		});
+		return {};
+	}
+
+	error::result<> write_json(const std::filesystem::path& path) const
+	{
+		std::ofstream out{path, std::ios::trunc};
+		if (!out)
+		{
+			return std::unexpected(
+				stats_error(std::format("{}: can't write", path.string())));
+		}
+		out << "{\n  \"summary\": {";
+		for (std::size_t i = 0; i < counter_count; ++i)
+		{
+			const auto summary = this->summary(static_cast<counter>(i));
+			out << std::format("{}\n    \"{}\": {{\"min\": {}, \"average\": "
+							   "{:.2f}, \"p99\": {}, \"max\": {}}}",
+							   i == 0 ? "" : ",",
+							   counter_names.at(i),
+							   summary.min,
+							   summary.average,
+							   summary.p99,
+							   summary.max);
+		}
+		out << "\n  },\n  \"frames\": [";
+		bool first = true;
+		this->for_each_frame([&](std::uint64_t number, const frame& counters) {
+			out << (first ? "\n" : ",\n") << "    {\"frame\": " << number;
+			for (std::size_t i = 0; i < counter_count; ++i)
+			{
+				out << ", \"" << counter_names.at(i)
+					<< "\": " << counters.at(i);
+			}
+			out << '}';
+			first = false;
+		});
+		out << "\n  ]\n}\n";
+		return {};
+	}
+
+	frame_statistics(const frame_statistics&) = delete;
+	frame_statistics(frame_statistics&&) = delete;
+	frame_statistics& operator=(const frame_statistics&) = delete;
+	frame_statistics& operator=(frame_statistics&&) = delete;
+};
+} // namespace moonstone
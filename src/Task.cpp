@@ -0,0 +1,528 @@
+module;
+
+#include <array>
+#include <atomic>
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <stop_token>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+export module moonstone:task;
+
+import :jobs;
+
+export namespace moonstone
+{
+// Thrown out of a co_await once the task was cancelled, ends up in get()
+struct task_cancelled : std::runtime_error
+{
+	task_cancelled() : std::runtime_error("task cancelled")
+	{
+	}
+};
+
+template <typename T = void>
+class task;
+
+// Coroutines parked with `co_await on_render_thread()` wait here until the
+// render thread drains the queue, once per frame
+class render_queue
+{
+	std::mutex m_mutex;
+	std::vector<std::coroutine_handle<>> m_posted;
+	// Swapped with m_posted, so resuming doesn't hold the lock
+	std::vector<std::coroutine_handle<>> m_resuming;
+	std::atomic<std::thread::id> m_owner{};
+
+public:
+	render_queue() = default;
+	~render_queue() = default;
+
+	void bind_to_current_thread()
+	{
+		this->m_owner.store(std::this_thread::get_id(),
+							std::memory_order_relaxed);
+	}
+
+	[[nodiscard]] bool on_owner() const
+	{
+		return this->m_owner.load(std::memory_order_relaxed) ==
+			   std::this_thread::get_id();
+	}
+
+	void post(std::coroutine_handle<> handle)
+	{
+		const std::scoped_lock lock{this->m_mutex};
+		this->m_posted.push_back(handle);
+	}
+
+	// Resumes what was posted before the call, whatever those post again
+	// waits for the next one. Returns how many were resumed.
+	auto resume_all() -> std::size_t
+	{
+		{
+			const std::scoped_lock lock{this->m_mutex};
+			std::swap(this->m_posted, this->m_resuming);
+		}
+		for (const auto handle : this->m_resuming)
+		{
+			handle.resume();
+		}
+		const auto resumed = this->m_resuming.size();
+		this->m_resuming.clear();
+		return resumed;
+	}
+
+	render_queue(const render_queue&) = delete;
+	render_queue(render_queue&&) = delete;
+	render_queue& operator=(const render_queue&) = delete;
+	render_queue& operator=(render_queue&&) = delete;
+};
+
+auto render_tasks() -> render_queue&
+{
+	static render_queue instance;
+	return instance;
+}
+} // namespace moonstone
+
+namespace moonstone
+{
+// when_all resumes the parent once every child has finished, the +1 is
+// the parent's own reference while it's still starting them
+struct when_all_latch
+{
+	std::atomic<std::size_t> remaining{0};
+	std::coroutine_handle<> parent;
+};
+
+class promise_base
+{
+	template <typename T>
+	friend class moonstone::task;
+	friend struct when_all_awaiter;
+
+	std::coroutine_handle<> m_continuation;
+	when_all_latch* m_latch{nullptr};
+	// A task awaited by another shares its parent's token, only the
+	// outermost task's source is ever used
+	std::stop_source m_source;
+	std::stop_token m_stop{m_source.get_token()};
+	std::atomic<bool> m_finished{false};
+
+protected:
+	std::exception_ptr m_exception;
+
+	void rethrow() const
+	{
+		if (this->m_exception)
+		{
+			std::rethrow_exception(this->m_exception);
+		}
+	}
+
+public:
+	struct final_awaiter
+	{
+		[[nodiscard]] bool await_ready() const noexcept
+		{
+			return false;
+		}
+		// Whoever sees m_finished may destroy the frame, so everything is
+		// read before it's published and nothing is touched after
+		template <typename P>
+		auto await_suspend(std::coroutine_handle<P> self) noexcept
+			-> std::coroutine_handle<>
+		{
+			promise_base& promise = self.promise();
+			const auto continuation = promise.m_continuation;
+			auto* latch = promise.m_latch;
+			promise.m_finished.store(true, std::memory_order_release);
+			if (latch != nullptr)
+			{
+				if (latch->remaining.fetch_sub(1, std::memory_order_acq_rel) ==
+					1)
+				{
+					return latch->parent;
+				}
+				return std::noop_coroutine();
+			}
+			if (continuation)
+			{
+				return continuation;
+			}
+			return std::noop_coroutine();
+		}
+		void await_resume() const noexcept
+		{
+		}
+	};
+
+	// Lazy, nothing runs until it's awaited or started
+	[[nodiscard]] std::suspend_always initial_suspend() const noexcept
+	{
+		return {};
+	}
+	[[nodiscard]] final_awaiter final_suspend() const noexcept
+	{
+		return {};
+	}
+	void unhandled_exception()
+	{
+		this->m_exception = std::current_exception();
+	}
+
+	[[nodiscard]] std::stop_token stop_token() const
+	{
+		return this->m_stop;
+	}
+};
+
+template <typename T>
+class promise_storage : public promise_base
+{
+	std::optional<T> m_value;
+
+public:
+	template <typename U = T>
+	void return_value(U&& value)
+	{
+		this->m_value.emplace(std::forward<U>(value));
+	}
+	auto take() -> T
+	{
+		this->rethrow();
+		return std::move(*this->m_value);
+	}
+};
+
+template <>
+class promise_storage<void> : public promise_base
+{
+public:
+	void return_void() const
+	{
+	}
+	void take() const
+	{
+		this->rethrow();
+	}
+};
+
+template <typename P>
+concept task_promise = std::derived_from<P, promise_base>;
+
+struct when_all_child
+{
+	promise_base* promise;
+	std::coroutine_handle<> handle;
+};
+
+struct when_all_awaiter
+{
+	std::span<const when_all_child> children;
+	when_all_latch latch;
+
+	[[nodiscard]] bool await_ready() const noexcept
+	{
+		return this->children.empty();
+	}
+	template <task_promise P>
+	bool await_suspend(std::coroutine_handle<P> parent)
+	{
+		this->latch.remaining.store(this->children.size() + 1,
+									std::memory_order_relaxed);
+		this->latch.parent = parent;
+		for (const auto& child : this->children)
+		{
+			child.promise->m_latch = &this->latch;
+			child.promise->m_stop = parent.promise().stop_token();
+			child.handle.resume();
+		}
+		// Everything may have finished inline, then don't suspend at all
+		return this->latch.remaining.fetch_sub(1, std::memory_order_acq_rel) !=
+			   1;
+	}
+	void await_resume() const noexcept
+	{
+	}
+};
+
+template <typename T>
+using when_all_value =
+	std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+} // namespace moonstone
+
+export namespace moonstone
+{
+// Lazily started coroutine. Awaiting it from another task runs it and
+// resumes the awaiting one on whichever thread it finishes. The outermost
+// task is started with start() and polled with done().
+template <typename T>
+class task
+{
+public:
+	class promise_type : public promise_storage<T>
+	{
+	public:
+		auto get_return_object() -> task
+		{
+			return task{
+				std::coroutine_handle<promise_type>::from_promise(*this)};
+		}
+	};
+
+private:
+	std::coroutine_handle<promise_type> m_handle;
+	bool m_started{false};
+
+	explicit task(std::coroutine_handle<promise_type> handle) :
+		m_handle{handle}
+	{
+	}
+
+	template <typename U>
+	friend auto child_of(task<U>& child) -> when_all_child;
+
+public:
+	task() = default;
+	// The frame must not be running anywhere, cancel() and wait for done()
+	// before dropping a started task
+	~task()
+	{
+		if (this->m_handle)
+		{
+			this->m_handle.destroy();
+		}
+	}
+
+	void start()
+	{
+		if (!this->m_started)
+		{
+			this->m_started = true;
+			this->m_handle.resume();
+		}
+	}
+
+	[[nodiscard]] bool valid() const
+	{
+		return static_cast<bool>(this->m_handle);
+	}
+
+	[[nodiscard]] bool done() const
+	{
+		return this->m_handle.promise().m_finished.load(
+			std::memory_order_acquire);
+	}
+
+	// Once done(), returns the result or rethrows what the coroutine threw
+	auto get() -> T
+	{
+		return this->m_handle.promise().take();
+	}
+
+	// The next cancellable co_await throws task_cancelled, in this task and
+	// every task it's awaiting
+	void cancel()
+	{
+		this->m_handle.promise().m_source.request_stop();
+	}
+
+	struct awaiter
+	{
+		std::coroutine_handle<promise_type> child;
+
+		[[nodiscard]] bool await_ready() const noexcept
+		{
+			return false;
+		}
+		template <task_promise P>
+		auto await_suspend(std::coroutine_handle<P> parent) noexcept
+			-> std::coroutine_handle<>
+		{
+			this->child.promise().m_continuation = parent;
+			this->child.promise().m_stop = parent.promise().stop_token();
+			return this->child;
+		}
+		auto await_resume() -> T
+		{
+			return this->child.promise().take();
+		}
+	};
+
+	auto operator co_await() noexcept -> awaiter
+	{
+		this->m_started = true;
+		return awaiter{this->m_handle};
+	}
+
+	task(const task&) = delete;
+	task(task&& other) noexcept :
+		m_handle{std::exchange(other.m_handle, {})},
+		m_started{other.m_started}
+	{
+	}
+	task& operator=(const task&) = delete;
+	task& operator=(task&& other) noexcept
+	{
+		if (this != &other)
+		{
+			if (this->m_handle)
+			{
+				this->m_handle.destroy();
+			}
+			this->m_handle = std::exchange(other.m_handle, {});
+			this->m_started = other.m_started;
+		}
+		return *this;
+	}
+};
+
+template <typename T>
+auto child_of(task<T>& child) -> when_all_child
+{
+	child.m_started = true;
+	return {&child.m_handle.promise(), child.m_handle};
+}
+
+// Base of the awaiters that switch threads, they throw task_cancelled when
+// the task was cancelled while it was suspended
+class cancellable_awaiter
+{
+protected:
+	std::stop_token m_stop;
+
+public:
+	void await_resume() const
+	{
+		if (this->m_stop.stop_requested())
+		{
+			throw task_cancelled{};
+		}
+	}
+};
+
+struct worker_awaiter : cancellable_awaiter
+{
+	[[nodiscard]] bool await_ready() const noexcept
+	{
+		return false;
+	}
+	template <task_promise P>
+	void await_suspend(std::coroutine_handle<P> self)
+	{
+		this->m_stop = self.promise().stop_token();
+		jobs().run([self] { self.resume(); });
+	}
+};
+
+struct render_thread_awaiter : cancellable_awaiter
+{
+	[[nodiscard]] bool await_ready() const noexcept
+	{
+		return false;
+	}
+	// Doesn't suspend when it's already there
+	template <task_promise P>
+	bool await_suspend(std::coroutine_handle<P> self)
+	{
+		this->m_stop = self.promise().stop_token();
+		if (render_tasks().on_owner())
+		{
+			return false;
+		}
+		render_tasks().post(self);
+		return true;
+	}
+};
+
+// Same check without switching threads, for long loops on one thread
+struct cancellation_point : cancellable_awaiter
+{
+	[[nodiscard]] bool await_ready() const noexcept
+	{
+		return false;
+	}
+	template <task_promise P>
+	bool await_suspend(std::coroutine_handle<P> self)
+	{
+		this->m_stop = self.promise().stop_token();
+		return false;
+	}
+};
+
+// `co_await on_workers()` continues on the job system
+auto on_workers() -> worker_awaiter
+{
+	return {};
+}
+
+// `co_await on_render_thread()` continues on the thread draining
+// render_tasks(), where GL calls are allowed
+auto on_render_thread() -> render_thread_awaiter
+{
+	return {};
+}
+
+// Starts every task at once, finishes when all of them have. Void tasks
+// give std::monostate, the first exception is rethrown.
+template <typename... Ts>
+auto when_all(task<Ts>... tasks) -> task<std::tuple<when_all_value<Ts>...>>
+{
+	const std::array<when_all_child, sizeof...(Ts)> children{
+		child_of(tasks)...};
+	co_await when_all_awaiter{.children = children};
+	auto take = []<typename T>(task<T>& finished) -> when_all_value<T> {
+		if constexpr (std::is_void_v<T>)
+		{
+			finished.get();
+			return {};
+		}
+		else
+		{
+			return finished.get();
+		}
+	};
+	co_return std::tuple<when_all_value<Ts>...>{take(tasks)...};
+}
+
+template <typename T>
+auto when_all(std::vector<task<T>> tasks)
+	-> task<std::vector<when_all_value<T>>>
+{
+	std::vector<when_all_child> children;
+	children.reserve(tasks.size());
+	for (auto& child : tasks)
+	{
+		children.push_back(child_of(child));
+	}
+	co_await when_all_awaiter{.children = children};
+	std::vector<when_all_value<T>> results;
+	results.reserve(tasks.size());
+	for (auto& finished : tasks)
+	{
+		if constexpr (std::is_void_v<T>)
+		{
+			finished.get();
+			results.emplace_back();
+		}
+		else
+		{
+			results.push_back(finished.get());
+		}
+	}
+	co_return results;
+}
+} // namespace moonstone
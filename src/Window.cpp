@@ -6,11 +6,11 @@ module;
 #include <cstdint>
 #include <exception>
 #include <glad/glad.h>
-#include <print>
 
 export module moonstone:window;
 
 import :error;
+import :logging;
 import :call;
 
 export namespace moonstone
@@ -21,16 +21,19 @@ struct window_properties
 	const char* title{};
 	bool vsync{};
 	bool fullscreen{};
+	// Textures loaded with alpha_mode::premultiplied need GL_ONE blending
+	bool premultiplied_alpha{};
 } __attribute__((aligned(128))) __attribute__((packed));
 
 class window
 {
 	GLFWwindow* m_window;
 
-	static error::result<> create()
+	static error::result<> create(bool premultiplied_alpha)
 	{
-		Try(renderer::gl().call(
-			glBlendFunc, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
+		Try(renderer::gl().call(glBlendFunc,
+								premultiplied_alpha ? GL_ONE : GL_SRC_ALPHA,
+								GL_ONE_MINUS_SRC_ALPHA));
 		Try(renderer::gl().call(glEnable, GL_BLEND));
 		return {};
 	}
@@ -51,13 +54,15 @@ public:
 		if (gladLoadGLLoader(
 				reinterpret_cast<GLADloadproc>(glfwGetProcAddress)) == 0)
 		{
-			std::println(stderr, "Failed to initialize GLAD");
+			log_error<"Failed to initialize GLAD">();
+			flush_logs();
 			std::terminate();
 		}
-		auto err = window::create();
+		auto err = window::create(props.premultiplied_alpha);
 		if (!err.has_value())
 		{
-			std::println(stderr, "{}", err.error().format());
+			log_error<"{}">(err.error().format());
+			flush_logs();
 			std::terminate();
 		}
 	}
@@ -0,0 +1,373 @@
+module;
+
+#include "Try.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <glm/glm.hpp>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+export module moonstone:animation;
+
+import :ecs;
+import :error;
+import :vertex_element;
+import :vertex_buffer;
+import :vertex_array;
+import :index_buffer;
+import :buffer_layout;
+import :shader;
+import :renderer;
+import :memory_tracking;
+import :jobs;
+import :sprites;
+
+export namespace moonstone::engine
+{
+using clip_id = std::uint32_t;
+
+// Frames play in order, each one for `frame_duration` seconds. A clip that
+// doesn't loop stops on its last frame.
+struct animation_clip
+{
+	std::vector<sprite> frames;
+	float frame_duration{0.1F};
+	bool looping{true};
+};
+
+// `count` cells of a sheet cut into `cells` equal cells on one layer,
+// starting at `first`. Cells go left to right from the top row down.
+auto slice_sheet(glm::uvec2 cells, std::uint32_t layer, std::uint32_t first,
+				 std::uint32_t count) -> std::vector<sprite>
+{
+	std::vector<sprite> frames;
+	frames.reserve(count);
+	const auto cell_size = 1.0F / glm::vec2{cells};
+	for (auto i = first; i < first + count; ++i)
+	{
+		const auto column = static_cast<float>(i % cells.x);
+		const auto row = static_cast<float>(i / cells.x);
+		// Images are stored bottom to top, the top row has the highest v
+		const glm::vec2 low{column * cell_size.x,
+							1.0F - ((row + 1.0F) * cell_size.y)};
+		frames.push_back(
+			{.uv_rect = {low, low + cell_size}, .layer = layer});
+	}
+	return frames;
+}
+
+// Every clip the animators refer to, by index
+class animation_library
+{
+	std::vector<animation_clip> m_clips;
+
+public:
+	animation_library() = default;
+	~animation_library() = default;
+
+	auto add(animation_clip clip) -> clip_id
+	{
+		const memory_scope scope{memory_tag::assets};
+		clip.frame_duration = std::max(clip.frame_duration, 1e-3F);
+		this->m_clips.push_back(std::move(clip));
+		return static_cast<clip_id>(this->m_clips.size() - 1);
+	}
+
+	[[nodiscard]] const animation_clip& get(clip_id clip) const
+	{
+		return this->m_clips.at(clip);
+	}
+
+	[[nodiscard]] std::size_t size() const
+	{
+		return this->m_clips.size();
+	}
+
+	animation_library(const animation_library&) = delete;
+	animation_library(animation_library&&) = delete;
+	animation_library& operator=(const animation_library&) = delete;
+	animation_library& operator=(animation_library&&) = delete;
+};
+
+// Playback state of one entity, its sprite holds the current frame
+struct animator
+{
+	clip_id clip{0};
+	std::uint32_t frame{0};
+	// Seconds spent on the current frame
+	float time{0.0F};
+	// Playback rate, clips only play forwards so negative counts as 0
+	float speed{1.0F};
+	bool playing{true};
+};
+
+// Where the entity's vertices live in a retained_sprite_batch
+struct sprite_slot
+{
+	std::uint32_t index{0};
+};
+
+// Sprites that keep their vertices on the GPU between frames, for sprites
+// that mostly stay put. Every sprite owns a slot, editing one only marks it
+// dirty and upload() sends the dirty slots, so a frame where few sprites
+// change costs little however many there are. Fixed capacity, freed slots
+// become empty quads until they're reused.
+class retained_sprite_batch
+{
+	static constexpr std::array<std::uint32_t, 6> s_quad_indices{
+		0, 1, 2, 2, 3, 0};
+	// Dirty slots this close are sent together, resending a few clean ones
+	// is cheaper than another glBufferSubData
+	static constexpr std::size_t s_merge_gap = 32;
+
+	std::size_t m_capacity;
+	std::vector<renderer::vertex_element> m_vertices;
+	// One byte per slot so workers can mark different slots at once
+	std::vector<std::uint8_t> m_dirty;
+	std::vector<std::uint32_t> m_free;
+	// Slots in [0, used) have been handed out at some point
+	std::uint32_t m_used{0};
+	std::size_t m_uploaded{0};
+	renderer::vertex_array m_vao;
+	renderer::static_buffer<renderer::vertex_element> m_vbo;
+	renderer::index_buffer m_ibo;
+	renderer::buffer_layout m_layout;
+
+	error::result<> create()
+	{
+		renderer::vertex_element::register_layout(this->m_layout);
+		Try(this->m_vao.add_buffer(this->m_vbo, this->m_layout));
+		Try(renderer::vertex_array::unbind());
+		std::vector<std::uint32_t> indices;
+		indices.reserve(this->m_capacity * 6);
+		for (std::size_t i = 0; i < this->m_capacity; ++i)
+		{
+			for (const auto index : s_quad_indices)
+			{
+				indices.push_back(static_cast<std::uint32_t>(i * 4) + index);
+			}
+		}
+		Try(this->m_ibo.append(indices));
+		return {};
+	}
+
+	auto corners(std::uint32_t slot) -> std::span<renderer::vertex_element, 4>
+	{
+		const auto all = std::span{this->m_vertices};
+		return all.subspan(std::size_t{slot} * 4).first<4>();
+	}
+
+	error::result<> send(std::size_t first, std::size_t last)
+	{
+		Try(this->m_vbo.update(
+			first * 4,
+			std::span<const renderer::vertex_element>{this->m_vertices}
+				.subspan(first * 4, (last - first) * 4)));
+		this->m_uploaded += last - first;
+		return {};
+	}
+
+public:
+	explicit retained_sprite_batch(std::size_t capacity) :
+		m_capacity{capacity},
+		m_vertices(capacity * 4),
+		m_dirty(capacity),
+		m_vbo{std::span<const renderer::vertex_element>{m_vertices}}
+	{
+		const memory_scope scope{memory_tag::renderer};
+		auto err = this->create();
+		if (!err.has_value())
+		{
+			throw std::runtime_error(err.error().format());
+		}
+	}
+	~retained_sprite_batch() = default;
+
+	auto add(const transform& where, const sprite& look)
+		-> error::result<std::uint32_t>
+	{
+		std::uint32_t slot = 0;
+		if (!this->m_free.empty())
+		{
+			slot = this->m_free.back();
+			this->m_free.pop_back();
+		}
+		else if (this->m_used < this->m_capacity)
+		{
+			slot = this->m_used++;
+		}
+		else
+		{
+			return std::unexpected(error::gl_error{
+				"APPLICATION",
+				{},
+				"ERROR",
+				0,
+				"HIGH",
+				"retained_sprite_batch is full, raise its capacity"});
+		}
+		this->set(slot, where, look);
+		return slot;
+	}
+
+	void remove(std::uint32_t slot)
+	{
+		std::ranges::fill(this->corners(slot), renderer::vertex_element{});
+		this->m_dirty[slot] = 1;
+		this->m_free.push_back(slot);
+	}
+
+	void set(std::uint32_t slot, const transform& where, const sprite& look)
+	{
+		write_sprite(this->corners(slot), where, look);
+		this->m_dirty[slot] = 1;
+	}
+
+	// Only the texture coordinates, the corners stay where they are. Safe
+	// to call for different slots from different threads.
+	void set_look(std::uint32_t slot, const sprite& look)
+	{
+		auto out = this->corners(slot);
+		const auto layer = static_cast<float>(look.layer);
+		out[0].m_uv = {look.uv_rect.x, look.uv_rect.w, layer};
+		out[1].m_uv = {look.uv_rect.x, look.uv_rect.y, layer};
+		out[2].m_uv = {look.uv_rect.z, look.uv_rect.y, layer};
+		out[3].m_uv = {look.uv_rect.z, look.uv_rect.w, layer};
+		this->m_dirty[slot] = 1;
+	}
+
+	// Sends runs of dirty slots, call once per frame before draw()
+	error::result<> upload()
+	{
+		this->m_uploaded = 0;
+		std::size_t run_first = 0;
+		std::size_t run_last = 0;
+		bool in_run = false;
+		for (std::size_t slot = 0; slot < this->m_used; ++slot)
+		{
+			if (this->m_dirty[slot] == 0)
+			{
+				continue;
+			}
+			this->m_dirty[slot] = 0;
+			if (in_run && slot - run_last <= s_merge_gap)
+			{
+				run_last = slot + 1;
+				continue;
+			}
+			if (in_run)
+			{
+				Try(this->send(run_first, run_last));
+			}
+			run_first = slot;
+			run_last = slot + 1;
+			in_run = true;
+		}
+		if (in_run)
+		{
+			Try(this->send(run_first, run_last));
+		}
+		return {};
+	}
+
+	error::result<> draw(const renderer::shader& shader)
+	{
+		if (this->m_used == 0)
+		{
+			return {};
+		}
+		Try(renderer::renderer::draw(
+			this->m_vao,
+			this->m_ibo,
+			shader,
+			static_cast<std::uint32_t>(std::size_t{this->m_used} * 6),
+			static_cast<std::uint32_t>(std::size_t{this->m_used} * 4)));
+		return {};
+	}
+
+	// Slots sent by the last upload, clean ones inside a merged run included
+	[[nodiscard]] std::size_t uploaded() const
+	{
+		return this->m_uploaded;
+	}
+
+	[[nodiscard]] std::size_t size() const
+	{
+		return this->m_used - this->m_free.size();
+	}
+
+	retained_sprite_batch(const retained_sprite_batch&) = delete;
+	retained_sprite_batch(retained_sprite_batch&&) = delete;
+	retained_sprite_batch& operator=(const retained_sprite_batch&) = delete;
+	retained_sprite_batch& operator=(retained_sprite_batch&&) = delete;
+};
+
+// The animation system. Advances every entity with an animator, a sprite
+// and a sprite_slot, chunks in parallel. Only entities whose frame changed
+// get a new sprite and have their slot's texture coordinates rewritten.
+// Returns how many did.
+auto update_animations(world& entities, const animation_library& clips,
+					   float delta_time, retained_sprite_batch& batch)
+	-> std::size_t
+{
+	std::atomic<std::size_t> changed{0};
+	entities.each_chunk_parallel<animator, sprite, sprite_slot>(
+		jobs(),
+		[&](std::span<const entity> /*owners*/,
+			std::span<animator> states,
+			std::span<sprite> looks,
+			std::span<sprite_slot> slots) {
+			std::size_t local = 0;
+			for (std::size_t i = 0; i < states.size(); ++i)
+			{
+				auto& state = states[i];
+				if (!state.playing)
+				{
+					continue;
+				}
+				const auto& clip = clips.get(state.clip);
+				const auto frames = clip.frames.size();
+				if (frames == 0)
+				{
+					continue;
+				}
+				// A negative time would make the cast below undefined
+				state.time += delta_time * std::max(state.speed, 0.0F);
+				const auto steps =
+					static_cast<std::size_t>(state.time / clip.frame_duration);
+				if (steps == 0)
+				{
+					continue;
+				}
+				state.time -= static_cast<float>(steps) * clip.frame_duration;
+				auto next = state.frame + steps;
+				if (next >= frames && clip.looping)
+				{
+					next %= frames;
+				}
+				else if (next >= frames)
+				{
+					next = frames - 1;
+					state.playing = false;
+					state.time = 0.0F;
+				}
+				if (next == state.frame)
+				{
+					continue;
+				}
+				state.frame = static_cast<std::uint32_t>(next);
+				looks[i] = clip.frames[next];
+				batch.set_look(slots[i].index, looks[i]);
+				++local;
+			}
+			changed.fetch_add(local, std::memory_order_relaxed);
+		});
+	return changed.load(std::memory_order_relaxed);
+}
+} // namespace moonstone::engine
@@ -0,0 +1,243 @@
+module;
+
+#include "Try.hpp"
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/glm.hpp>
+#include <span>
+
+export module moonstone:camera;
+
+import :error;
+import :renderer;
+import :spatial_grid;
+import :frame_arena;
+
+export namespace moonstone::engine
+{
+// The part of the framebuffer a camera draws into, as fractions of its size
+// so it follows resizes. 0,0 is the bottom left corner.
+struct viewport
+{
+	glm::vec2 origin{0.0F, 0.0F};
+	glm::vec2 size{1.0F, 1.0F};
+
+	bool operator==(const viewport&) const = default;
+};
+
+// Orthographic 2D camera looking at `position`, the center of its viewport.
+// At zoom 1 a world unit is a pixel. The matrices are only rebuilt when
+// something they depend on changes, setting the same value again is free.
+class camera
+{
+	glm::vec2 m_position{0.0F, 0.0F};
+	float m_zoom{1.0F};
+	// Radians, counter clockwise
+	float m_rotation{0.0F};
+	viewport m_viewport;
+	glm::vec2 m_framebuffer{0.0F, 0.0F};
+	mutable glm::mat4 m_view{1.0F};
+	mutable glm::mat4 m_projection{1.0F};
+	mutable glm::mat4 m_view_projection{1.0F};
+	mutable bool m_view_dirty{true};
+	mutable bool m_projection_dirty{true};
+
+	void refresh() const
+	{
+		if (!this->m_view_dirty && !this->m_projection_dirty)
+		{
+			return;
+		}
+		if (this->m_view_dirty)
+		{
+			this->m_view =
+				glm::rotate(glm::mat4{1.0F},
+							-this->m_rotation,
+							glm::vec3{0.0F, 0.0F, 1.0F}) *
+				glm::translate(glm::mat4{1.0F},
+							   glm::vec3{-this->m_position, 0.0F});
+		}
+		if (this->m_projection_dirty)
+		{
+			const auto half = this->extent() * 0.5F;
+			this->m_projection =
+				glm::ortho(-half.x, half.x, -half.y, half.y, -1.0F, 1.0F);
+		}
+		this->m_view_projection = this->m_projection * this->m_view;
+		this->m_view_dirty = false;
+		this->m_projection_dirty = false;
+	}
+
+public:
+	camera() = default;
+	explicit camera(viewport area) : m_viewport{area}
+	{
+	}
+	~camera() = default;
+
+	void set_position(glm::vec2 position)
+	{
+		if (position != this->m_position)
+		{
+			this->m_position = position;
+			this->m_view_dirty = true;
+		}
+	}
+
+	void set_zoom(float zoom)
+	{
+		if (zoom != this->m_zoom)
+		{
+			this->m_zoom = zoom;
+			this->m_projection_dirty = true;
+		}
+	}
+
+	void set_rotation(float radians)
+	{
+		if (radians != this->m_rotation)
+		{
+			this->m_rotation = radians;
+			this->m_view_dirty = true;
+		}
+	}
+
+	void set_viewport(viewport area)
+	{
+		if (area != this->m_viewport)
+		{
+			this->m_viewport = area;
+			this->m_projection_dirty = true;
+		}
+	}
+
+	// Usually from renderer::get_framebuffer_size, apply() does it too
+	void set_framebuffer(glm::vec2 size)
+	{
+		if (size != this->m_framebuffer)
+		{
+			this->m_framebuffer = size;
+			this->m_projection_dirty = true;
+		}
+	}
+
+	[[nodiscard]] glm::vec2 get_position() const
+	{
+		return this->m_position;
+	}
+
+	[[nodiscard]] float get_zoom() const
+	{
+		return this->m_zoom;
+	}
+
+	[[nodiscard]] float get_rotation() const
+	{
+		return this->m_rotation;
+	}
+
+	[[nodiscard]] const viewport& get_viewport() const
+	{
+		return this->m_viewport;
+	}
+
+	// x, y, width, height in pixels
+	[[nodiscard]] glm::ivec4 pixel_rect() const
+	{
+		const auto origin = this->m_viewport.origin * this->m_framebuffer;
+		const auto size = this->m_viewport.size * this->m_framebuffer;
+		return {glm::ivec2{glm::round(origin)}, glm::ivec2{glm::round(size)}};
+	}
+
+	// World units across the viewport, before rotation
+	[[nodiscard]] glm::vec2 extent() const
+	{
+		return this->m_viewport.size * this->m_framebuffer / this->m_zoom;
+	}
+
+	[[nodiscard]] const glm::mat4& view() const
+	{
+		this->refresh();
+		return this->m_view;
+	}
+
+	[[nodiscard]] const glm::mat4& projection() const
+	{
+		this->refresh();
+		return this->m_projection;
+	}
+
+	[[nodiscard]] const glm::mat4& view_projection() const
+	{
+		this->refresh();
+		return this->m_view_projection;
+	}
+
+	// What culling should query, rotated cameras get the box around what
+	// they see
+	[[nodiscard]] aabb visible_bounds() const
+	{
+		const auto half = this->extent() * 0.5F;
+		const auto cosine = std::abs(std::cos(this->m_rotation));
+		const auto sine = std::abs(std::sin(this->m_rotation));
+		const glm::vec2 reach{(half.x * cosine) + (half.y * sine),
+							  (half.x * sine) + (half.y * cosine)};
+		return {this->m_position - reach, this->m_position + reach};
+	}
+
+	// Points the renderer's frame block and the GL viewport at this camera
+	error::result<> apply(renderer::renderer& target)
+	{
+		this->set_framebuffer(glm::vec2{target.get_framebuffer_size()});
+		Try(target.set_camera(
+			this->view(), this->projection(), this->pixel_rect()));
+		return {};
+	}
+};
+
+// Cameras whose visible bounds overlap, which share one culling query and
+// one batch. Bit i of `cameras` is the i-th view given to group_views.
+struct view_group
+{
+	aabb bounds;
+	std::uint32_t cameras{0};
+};
+
+// Merges overlapping views until none of the groups overlap. Drawing the
+// union once per camera is cheaper than building the overlap twice, the GPU
+// clips what a camera doesn't see. At most 32 views.
+auto group_views(std::span<const aabb> views) -> frame_vector<view_group>
+{
+	auto groups = make_frame_vector<view_group>();
+	groups.reserve(views.size());
+	for (std::size_t i = 0; i < views.size(); ++i)
+	{
+		groups.push_back({views[i], 1U << i});
+	}
+	bool merged = true;
+	while (merged)
+	{
+		merged = false;
+		for (std::size_t a = 0; a < groups.size() && !merged; ++a)
+		{
+			for (std::size_t b = a + 1; b < groups.size() && !merged; ++b)
+			{
+				if (!groups[a].bounds.overlaps(groups[b].bounds))
+				{
+					continue;
+				}
+				groups[a].bounds = {
+					glm::min(groups[a].bounds.min, groups[b].bounds.min),
+					glm::max(groups[a].bounds.max, groups[b].bounds.max)};
+				groups[a].cameras |= groups[b].cameras;
+				groups.erase(groups.begin() + static_cast<std::ptrdiff_t>(b));
+				merged = true;
+			}
+		}
+	}
+	return groups;
+}
+} // namespace moonstone::engine
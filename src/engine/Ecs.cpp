@@ -0,0 +1,594 @@
+module;
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+export module moonstone:ecs;
+
+import :frame_arena;
+import :jobs;
+
+export namespace moonstone::engine
+{
+struct entity
+{
+	std::uint32_t index{std::numeric_limits<std::uint32_t>::max()};
+	std::uint32_t generation{0};
+
+	bool operator==(const entity&) const = default;
+};
+
+// Components are plain data, they're moved between chunks with memcpy
+template <typename T>
+concept component = std::is_trivially_copyable_v<T> &&
+					std::is_trivially_destructible_v<T> &&
+					std::is_default_constructible_v<T>;
+
+constexpr std::size_t max_components = 64;
+using component_mask = std::uint64_t;
+// Big enough for a few hundred sprites while staying in L1/L2
+constexpr std::size_t chunk_bytes = 16UZ * 1024;
+} // namespace moonstone::engine
+
+namespace moonstone::engine
+{
+std::atomic<std::uint32_t> next_component_id{0};
+
+// Handed out the first time a component type is used
+template <component T>
+auto component_id() -> std::uint32_t
+{
+	static const std::uint32_t id = [] {
+		const auto next =
+			next_component_id.fetch_add(1, std::memory_order_relaxed);
+		if (next >= max_components)
+		{
+			throw std::length_error("ecs: too many component types");
+		}
+		return next;
+	}();
+	return id;
+}
+
+template <component... Ts>
+auto mask_of() -> component_mask
+{
+	return ((component_mask{1} << component_id<Ts>()) | ... | 0);
+}
+
+struct column
+{
+	std::uint32_t id;
+	std::uint32_t size;
+	std::uint32_t alignment;
+	// Where the array of this component starts inside a chunk
+	std::uint32_t offset{0};
+};
+
+template <component T>
+auto make_column() -> column
+{
+	static_assert(alignof(T) <= 64, "ecs: chunks are only 64 byte aligned");
+	return {.id = component_id<T>(),
+			.size = sizeof(T),
+			.alignment = alignof(T)};
+}
+
+struct alignas(64) chunk
+{
+	std::array<std::byte, chunk_bytes> data;
+	std::uint32_t size{0};
+};
+} // namespace moonstone::engine
+
+export namespace moonstone::engine
+{
+// Every entity with exactly the same set of components lives in the same
+// archetype. Its components are stored SoA in fixed size chunks, the
+// entity ids first and then one tightly packed array per component, so a
+// query walks plain arrays.
+class archetype
+{
+	static constexpr std::uint8_t s_absent = 0xFF;
+
+	component_mask m_mask;
+	std::vector<column> m_columns;
+	std::array<std::uint8_t, max_components> m_slots{};
+	std::size_t m_capacity{0};
+	std::size_t m_size{0};
+	std::vector<std::unique_ptr<chunk>> m_chunks;
+
+	bool layout(std::size_t capacity)
+	{
+		std::size_t offset = sizeof(entity) * capacity;
+		for (auto& element : this->m_columns)
+		{
+			offset = (offset + element.alignment - 1) / element.alignment *
+					 element.alignment;
+			element.offset = static_cast<std::uint32_t>(offset);
+			offset += element.size * capacity;
+		}
+		return offset <= chunk_bytes;
+	}
+
+	[[nodiscard]] auto locate(std::size_t row) const
+		-> std::pair<chunk*, std::size_t>
+	{
+		return {this->m_chunks.at(row / this->m_capacity).get(),
+				row % this->m_capacity};
+	}
+
+public:
+	archetype(component_mask mask, std::vector<column> columns) :
+		m_mask{mask},
+		m_columns{std::move(columns)}
+	{
+		std::ranges::sort(this->m_columns, {}, &column::id);
+		std::size_t per_entity = sizeof(entity);
+		for (const auto& element : this->m_columns)
+		{
+			per_entity += element.size;
+		}
+		// Alignment padding can push the last array over, shrink until not
+		this->m_capacity = chunk_bytes / per_entity;
+		while (this->m_capacity > 1 && !this->layout(this->m_capacity))
+		{
+			--this->m_capacity;
+		}
+		if (this->m_capacity == 0 || !this->layout(this->m_capacity))
+		{
+			throw std::length_error("ecs: components don't fit in a chunk");
+		}
+		this->m_slots.fill(s_absent);
+		for (std::size_t i = 0; i < this->m_columns.size(); ++i)
+		{
+			this->m_slots.at(this->m_columns.at(i).id) =
+				static_cast<std::uint8_t>(i);
+		}
+	}
+	~archetype() = default;
+
+	// Appends the entity, its components are left for the caller to fill
+	auto push(entity owner) -> std::size_t
+	{
+		if (this->m_size == this->m_chunks.size() * this->m_capacity)
+		{
+			this->m_chunks.push_back(std::make_unique<chunk>());
+		}
+		const auto row = this->m_size++;
+		auto [target, slot] = this->locate(row);
+		++target->size;
+		std::memcpy(target->data.data() + slot * sizeof(entity),
+					&owner,
+					sizeof(entity));
+		return row;
+	}
+
+	// Swaps the last entity into the hole. Returns the one that moved, or a
+	// default entity when `row` was the last.
+	auto remove(std::size_t row) -> entity
+	{
+		const auto last = this->m_size - 1;
+		auto [target, slot] = this->locate(row);
+		auto [source, source_slot] = this->locate(last);
+		entity moved{};
+		if (row != last)
+		{
+			for (const auto& element : this->m_columns)
+			{
+				std::memcpy(target->data.data() + element.offset +
+								slot * element.size,
+							source->data.data() + element.offset +
+								source_slot * element.size,
+							element.size);
+			}
+			std::memcpy(&moved,
+						source->data.data() + source_slot * sizeof(entity),
+						sizeof(entity));
+			std::memcpy(target->data.data() + slot * sizeof(entity),
+						&moved,
+						sizeof(entity));
+		}
+		// Emptied chunks are kept for the next push
+		--source->size;
+		--this->m_size;
+		return moved;
+	}
+
+	[[nodiscard]] bool has(std::uint32_t id) const
+	{
+		return this->m_slots.at(id) != s_absent;
+	}
+
+	[[nodiscard]] void* at(std::uint32_t id, std::size_t row) const
+	{
+		const auto& element = this->m_columns.at(this->m_slots.at(id));
+		auto [target, slot] = this->locate(row);
+		return target->data.data() + element.offset + slot * element.size;
+	}
+
+	template <component T>
+	[[nodiscard]] T* column_data(std::size_t chunk_index)
+	{
+		const auto& element =
+			this->m_columns.at(this->m_slots.at(component_id<T>()));
+		return reinterpret_cast<T*>(
+			this->m_chunks.at(chunk_index)->data.data() + element.offset);
+	}
+	template <component T>
+	[[nodiscard]] const T* column_data(std::size_t chunk_index) const
+	{
+		const auto& element =
+			this->m_columns.at(this->m_slots.at(component_id<T>()));
+		return reinterpret_cast<const T*>(
+			this->m_chunks.at(chunk_index)->data.data() + element.offset);
+	}
+
+	[[nodiscard]] const entity* entities(std::size_t chunk_index) const
+	{
+		return reinterpret_cast<const entity*>(
+			this->m_chunks.at(chunk_index)->data.data());
+	}
+
+	[[nodiscard]] component_mask mask() const
+	{
+		return this->m_mask;
+	}
+	[[nodiscard]] const std::vector<column>& columns() const
+	{
+		return this->m_columns;
+	}
+	[[nodiscard]] std::size_t size() const
+	{
+		return this->m_size;
+	}
+	[[nodiscard]] std::size_t chunk_capacity() const
+	{
+		return this->m_capacity;
+	}
+	[[nodiscard]] std::size_t chunk_count() const
+	{
+		return this->m_chunks.size();
+	}
+	[[nodiscard]] std::size_t chunk_size(std::size_t chunk_index) const
+	{
+		return this->m_chunks.at(chunk_index)->size;
+	}
+
+	archetype(const archetype&) = delete;
+	archetype(archetype&&) = delete;
+	archetype& operator=(const archetype&) = delete;
+	archetype& operator=(archetype&&) = delete;
+};
+
+// Owns the entities and their archetypes. Adding or removing a component
+// moves the entity to another archetype, so do that between queries, not
+// inside one.
+class world
+{
+	struct record
+	{
+		archetype* owner{nullptr};
+		std::size_t row{0};
+		std::uint32_t generation{0};
+	};
+
+	std::vector<record> m_records;
+	std::vector<std::uint32_t> m_free;
+	std::unordered_map<component_mask, std::unique_ptr<archetype>>
+		m_archetypes;
+	// Creation order, so queries visit archetypes in a stable order
+	std::vector<archetype*> m_ordered;
+	std::size_t m_alive{0};
+
+	// A const world hands out read only components
+	template <typename Self, typename T>
+	using maybe_const = std::conditional_t<std::is_const_v<Self>, const T, T>;
+
+	// The queries below for either constness of `self`
+	template <component... Ts, typename Self, typename F>
+	static void visit_chunks(Self& self, F& visit)
+	{
+		const auto wanted = mask_of<Ts...>();
+		for (maybe_const<Self, archetype>* owner : self.m_ordered)
+		{
+			if ((owner->mask() & wanted) != wanted)
+			{
+				continue;
+			}
+			for (std::size_t i = 0; i < owner->chunk_count(); ++i)
+			{
+				const auto size = owner->chunk_size(i);
+				if (size == 0)
+				{
+					continue;
+				}
+				visit(std::span<const entity>{owner->entities(i), size},
+					  std::span<maybe_const<Self, Ts>>{
+						  owner->template column_data<Ts>(i), size}...);
+			}
+		}
+	}
+
+	template <component... Ts, typename Self, typename F>
+	static void visit_chunks_parallel(Self& self, job_system& scheduler,
+									  F& visit)
+	{
+		struct piece
+		{
+			maybe_const<Self, archetype>* owner;
+			std::size_t chunk;
+		};
+		const auto wanted = mask_of<Ts...>();
+		auto pieces = make_frame_vector<piece>();
+		for (maybe_const<Self, archetype>* owner : self.m_ordered)
+		{
+			if ((owner->mask() & wanted) != wanted)
+			{
+				continue;
+			}
+			for (std::size_t i = 0; i < owner->chunk_count(); ++i)
+			{
+				if (owner->chunk_size(i) != 0)
+				{
+					pieces.push_back({owner, i});
+				}
+			}
+		}
+		scheduler.parallel_for(
+			0, pieces.size(), 1, [&](std::size_t begin, std::size_t end) {
+				for (std::size_t i = begin; i < end; ++i)
+				{
+					const auto [owner, chunk] = pieces[i];
+					const auto size = owner->chunk_size(chunk);
+					visit(std::span<const entity>{owner->entities(chunk), size},
+						  std::span<maybe_const<Self, Ts>>{
+							  owner->template column_data<Ts>(chunk),
+							  size}...);
+				}
+			});
+	}
+
+	template <component... Ts, typename Self, typename F>
+	static void visit_entities(Self& self, F& visit)
+	{
+		auto per_entity = [&visit](std::span<const entity> entities,
+								   std::span<maybe_const<Self, Ts>>... data) {
+			for (std::size_t i = 0; i < entities.size(); ++i)
+			{
+				visit(data[i]...);
+			}
+		};
+		visit_chunks<Ts...>(self, per_entity);
+	}
+
+	template <typename F>
+	auto find_or_create(component_mask mask, F&& make_columns) -> archetype&
+	{
+		auto found = this->m_archetypes.find(mask);
+		if (found != this->m_archetypes.end())
+		{
+			return *found->second;
+		}
+		auto created = std::make_unique<archetype>(mask, make_columns());
+		auto& result = *created;
+		this->m_archetypes.emplace(mask, std::move(created));
+		this->m_ordered.push_back(&result);
+		return result;
+	}
+
+	auto allocate() -> entity
+	{
+		++this->m_alive;
+		if (!this->m_free.empty())
+		{
+			const auto index = this->m_free.back();
+			this->m_free.pop_back();
+			return {index, this->m_records.at(index).generation};
+		}
+		this->m_records.emplace_back();
+		return {static_cast<std::uint32_t>(this->m_records.size() - 1), 0};
+	}
+
+	void detach(record& owned)
+	{
+		const auto moved = owned.owner->remove(owned.row);
+		if (moved != entity{})
+		{
+			this->m_records.at(moved.index).row = owned.row;
+		}
+	}
+
+	// Copies the components both archetypes share, new ones stay zeroed
+	void move(entity target, archetype& destination)
+	{
+		auto& owned = this->m_records.at(target.index);
+		const auto row = destination.push(target);
+		for (const auto& element : destination.columns())
+		{
+			auto* to = destination.at(element.id, row);
+			if (owned.owner->has(element.id))
+			{
+				std::memcpy(
+					to, owned.owner->at(element.id, owned.row), element.size);
+			}
+			else
+			{
+				std::memset(to, 0, element.size);
+			}
+		}
+		this->detach(owned);
+		owned.owner = &destination;
+		owned.row = row;
+	}
+
+public:
+	world() = default;
+	~world() = default;
+
+	template <component... Ts>
+	auto create(const Ts&... values) -> entity
+	{
+		auto& destination = this->find_or_create(
+			mask_of<Ts...>(),
+			[] { return std::vector<column>{make_column<Ts>()...}; });
+		const auto created = this->allocate();
+		const auto row = destination.push(created);
+		(std::memcpy(
+			 destination.at(component_id<Ts>(), row), &values, sizeof(Ts)),
+		 ...);
+		auto& owned = this->m_records.at(created.index);
+		owned.owner = &destination;
+		owned.row = row;
+		return created;
+	}
+
+	bool destroy(entity target)
+	{
+		if (!this->alive(target))
+		{
+			return false;
+		}
+		auto& owned = this->m_records.at(target.index);
+		this->detach(owned);
+		owned.owner = nullptr;
+		++owned.generation;
+		this->m_free.push_back(target.index);
+		--this->m_alive;
+		return true;
+	}
+
+	[[nodiscard]] bool alive(entity target) const
+	{
+		return target.index < this->m_records.size() &&
+			   this->m_records.at(target.index).generation ==
+				   target.generation &&
+			   this->m_records.at(target.index).owner != nullptr;
+	}
+
+	template <component T>
+	[[nodiscard]] bool has(entity target) const
+	{
+		return this->alive(target) &&
+			   this->m_records.at(target.index).owner->has(component_id<T>());
+	}
+
+	// Valid until the next structural change
+	template <component T>
+	[[nodiscard]] T* get(entity target)
+	{
+		if (!this->has<T>(target))
+		{
+			return nullptr;
+		}
+		const auto& owned = this->m_records.at(target.index);
+		return static_cast<T*>(owned.owner->at(component_id<T>(), owned.row));
+	}
+
+	// Sets the component, moving the entity to a new archetype if needed
+	template <component T>
+	void add(entity target, const T& value = {})
+	{
+		if (!this->alive(target))
+		{
+			return;
+		}
+		if (!this->has<T>(target))
+		{
+			const auto* source = this->m_records.at(target.index).owner;
+			auto& destination = this->find_or_create(
+				source->mask() | mask_of<T>(), [source] {
+					auto columns = source->columns();
+					columns.push_back(make_column<T>());
+					return columns;
+				});
+			this->move(target, destination);
+		}
+		*this->get<T>(target) = value;
+	}
+
+	template <component T>
+	void remove(entity target)
+	{
+		if (!this->has<T>(target))
+		{
+			return;
+		}
+		const auto* source = this->m_records.at(target.index).owner;
+		auto& destination = this->find_or_create(
+			source->mask() & ~mask_of<T>(), [source] {
+				auto columns = source->columns();
+				std::erase_if(columns, [](const column& element) {
+					return element.id == component_id<T>();
+				});
+				return columns;
+			});
+		this->move(target, destination);
+	}
+
+	// Calls `visit(entities, components...)` once per chunk of every
+	// archetype that has all of Ts, with spans over the chunk's arrays. The
+	// spans are `std::span<const T>` when called on a const world.
+	template <component... Ts, typename F>
+	void each_chunk(F&& visit)
+	{
+		visit_chunks<Ts...>(*this, visit);
+	}
+	template <component... Ts, typename F>
+	void each_chunk(F&& visit) const
+	{
+		visit_chunks<Ts...>(*this, visit);
+	}
+
+	// each_chunk with the chunks spread over the job system. `visit` runs
+	// on several threads at once and must only touch the chunk it's given.
+	template <component... Ts, typename F>
+	void each_chunk_parallel(job_system& scheduler, F&& visit)
+	{
+		visit_chunks_parallel<Ts...>(*this, scheduler, visit);
+	}
+	template <component... Ts, typename F>
+	void each_chunk_parallel(job_system& scheduler, F&& visit) const
+	{
+		visit_chunks_parallel<Ts...>(*this, scheduler, visit);
+	}
+
+	// Per entity version of each_chunk, `visit(components&...)`
+	template <component... Ts, typename F>
+	void each(F&& visit)
+	{
+		visit_entities<Ts...>(*this, visit);
+	}
+	template <component... Ts, typename F>
+	void each(F&& visit) const
+	{
+		visit_entities<Ts...>(*this, visit);
+	}
+
+	[[nodiscard]] std::size_t size() const
+	{
+		return this->m_alive;
+	}
+	[[nodiscard]] std::size_t archetype_count() const
+	{
+		return this->m_ordered.size();
+	}
+
+	world(const world&) = delete;
+	world(world&&) = delete;
+	world& operator=(const world&) = delete;
+	world& operator=(world&&) = delete;
+};
+} // namespace moonstone::engine
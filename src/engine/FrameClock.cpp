@@ -0,0 +1,243 @@
+module;
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+export module moonstone:frame_clock;
+
+import :frame_arena;
+
+export namespace moonstone::engine
+{
+struct frame_options
+{
+	// Rate of scene::on_update, independent of how fast frames are drawn
+	double simulation_rate{60.0};
+	// Frames per second, 0 doesn't limit
+	double frame_cap{0.0};
+	// After a long stall (a breakpoint, loading) the simulation drops time
+	// instead of running hundreds of steps to catch up
+	std::uint32_t max_steps{5};
+	// The OS wakes up late from a sleep, the last bit before the deadline is
+	// spun instead
+	std::chrono::microseconds spin_window{1500};
+};
+
+// Milliseconds, over the recorded frames
+struct frame_stats
+{
+	double average{};
+	double p50{};
+	double p95{};
+	double p99{};
+	double worst{};
+	// How far frames land from the cap's period, 0 when uncapped
+	double pacing_average{};
+	double pacing_worst{};
+	std::size_t samples{};
+	std::uint64_t dropped_steps{};
+};
+
+// Drives the main loop: a fixed-timestep accumulator for the simulation, the
+// interpolation alpha for rendering in between steps and an optional frame
+// cap that sleeps for most of the wait and spins for the rest.
+//
+//   clock.begin_frame();
+//   while (clock.step()) scene.on_update(clock.get_step());
+//   scene.on_render(clock.get_alpha());
+//   ...swap...
+//   clock.end_frame();
+class frame_clock
+{
+	using clock = std::chrono::steady_clock;
+	using seconds = std::chrono::duration<double>;
+	static constexpr std::size_t s_history = 256;
+
+	frame_options m_options;
+	seconds m_step{};
+	seconds m_accumulator{};
+	seconds m_delta{};
+	clock::time_point m_frame_start{clock::now()};
+	clock::time_point m_deadline{clock::now()};
+	std::uint32_t m_steps_this_frame{0};
+	std::uint64_t m_dropped_steps{0};
+
+	std::array<float, s_history> m_frame_times{};
+	std::array<float, s_history> m_pacing_errors{};
+	std::size_t m_recorded{0};
+	std::size_t m_next{0};
+
+	[[nodiscard]] seconds frame_period() const
+	{
+		return seconds{1.0 / this->m_options.frame_cap};
+	}
+
+	void record(seconds frame_time)
+	{
+		using milliseconds = std::chrono::duration<float, std::milli>;
+		this->m_frame_times.at(this->m_next) =
+			std::chrono::duration_cast<milliseconds>(frame_time).count();
+		this->m_pacing_errors.at(this->m_next) =
+			this->is_capped()
+				? std::abs(std::chrono::duration_cast<milliseconds>(
+							   frame_time - this->frame_period())
+							   .count())
+				: 0.0F;
+		this->m_next = (this->m_next + 1) % s_history;
+		this->m_recorded = std::min(this->m_recorded + 1, s_history);
+	}
+
+	void wait_until(clock::time_point deadline) const
+	{
+		const auto sleep_until = deadline - this->m_options.spin_window;
+		if (clock::now() < sleep_until)
+		{
+			std::this_thread::sleep_until(sleep_until);
+		}
+		while (clock::now() < deadline)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+public:
+	explicit frame_clock(frame_options options = {}) :
+		m_options{options},
+		m_step{1.0 / options.simulation_rate}
+	{
+	}
+
+	void set_frame_cap(double frame_cap)
+	{
+		this->m_options.frame_cap = frame_cap;
+		this->m_deadline = clock::now();
+	}
+	[[nodiscard]] bool is_capped() const
+	{
+		return this->m_options.frame_cap > 0.0;
+	}
+
+	void begin_frame()
+	{
+		const auto now = clock::now();
+		this->m_delta = now - this->m_frame_start;
+		this->m_frame_start = now;
+		this->record(this->m_delta);
+
+		// Also bounds what piles up while nothing consumes the steps
+		const auto longest = this->m_step * this->m_options.max_steps;
+		this->m_accumulator += this->m_delta;
+		if (this->m_accumulator > longest)
+		{
+			this->m_dropped_steps += static_cast<std::uint64_t>(
+				(this->m_accumulator - longest) / this->m_step);
+			this->m_accumulator = longest;
+		}
+		this->m_steps_this_frame = 0;
+	}
+
+	// True while there's a whole simulation step left to run this frame
+	bool step()
+	{
+		if (this->m_accumulator < this->m_step)
+		{
+			return false;
+		}
+		this->m_accumulator -= this->m_step;
+		++this->m_steps_this_frame;
+		return true;
+	}
+
+	// Sleeps off whatever is left of the frame when capped
+	void end_frame()
+	{
+		if (!this->is_capped())
+		{
+			return;
+		}
+		const auto period =
+			std::chrono::duration_cast<clock::duration>(this->frame_period());
+		this->m_deadline += period;
+		// Fell more than a frame behind, pace from this frame instead of
+		// rushing through frames to catch up
+		if (this->m_deadline + period < clock::now())
+		{
+			this->m_deadline = this->m_frame_start + period;
+		}
+		this->wait_until(this->m_deadline);
+	}
+
+	// Fixed delta time passed to each on_update
+	[[nodiscard]] float get_step() const
+	{
+		return static_cast<float>(this->m_step.count());
+	}
+	// How far between the last step and the next one this frame is drawn
+	[[nodiscard]] float get_alpha() const
+	{
+		return static_cast<float>(this->m_accumulator / this->m_step);
+	}
+	// Real time since the previous frame
+	[[nodiscard]] float get_delta() const
+	{
+		return static_cast<float>(this->m_delta.count());
+	}
+	[[nodiscard]] std::uint32_t get_steps_this_frame() const
+	{
+		return this->m_steps_this_frame;
+	}
+	[[nodiscard]] const frame_options& get_options() const
+	{
+		return this->m_options;
+	}
+
+	[[nodiscard]] frame_stats get_stats() const
+	{
+		frame_stats stats{.samples = this->m_recorded,
+						  .dropped_steps = this->m_dropped_steps};
+		if (this->m_recorded == 0)
+		{
+			return stats;
+		}
+		auto times = make_frame_vector<float>();
+		times.assign(this->m_frame_times.begin(),
+					 this->m_frame_times.begin() +
+						 static_cast<std::ptrdiff_t>(this->m_recorded));
+		std::ranges::sort(times);
+		auto percentile = [&](double fraction) {
+			const auto index = static_cast<std::size_t>(
+				fraction * static_cast<double>(times.size() - 1));
+			return static_cast<double>(times.at(index));
+		};
+		double total = 0.0;
+		double pacing_total = 0.0;
+		for (std::size_t i = 0; i < this->m_recorded; ++i)
+		{
+			total += this->m_frame_times.at(i);
+			pacing_total += this->m_pacing_errors.at(i);
+			stats.pacing_worst =
+				std::max(stats.pacing_worst,
+						 static_cast<double>(this->m_pacing_errors.at(i)));
+		}
+		const auto count = static_cast<double>(this->m_recorded);
+		stats.average = total / count;
+		stats.p50 = percentile(0.50);
+		stats.p95 = percentile(0.95);
+		stats.p99 = percentile(0.99);
+		stats.worst = times.back();
+		stats.pacing_average = pacing_total / count;
+		return stats;
+	}
+
+	frame_clock(const frame_clock&) = delete;
+	frame_clock(frame_clock&&) = delete;
+	frame_clock& operator=(const frame_clock&) = delete;
+	frame_clock& operator=(frame_clock&&) = delete;
+};
+} // namespace moonstone::engine
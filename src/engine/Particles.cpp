@@ -0,0 +1,521 @@
+module;
+
+#include "Try.hpp"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <span>
+#include <stdexcept>
+#include <vector>
+#ifdef __x86_64__
+#include <immintrin.h>
+#define MOONSTONE_PARTICLES_SIMD
+#endif
+
+export module moonstone:particles;
+
+import :error;
+import :jobs;
+import :vertex_buffer;
+import :vertex_array;
+import :index_buffer;
+import :buffer_layout;
+import :shader;
+import :renderer;
+import :memory_tracking;
+
+export namespace moonstone::engine
+{
+// What the instanced shader reads per particle, 16 bytes
+struct particle_instance
+{
+	glm::vec2 position{0.0F, 0.0F};
+	float size{0.0F};
+	// RGBA8, red in the lowest byte
+	std::uint32_t colour{0};
+
+	static void register_layout(renderer::buffer_layout& layout)
+	{
+		layout.push<float>(2);
+		layout.push<float>(1);
+		layout.push<std::byte>(4);
+	}
+};
+
+struct particle_spawn
+{
+	glm::vec2 position{0.0F, 0.0F};
+	glm::vec2 velocity{0.0F, 0.0F};
+	// Seconds
+	float lifetime{1.0F};
+};
+
+// Shared by every particle of a system, colour and size go from start to
+// end over each particle's life
+struct particle_settings
+{
+	glm::vec2 gravity{0.0F, -98.0F};
+	glm::vec4 start_colour{1.0F, 1.0F, 1.0F, 1.0F};
+	glm::vec4 end_colour{1.0F, 1.0F, 1.0F, 0.0F};
+	float start_size{8.0F};
+	float end_size{2.0F};
+};
+
+struct particle_stats
+{
+	std::size_t alive{0};
+	std::size_t capacity{0};
+};
+} // namespace moonstone::engine
+
+namespace moonstone::engine
+{
+// The kernels process whole groups of this many particles, the pools are
+// padded so the last group never needs a scalar tail
+constexpr std::size_t s_lanes = 8;
+
+constexpr auto round_up_to_lanes(std::size_t count) -> std::size_t
+{
+	return (count + s_lanes - 1) / s_lanes * s_lanes;
+}
+
+// Structure of arrays, one column per component so the kernels load eight
+// particles at a time
+struct particle_columns
+{
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> vx;
+	std::vector<float> vy;
+	// Fraction of the lifetime used up, dead at 1
+	std::vector<float> age;
+	std::vector<float> inv_lifetime;
+
+	void resize(std::size_t count)
+	{
+		for (auto* column : {&x, &y, &vx, &vy, &age, &inv_lifetime})
+		{
+			column->resize(count);
+		}
+	}
+
+	void move(std::size_t from, std::size_t to)
+	{
+		for (auto* column : {&x, &y, &vx, &vy, &age, &inv_lifetime})
+		{
+			(*column)[to] = (*column)[from];
+		}
+	}
+};
+
+// Start and slope of the colour and size ramps, colour already scaled to
+// 0..255 so the kernels only have to round
+struct particle_ramps
+{
+	std::array<float, 4> colour{};
+	std::array<float, 4> colour_slope{};
+	float size{0.0F};
+	float size_slope{0.0F};
+
+	explicit particle_ramps(const particle_settings& settings)
+	{
+		for (glm::length_t c = 0; c < 4; ++c)
+		{
+			const auto index = static_cast<std::size_t>(c);
+			colour.at(index) = settings.start_colour[c] * 255.0F;
+			colour_slope.at(index) =
+				(settings.end_colour[c] - settings.start_colour[c]) * 255.0F;
+		}
+		size = settings.start_size;
+		size_slope = settings.end_size - settings.start_size;
+	}
+};
+
+void integrate_scalar(particle_columns& p, std::size_t first,
+					  std::size_t last, glm::vec2 gravity, float delta_time)
+{
+	for (auto i = first; i < last; ++i)
+	{
+		p.vx[i] += gravity.x * delta_time;
+		p.vy[i] += gravity.y * delta_time;
+		p.x[i] += p.vx[i] * delta_time;
+		p.y[i] += p.vy[i] * delta_time;
+		p.age[i] += p.inv_lifetime[i] * delta_time;
+	}
+}
+
+// `lag` is how far behind the last update the frame is drawn. The update
+// moved every particle by its velocity times the step, so stepping back
+// along the velocity lands between the last two positions.
+void write_scalar(const particle_columns& p, std::size_t first,
+				  std::size_t last, const particle_ramps& ramps, float lag,
+				  particle_instance* out)
+{
+	for (auto i = first; i < last; ++i)
+	{
+		const auto t = std::min(p.age[i], 1.0F);
+		std::uint32_t colour = 0;
+		for (std::size_t c = 0; c < 4; ++c)
+		{
+			const auto channel =
+				ramps.colour.at(c) + (ramps.colour_slope.at(c) * t) + 0.5F;
+			colour |= static_cast<std::uint32_t>(channel) << (c * 8);
+		}
+		out[i] = {.position = {p.x[i] - (p.vx[i] * lag),
+							   p.y[i] - (p.vy[i] * lag)},
+				  .size = ramps.size + (ramps.size_slope * t),
+				  .colour = colour};
+	}
+}
+
+#ifdef MOONSTONE_PARTICLES_SIMD
+const bool s_has_avx2 = __builtin_cpu_supports("avx2") != 0 &&
+						__builtin_cpu_supports("fma") != 0;
+
+void integrate_sse2(particle_columns& p, std::size_t first, std::size_t last,
+					glm::vec2 gravity, float delta_time)
+{
+	const __m128 dt = _mm_set1_ps(delta_time);
+	const __m128 gx = _mm_set1_ps(gravity.x * delta_time);
+	const __m128 gy = _mm_set1_ps(gravity.y * delta_time);
+	for (auto i = first; i < last; i += 4)
+	{
+		const __m128 vx = _mm_add_ps(_mm_loadu_ps(&p.vx[i]), gx);
+		const __m128 vy = _mm_add_ps(_mm_loadu_ps(&p.vy[i]), gy);
+		_mm_storeu_ps(&p.vx[i], vx);
+		_mm_storeu_ps(&p.vy[i], vy);
+		_mm_storeu_ps(&p.x[i],
+					  _mm_add_ps(_mm_loadu_ps(&p.x[i]), _mm_mul_ps(vx, dt)));
+		_mm_storeu_ps(&p.y[i],
+					  _mm_add_ps(_mm_loadu_ps(&p.y[i]), _mm_mul_ps(vy, dt)));
+		_mm_storeu_ps(
+			&p.age[i],
+			_mm_add_ps(_mm_loadu_ps(&p.age[i]),
+					   _mm_mul_ps(_mm_loadu_ps(&p.inv_lifetime[i]), dt)));
+	}
+}
+
+// Four channels in 0..255 to RGBA8, red lowest
+inline __m128i pack_colour_sse2(__m128 r, __m128 g, __m128 b, __m128 a)
+{
+	return _mm_or_si128(
+		_mm_or_si128(_mm_cvtps_epi32(r),
+					 _mm_slli_epi32(_mm_cvtps_epi32(g), 8)),
+		_mm_or_si128(_mm_slli_epi32(_mm_cvtps_epi32(b), 16),
+					 _mm_slli_epi32(_mm_cvtps_epi32(a), 24)));
+}
+
+inline __m128 ramp_sse2(float start, float slope, __m128 t)
+{
+	return _mm_add_ps(_mm_set1_ps(start), _mm_mul_ps(_mm_set1_ps(slope), t));
+}
+
+void write_sse2(const particle_columns& p, std::size_t first, std::size_t last,
+				const particle_ramps& ramps, float lag, particle_instance* out)
+{
+	const __m128 one = _mm_set1_ps(1.0F);
+	const __m128 behind = _mm_set1_ps(lag);
+	for (auto i = first; i < last; i += 4)
+	{
+		const __m128 t = _mm_min_ps(_mm_loadu_ps(&p.age[i]), one);
+		__m128 x = _mm_sub_ps(_mm_loadu_ps(&p.x[i]),
+							  _mm_mul_ps(_mm_loadu_ps(&p.vx[i]), behind));
+		__m128 y = _mm_sub_ps(_mm_loadu_ps(&p.y[i]),
+							  _mm_mul_ps(_mm_loadu_ps(&p.vy[i]), behind));
+		__m128 size = ramp_sse2(ramps.size, ramps.size_slope, t);
+		__m128 colour = _mm_castsi128_ps(pack_colour_sse2(
+			ramp_sse2(ramps.colour[0], ramps.colour_slope[0], t),
+			ramp_sse2(ramps.colour[1], ramps.colour_slope[1], t),
+			ramp_sse2(ramps.colour[2], ramps.colour_slope[2], t),
+			ramp_sse2(ramps.colour[3], ramps.colour_slope[3], t)));
+		// Columns to instances, each row is one particle_instance
+		_MM_TRANSPOSE4_PS(x, y, size, colour);
+		auto* target = reinterpret_cast<float*>(out + i);
+		_mm_storeu_ps(target, x);
+		_mm_storeu_ps(target + 4, y);
+		_mm_storeu_ps(target + 8, size);
+		_mm_storeu_ps(target + 12, colour);
+	}
+}
+
+__attribute__((target("avx2,fma"))) void integrate_avx2(
+	particle_columns& p, std::size_t first, std::size_t last,
+	glm::vec2 gravity, float delta_time)
+{
+	const __m256 dt = _mm256_set1_ps(delta_time);
+	const __m256 gx = _mm256_set1_ps(gravity.x * delta_time);
+	const __m256 gy = _mm256_set1_ps(gravity.y * delta_time);
+	for (auto i = first; i < last; i += 8)
+	{
+		const __m256 vx = _mm256_add_ps(_mm256_loadu_ps(&p.vx[i]), gx);
+		const __m256 vy = _mm256_add_ps(_mm256_loadu_ps(&p.vy[i]), gy);
+		_mm256_storeu_ps(&p.vx[i], vx);
+		_mm256_storeu_ps(&p.vy[i], vy);
+		_mm256_storeu_ps(&p.x[i],
+						 _mm256_fmadd_ps(vx, dt, _mm256_loadu_ps(&p.x[i])));
+		_mm256_storeu_ps(&p.y[i],
+						 _mm256_fmadd_ps(vy, dt, _mm256_loadu_ps(&p.y[i])));
+		_mm256_storeu_ps(&p.age[i],
+						 _mm256_fmadd_ps(_mm256_loadu_ps(&p.inv_lifetime[i]),
+										 dt,
+										 _mm256_loadu_ps(&p.age[i])));
+	}
+}
+
+__attribute__((target("avx2,fma"))) inline __m256i pack_colour_avx2(
+	__m256 r, __m256 g, __m256 b, __m256 a)
+{
+	return _mm256_or_si256(
+		_mm256_or_si256(_mm256_cvtps_epi32(r),
+						_mm256_slli_epi32(_mm256_cvtps_epi32(g), 8)),
+		_mm256_or_si256(_mm256_slli_epi32(_mm256_cvtps_epi32(b), 16),
+						_mm256_slli_epi32(_mm256_cvtps_epi32(a), 24)));
+}
+
+__attribute__((target("avx2,fma"))) inline __m256 ramp_avx2(float start,
+																float slope,
+																__m256 t)
+{
+	return _mm256_fmadd_ps(_mm256_set1_ps(slope), t, _mm256_set1_ps(start));
+}
+
+__attribute__((target("avx2,fma"))) void write_avx2(
+	const particle_columns& p, std::size_t first, std::size_t last,
+	const particle_ramps& ramps, float lag, particle_instance* out)
+{
+	const __m256 one = _mm256_set1_ps(1.0F);
+	const __m256 behind = _mm256_set1_ps(lag);
+	for (auto i = first; i < last; i += 8)
+	{
+		const __m256 t = _mm256_min_ps(_mm256_loadu_ps(&p.age[i]), one);
+		const __m256 x = _mm256_fnmadd_ps(
+			_mm256_loadu_ps(&p.vx[i]), behind, _mm256_loadu_ps(&p.x[i]));
+		const __m256 y = _mm256_fnmadd_ps(
+			_mm256_loadu_ps(&p.vy[i]), behind, _mm256_loadu_ps(&p.y[i]));
+		const __m256 size = ramp_avx2(ramps.size, ramps.size_slope, t);
+		const __m256 colour = _mm256_castsi256_ps(pack_colour_avx2(
+			ramp_avx2(ramps.colour[0], ramps.colour_slope[0], t),
+			ramp_avx2(ramps.colour[1], ramps.colour_slope[1], t),
+			ramp_avx2(ramps.colour[2], ramps.colour_slope[2], t),
+			ramp_avx2(ramps.colour[3], ramps.colour_slope[3], t)));
+		// Transposes within each 128 bit half, particles 0-3 in the low
+		// halves and 4-7 in the high ones
+		const __m256 xy_low = _mm256_unpacklo_ps(x, y);
+		const __m256 xy_high = _mm256_unpackhi_ps(x, y);
+		const __m256 sc_low = _mm256_unpacklo_ps(size, colour);
+		const __m256 sc_high = _mm256_unpackhi_ps(size, colour);
+		const __m256 p0 = _mm256_shuffle_ps(xy_low, sc_low, 0x44);
+		const __m256 p1 = _mm256_shuffle_ps(xy_low, sc_low, 0xEE);
+		const __m256 p2 = _mm256_shuffle_ps(xy_high, sc_high, 0x44);
+		const __m256 p3 = _mm256_shuffle_ps(xy_high, sc_high, 0xEE);
+		auto* target = reinterpret_cast<float*>(out + i);
+		_mm256_storeu_ps(target, _mm256_permute2f128_ps(p0, p1, 0x20));
+		_mm256_storeu_ps(target + 8, _mm256_permute2f128_ps(p2, p3, 0x20));
+		_mm256_storeu_ps(target + 16, _mm256_permute2f128_ps(p0, p1, 0x31));
+		_mm256_storeu_ps(target + 24, _mm256_permute2f128_ps(p2, p3, 0x31));
+	}
+}
+#endif
+
+void integrate(particle_columns& p, std::size_t first, std::size_t last,
+			   glm::vec2 gravity, float delta_time)
+{
+#ifdef MOONSTONE_PARTICLES_SIMD
+	if (s_has_avx2)
+	{
+		integrate_avx2(p, first, last, gravity, delta_time);
+	}
+	else
+	{
+		integrate_sse2(p, first, last, gravity, delta_time);
+	}
+#else
+	integrate_scalar(p, first, last, gravity, delta_time);
+#endif
+}
+
+void write_instances(const particle_columns& p, std::size_t first,
+					 std::size_t last, const particle_ramps& ramps, float lag,
+					 particle_instance* out)
+{
+#ifdef MOONSTONE_PARTICLES_SIMD
+	if (s_has_avx2)
+	{
+		write_avx2(p, first, last, ramps, lag, out);
+	}
+	else
+	{
+		write_sse2(p, first, last, ramps, lag, out);
+	}
+#else
+	write_scalar(p, first, last, ramps, lag, out);
+#endif
+}
+} // namespace moonstone::engine
+
+export namespace moonstone::engine
+{
+// A fixed size pool of short lived particles for effects, meant for tens or
+// hundreds of thousands of them. engine::quad connects and erases one
+// buffer slot per object, far too slow for this churn, so the pool is kept
+// dense instead: live particles are always [0, alive), a dying one is
+// replaced by the last. The simulation runs on eight particles at a time
+// across the job system, and drawing writes the instances straight into a
+// mapped stream buffer for one instanced draw call. GL thread only.
+class particle_system
+{
+	// Particles per job, a multiple of s_lanes
+	static constexpr std::size_t s_grain = 8192;
+	static constexpr std::array<std::uint32_t, 6> s_quad_indices{
+		0, 1, 2, 2, 3, 0};
+	static constexpr std::array<glm::vec2, 4> s_corners{
+		glm::vec2{-0.5F, -0.5F},
+		glm::vec2{0.5F, -0.5F},
+		glm::vec2{0.5F, 0.5F},
+		glm::vec2{-0.5F, 0.5F}};
+
+	std::size_t m_capacity;
+	std::size_t m_alive{0};
+	// delta_time of the last update, for drawing between updates
+	float m_step{0.0F};
+	particle_columns m_particles;
+	particle_settings m_settings;
+	renderer::vertex_array m_vao;
+	renderer::static_buffer<glm::vec2> m_quad{s_corners};
+	renderer::batch_buffer<particle_instance> m_instances;
+	renderer::index_buffer m_ibo;
+
+	error::result<> create()
+	{
+		renderer::buffer_layout quad_layout;
+		quad_layout.push<float>(2);
+		renderer::buffer_layout instance_layout;
+		particle_instance::register_layout(instance_layout);
+		Try(this->m_vao.add_buffer(this->m_quad, quad_layout));
+		Try(this->m_vao.add_buffer(this->m_instances, instance_layout, 1, 1));
+		Try(renderer::vertex_array::unbind());
+		Try(this->m_ibo.append(s_quad_indices));
+		return {};
+	}
+
+	// Fills every hole a dead particle left with the last live one
+	void remove_dead()
+	{
+		auto& p = this->m_particles;
+		for (std::size_t i = 0; i < this->m_alive;)
+		{
+			if (p.age[i] < 1.0F)
+			{
+				++i;
+				continue;
+			}
+			--this->m_alive;
+			p.move(this->m_alive, i);
+		}
+	}
+
+public:
+	// Rounded up to a multiple of eight
+	explicit particle_system(std::size_t capacity,
+							 particle_settings settings = {}) :
+		m_capacity{round_up_to_lanes(capacity)},
+		m_settings{settings}
+	{
+		const memory_scope scope{memory_tag::renderer};
+		this->m_particles.resize(this->m_capacity);
+		auto err = this->create();
+		if (!err.has_value())
+		{
+			throw std::runtime_error(err.error().format());
+		}
+	}
+	~particle_system() = default;
+
+	// False once the pool is full, the particle is dropped
+	bool emit(const particle_spawn& spawn)
+	{
+		if (this->m_alive == this->m_capacity)
+		{
+			return false;
+		}
+		auto& p = this->m_particles;
+		const auto i = this->m_alive++;
+		p.x[i] = spawn.position.x;
+		p.y[i] = spawn.position.y;
+		p.vx[i] = spawn.velocity.x;
+		p.vy[i] = spawn.velocity.y;
+		p.age[i] = 0.0F;
+		p.inv_lifetime[i] = 1.0F / std::max(spawn.lifetime, 1e-3F);
+		return true;
+	}
+
+	// Moves and ages every particle, then drops the ones that died
+	void update(float delta_time)
+	{
+		const auto gravity = this->m_settings.gravity;
+		this->m_step = delta_time;
+		jobs().parallel_for(
+			0,
+			round_up_to_lanes(this->m_alive),
+			s_grain,
+			[this, gravity, delta_time](std::size_t first, std::size_t last) {
+				integrate(this->m_particles, first, last, gravity, delta_time);
+			});
+		this->remove_dead();
+	}
+
+	// The camera and the draw block are the caller's, like for sprite_batch.
+	// `alpha` places the particles between the last two updates.
+	error::result<> draw(const renderer::shader& shader, float alpha = 1.0F)
+	{
+		if (this->m_alive == 0)
+		{
+			return {};
+		}
+		const particle_ramps ramps{this->m_settings};
+		const auto lag = (1.0F - alpha) * this->m_step;
+		// The padding is written too, it's never drawn
+		const auto padded = round_up_to_lanes(this->m_alive);
+		auto out = Try(this->m_instances.map(padded));
+		jobs().parallel_for(
+			0,
+			padded,
+			s_grain,
+			[this, &ramps, lag, out](std::size_t first, std::size_t last) {
+				write_instances(
+					this->m_particles, first, last, ramps, lag, out.data());
+			});
+		Try(this->m_instances.unmap());
+		Try(renderer::renderer::draw_instanced(
+			this->m_vao,
+			this->m_ibo,
+			shader,
+			static_cast<std::uint32_t>(s_quad_indices.size()),
+			static_cast<std::uint32_t>(s_corners.size()),
+			static_cast<std::uint32_t>(this->m_alive)));
+		return {};
+	}
+
+	void clear()
+	{
+		this->m_alive = 0;
+	}
+
+	[[nodiscard]] particle_settings& settings()
+	{
+		return this->m_settings;
+	}
+
+	[[nodiscard]] particle_stats get_stats() const
+	{
+		return {.alive = this->m_alive, .capacity = this->m_capacity};
+	}
+
+	particle_system(const particle_system&) = delete;
+	particle_system(particle_system&&) = delete;
+	particle_system& operator=(const particle_system&) = delete;
+	particle_system& operator=(particle_system&&) = delete;
+};
+} // namespace moonstone::engine
@@ -0,0 +1,233 @@
+module;
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+#include <utility>
+#include <vector>
+
+export module moonstone:spatial_grid;
+
+export namespace moonstone::engine
+{
+// Axis aligned, in world units
+struct aabb
+{
+	glm::vec2 min{0.0F, 0.0F};
+	glm::vec2 max{0.0F, 0.0F};
+
+	[[nodiscard]] bool overlaps(const aabb& other) const
+	{
+		return this->min.x <= other.max.x && other.min.x <= this->max.x &&
+			   this->min.y <= other.max.y && other.min.y <= this->max.y;
+	}
+
+	[[nodiscard]] glm::vec2 center() const
+	{
+		return (this->min + this->max) * 0.5F;
+	}
+
+	[[nodiscard]] glm::vec2 half_extent() const
+	{
+		return (this->max - this->min) * 0.5F;
+	}
+};
+
+using spatial_id = std::uint32_t;
+
+// Loose uniform grid. Every item lives in the one cell under its center, so
+// moving only touches the grid when the center crosses into another cell.
+// Queries widen the rectangle by the largest half extent ever inserted, which
+// catches items hanging over from neighbouring cells, then test the exact
+// bounds. Positions outside the area are clamped into the border cells.
+template <typename T>
+class spatial_grid
+{
+	static constexpr std::uint32_t s_no_cell =
+		std::numeric_limits<std::uint32_t>::max();
+
+	struct item
+	{
+		aabb bounds;
+		T payload{};
+		std::uint32_t cell{s_no_cell};
+		// Index inside the cell's list, so removal is a swap with the last
+		std::uint32_t slot{0};
+	};
+
+	glm::vec2 m_origin;
+	float m_cell_size;
+	glm::ivec2 m_dimensions;
+	// Only ever grows, a shrinking item keeps the query a little wider
+	glm::vec2 m_max_half_extent{0.0F, 0.0F};
+	std::vector<std::vector<spatial_id>> m_cells;
+	std::vector<item> m_items;
+	std::vector<spatial_id> m_free;
+	std::size_t m_size{0};
+
+	[[nodiscard]] glm::ivec2 cell_of(glm::vec2 point) const
+	{
+		const glm::ivec2 cell{glm::floor((point - this->m_origin) /
+										 this->m_cell_size)};
+		return glm::clamp(cell, glm::ivec2{0}, this->m_dimensions - 1);
+	}
+
+	[[nodiscard]] std::uint32_t index_of(glm::ivec2 cell) const
+	{
+		return static_cast<std::uint32_t>(cell.y * this->m_dimensions.x +
+										  cell.x);
+	}
+
+	void link(spatial_id id, std::uint32_t cell)
+	{
+		auto& bucket = this->m_cells.at(cell);
+		auto& linked = this->m_items.at(id);
+		linked.cell = cell;
+		linked.slot = static_cast<std::uint32_t>(bucket.size());
+		bucket.push_back(id);
+	}
+
+	void unlink(spatial_id id)
+	{
+		auto& unlinked = this->m_items.at(id);
+		auto& bucket = this->m_cells.at(unlinked.cell);
+		const auto moved = bucket.back();
+		bucket[unlinked.slot] = moved;
+		this->m_items.at(moved).slot = unlinked.slot;
+		bucket.pop_back();
+		unlinked.cell = s_no_cell;
+	}
+
+public:
+	spatial_grid(aabb area, float cell_size) :
+		m_origin{area.min},
+		m_cell_size{cell_size},
+		m_dimensions{glm::max(
+			glm::ivec2{glm::ceil((area.max - area.min) / cell_size)},
+			glm::ivec2{1})},
+		m_cells(static_cast<std::size_t>(m_dimensions.x * m_dimensions.y))
+	{
+	}
+	~spatial_grid() = default;
+
+	auto insert(const aabb& bounds, const T& payload) -> spatial_id
+	{
+		spatial_id id = 0;
+		if (this->m_free.empty())
+		{
+			id = static_cast<spatial_id>(this->m_items.size());
+			this->m_items.emplace_back();
+		}
+		else
+		{
+			id = this->m_free.back();
+			this->m_free.pop_back();
+		}
+		auto& inserted = this->m_items.at(id);
+		inserted.bounds = bounds;
+		inserted.payload = payload;
+		this->m_max_half_extent =
+			glm::max(this->m_max_half_extent, bounds.half_extent());
+		this->link(id, this->index_of(this->cell_of(bounds.center())));
+		++this->m_size;
+		return id;
+	}
+
+	// Cheap when the center stays in its cell, which is most frames
+	void move(spatial_id id, const aabb& bounds)
+	{
+		auto& moved = this->m_items.at(id);
+		moved.bounds = bounds;
+		this->m_max_half_extent =
+			glm::max(this->m_max_half_extent, bounds.half_extent());
+		const auto cell = this->index_of(this->cell_of(bounds.center()));
+		if (cell != moved.cell)
+		{
+			this->unlink(id);
+			this->link(id, cell);
+		}
+	}
+
+	void remove(spatial_id id)
+	{
+		this->unlink(id);
+		this->m_free.push_back(id);
+		--this->m_size;
+	}
+
+	// Calls visit(payload) for every item overlapping the view
+	template <typename F>
+	void query(const aabb& view, F&& visit) const
+	{
+		const auto low = this->cell_of(view.min - this->m_max_half_extent);
+		const auto high = this->cell_of(view.max + this->m_max_half_extent);
+		for (int y = low.y; y <= high.y; ++y)
+		{
+			for (int x = low.x; x <= high.x; ++x)
+			{
+				for (const auto id : this->m_cells[this->index_of({x, y})])
+				{
+					const auto& found = this->m_items[id];
+					if (found.bounds.overlaps(view))
+					{
+						visit(found.payload);
+					}
+				}
+			}
+		}
+	}
+
+	[[nodiscard]] const aabb& bounds(spatial_id id) const
+	{
+		return this->m_items.at(id).bounds;
+	}
+
+	[[nodiscard]] std::size_t size() const
+	{
+		return this->m_size;
+	}
+
+	spatial_grid(const spatial_grid&) = delete;
+	spatial_grid(spatial_grid&&) = default;
+	spatial_grid& operator=(const spatial_grid&) = delete;
+	spatial_grid& operator=(spatial_grid&&) = default;
+};
+
+// Keeps one item in a grid for as long as its owner lives, for objects that
+// move around and don't want to track their id by hand
+template <typename T>
+class spatial_link
+{
+	spatial_grid<T>* m_grid;
+	spatial_id m_id;
+
+public:
+	spatial_link(spatial_grid<T>& grid, const aabb& bounds, const T& payload) :
+		m_grid{&grid},
+		m_id{grid.insert(bounds, payload)}
+	{
+	}
+	~spatial_link()
+	{
+		if (this->m_grid != nullptr)
+		{
+			this->m_grid->remove(this->m_id);
+		}
+	}
+
+	void move(const aabb& bounds)
+	{
+		this->m_grid->move(this->m_id, bounds);
+	}
+
+	spatial_link(const spatial_link&) = delete;
+	spatial_link(spatial_link&& other) noexcept :
+		m_grid{std::exchange(other.m_grid, nullptr)},
+		m_id{other.m_id}
+	{
+	}
+	spatial_link& operator=(const spatial_link&) = delete;
+	spatial_link& operator=(spatial_link&&) = delete;
+};
+} // namespace moonstone::engine
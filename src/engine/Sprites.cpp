@@ -0,0 +1,255 @@
+module;
+
+#include "Try.hpp"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+export module moonstone:sprites;
+
+import :ecs;
+import :error;
+import :vertex_element;
+import :vertex_buffer;
+import :vertex_array;
+import :index_buffer;
+import :buffer_layout;
+import :shader;
+import :renderer;
+import :memory_tracking;
+import :frame_arena;
+import :jobs;
+import :spatial_grid;
+import :stats;
+
+export namespace moonstone::engine
+{
+// What engine::quad stores per object, as components
+struct transform
+{
+	glm::vec2 position{0.0F, 0.0F};
+	glm::vec2 size{1.0F, 1.0F};
+	// 0,0 is the bottom left corner, 1,1 the top right
+	glm::vec2 anchor{0.0F, 0.0F};
+};
+
+struct sprite
+{
+	// min u, min v, max u, max v inside the layer
+	glm::vec4 uv_rect{0.0F, 0.0F, 1.0F, 1.0F};
+	std::uint32_t layer{0};
+};
+
+// Where the entity sits in the culling grid, see sync_sprite_grid
+struct culling_proxy
+{
+	spatial_id id{0};
+};
+
+using sprite_grid = spatial_grid<entity>;
+
+// One draw for any number of sprites. Systems write the vertices straight
+// into it, it's uploaded once and drawn with a shared index buffer.
+class sprite_batch
+{
+	static constexpr std::array<std::uint32_t, 6> s_quad_indices{
+		0, 1, 2, 2, 3, 0};
+
+	renderer::vertex_array m_vao;
+	renderer::batch_buffer<renderer::vertex_element> m_vbo;
+	renderer::index_buffer m_ibo;
+	renderer::buffer_layout m_layout;
+	// Cleared but never shrunk, so a steady scene doesn't allocate
+	std::vector<renderer::vertex_element> m_vertices;
+	std::size_t m_indexed_sprites{0};
+
+	error::result<> create()
+	{
+		renderer::vertex_element::register_layout(this->m_layout);
+		Try(this->m_vao.add_buffer(this->m_vbo, this->m_layout));
+		Try(renderer::vertex_array::unbind());
+		return {};
+	}
+
+	// The index pattern is the same for every sprite, so it's only
+	// extended, doubling to keep it rare
+	error::result<> grow_indices(std::size_t sprites)
+	{
+		if (sprites <= this->m_indexed_sprites)
+		{
+			return {};
+		}
+		const auto target = std::max(sprites, this->m_indexed_sprites * 2);
+		std::vector<std::uint32_t> indices;
+		indices.reserve((target - this->m_indexed_sprites) * 6);
+		for (auto i = this->m_indexed_sprites; i < target; ++i)
+		{
+			for (const auto index : s_quad_indices)
+			{
+				indices.push_back(static_cast<std::uint32_t>(i * 4 + index));
+			}
+		}
+		Try(this->m_ibo.append(indices));
+		this->m_indexed_sprites = target;
+		return {};
+	}
+
+public:
+	explicit sprite_batch(std::size_t reserve = 1024)
+	{
+		const memory_scope scope{memory_tag::renderer};
+		this->m_vertices.reserve(reserve * 4);
+		auto err = this->create().and_then(
+			[this, reserve] { return this->grow_indices(reserve); });
+		if (!err.has_value())
+		{
+			throw std::runtime_error(err.error().format());
+		}
+	}
+	~sprite_batch() = default;
+
+	void clear()
+	{
+		this->m_vertices.clear();
+	}
+
+	// Room for `sprites` more sprites, four vertices each
+	auto append(std::size_t sprites) -> std::span<renderer::vertex_element>
+	{
+		const memory_scope scope{memory_tag::renderer};
+		const auto first = this->m_vertices.size();
+		this->m_vertices.resize(first + sprites * 4);
+		return std::span{this->m_vertices}.subspan(first);
+	}
+
+	[[nodiscard]] std::size_t size() const
+	{
+		return this->m_vertices.size() / 4;
+	}
+
+	error::result<> upload()
+	{
+		Try(this->grow_indices(this->size()));
+		Try(this->m_vbo.upload(
+			std::span<const renderer::vertex_element>{this->m_vertices}));
+		return {};
+	}
+
+	error::result<> draw(const renderer::shader& shader)
+	{
+		if (this->m_vertices.empty())
+		{
+			return {};
+		}
+		Try(renderer::renderer::draw(
+			this->m_vao,
+			this->m_ibo,
+			shader,
+			static_cast<std::uint32_t>(this->size() * 6),
+			static_cast<std::uint32_t>(this->m_vertices.size())));
+		return {};
+	}
+
+	sprite_batch(const sprite_batch&) = delete;
+	sprite_batch(sprite_batch&&) = delete;
+	sprite_batch& operator=(const sprite_batch&) = delete;
+	sprite_batch& operator=(sprite_batch&&) = delete;
+};
+
+// Same corners and winding as engine::quad
+void write_sprite(std::span<renderer::vertex_element, 4> out,
+				  const transform& where, const sprite& look)
+{
+	const glm::vec2 low = where.position - where.size * where.anchor;
+	const glm::vec2 high = low + where.size;
+	out[0] = {{low.x, high.y}, {look.uv_rect.x, look.uv_rect.w}, look.layer};
+	out[1] = {{low.x, low.y}, {look.uv_rect.x, look.uv_rect.y}, look.layer};
+	out[2] = {{high.x, low.y}, {look.uv_rect.z, look.uv_rect.y}, look.layer};
+	out[3] = {{high.x, high.y}, {look.uv_rect.z, look.uv_rect.w}, look.layer};
+}
+
+[[nodiscard]] aabb bounds_of(const transform& where)
+{
+	const glm::vec2 low = where.position - where.size * where.anchor;
+	return {low, low + where.size};
+}
+
+// Moves every entity with a culling_proxy to where its transform is now.
+// Serial, the grid isn't thread safe, but most entities stay in their cell.
+void sync_sprite_grid(const world& entities, sprite_grid& grid)
+{
+	entities.each_chunk<transform, culling_proxy>(
+		[&grid](std::span<const entity> /*owners*/,
+				std::span<const transform> transforms,
+				std::span<const culling_proxy> proxies) {
+			for (std::size_t i = 0; i < transforms.size(); ++i)
+			{
+				grid.move(proxies[i].id, bounds_of(transforms[i]));
+			}
+		});
+}
+
+// The sprite system, rebuilds the batch from every entity that has a
+// transform and a sprite. Chunks are written in parallel, each one into its
+// own range of the batch.
+void build_sprite_batch(const world& entities, sprite_batch& batch)
+{
+	struct piece
+	{
+		std::span<const transform> transforms;
+		std::span<const sprite> sprites;
+		std::size_t first;
+	};
+	auto pieces = make_frame_vector<piece>();
+	std::size_t total = 0;
+	entities.each_chunk<transform, sprite>(
+		[&](std::span<const entity> owners,
+			std::span<const transform> transforms,
+			std::span<const sprite> sprites) {
+			pieces.push_back({transforms, sprites, total});
+			total += owners.size();
+		});
+	batch.clear();
+	auto out = batch.append(total);
+	jobs().parallel_for(
+		0, pieces.size(), 1, [&](std::size_t begin, std::size_t end) {
+			for (const auto& chunk : std::span{pieces}.subspan(
+					 begin, end - begin))
+			{
+				for (std::size_t i = 0; i < chunk.transforms.size(); ++i)
+				{
+					write_sprite(out.subspan((chunk.first + i) * 4).first<4>(),
+								 chunk.transforms[i],
+								 chunk.sprites[i]);
+				}
+			}
+		});
+}
+
+// Same, but only for the entities the grid finds inside `view`, so the cost
+// follows what's on screen instead of the size of the world. Entities
+// without a culling_proxy aren't in the grid and never drawn by this one.
+void build_sprite_batch(world& entities, sprite_batch& batch,
+						const sprite_grid& grid, const aabb& view)
+{
+	auto visible = make_frame_vector<entity>();
+	grid.query(view, [&visible](entity found) { visible.push_back(found); });
+	count(counter::culled, grid.size() - visible.size());
+	batch.clear();
+	auto out = batch.append(visible.size());
+	jobs().parallel_for(
+		0, visible.size(), 256, [&](std::size_t begin, std::size_t end) {
+			for (auto i = begin; i < end; ++i)
+			{
+				write_sprite(out.subspan(i * 4).first<4>(),
+							 *entities.get<transform>(visible[i]),
+							 *entities.get<sprite>(visible[i]));
+			}
+		});
+}
+} // namespace moonstone::engine
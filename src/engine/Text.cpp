@@ -0,0 +1,444 @@
+module;
+
+#include "Try.hpp"
+#define STB_TRUETYPE_IMPLEMENTATION
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <glm/glm.hpp>
+#include <span>
+#include <stb_truetype.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+export module moonstone:text;
+
+import :error;
+import :file_system;
+import :mipmap;
+import :texture_array;
+import :shader;
+import :sprites;
+import :memory_tracking;
+import :logging;
+
+namespace moonstone::engine
+{
+// Decodes one UTF-8 code point and moves past it, broken sequences give
+// U+FFFD
+auto next_code_point(std::string_view& text) -> char32_t
+{
+	const auto lead = static_cast<unsigned char>(text.front());
+	std::size_t length = 0;
+	if (lead < 0x80)
+	{
+		length = 1;
+	}
+	else if ((lead >> 5U) == 0x6)
+	{
+		length = 2;
+	}
+	else if ((lead >> 4U) == 0xE)
+	{
+		length = 3;
+	}
+	else if ((lead >> 3U) == 0x1E)
+	{
+		length = 4;
+	}
+	if (length == 0 || length > text.size())
+	{
+		text.remove_prefix(1);
+		return U'\uFFFD';
+	}
+	char32_t result = length == 1 ? lead : lead & (0x7FU >> length);
+	for (std::size_t i = 1; i < length; ++i)
+	{
+		const auto next = static_cast<unsigned char>(text[i]);
+		if ((next & 0xC0U) != 0x80)
+		{
+			text.remove_prefix(i);
+			return U'\uFFFD';
+		}
+		result = (result << 6U) | (next & 0x3FU);
+	}
+	text.remove_prefix(length);
+	return result;
+}
+
+// Lets the run cache be searched with a string_view
+struct string_hash
+{
+	using is_transparent = void;
+
+	std::size_t operator()(std::string_view text) const
+	{
+		return std::hash<std::string_view>{}(text);
+	}
+};
+} // namespace moonstone::engine
+
+export namespace moonstone::engine
+{
+// One glyph of a laid out string, relative to the string's origin
+struct placed_glyph
+{
+	glm::vec2 offset{0.0F, 0.0F};
+	glm::vec2 size{0.0F, 0.0F};
+	glm::vec4 uv_rect{0.0F, 0.0F, 1.0F, 1.0F};
+};
+
+// The origin is the first line's baseline, further lines go down from it
+struct text_run
+{
+	std::vector<placed_glyph> glyphs;
+	glm::vec2 size{0.0F, 0.0F};
+};
+
+// A TrueType font at one pixel size. Glyphs are rasterized with
+// stb_truetype the first time they're used and packed into the only layer
+// of its texture_array, drawn with the same shader as sprites. Laid out
+// strings are cached too, so repeating a string doesn't walk the font.
+// GL thread only.
+class font
+{
+	static constexpr std::uint32_t s_atlas_size = 512;
+	// Empty texels between glyphs so linear filtering doesn't bleed
+	static constexpr std::uint32_t s_padding = 1;
+	// Dynamic text would grow the cache forever, it starts over instead
+	static constexpr std::size_t s_max_runs = 1024;
+
+	struct glyph
+	{
+		glm::vec2 offset{0.0F, 0.0F};
+		glm::vec2 size{0.0F, 0.0F};
+		glm::vec4 uv_rect{0.0F, 0.0F, 0.0F, 0.0F};
+		float advance{0.0F};
+	};
+
+	using atlas = renderer::texture_array<s_atlas_size, s_atlas_size>;
+
+	std::vector<unsigned char> m_data;
+	stbtt_fontinfo m_info{};
+	float m_scale{1.0F};
+	float m_line_height{0.0F};
+	renderer::alpha_mode m_alpha;
+	atlas m_atlas;
+	// Shelf packing, glyphs fill rows left to right, bottom to top
+	glm::uvec2 m_cursor{s_padding, s_padding};
+	std::uint32_t m_row_height{0};
+	bool m_full{false};
+	std::unordered_map<char32_t, glyph> m_glyphs;
+	std::unordered_map<std::string, text_run, string_hash, std::equal_to<>>
+		m_runs;
+
+	static auto load(const std::string& font_path) -> std::vector<unsigned char>
+	{
+		std::string path{"assets/"};
+		path.append(font_path);
+		auto file = files().map(path);
+		if (!file.has_value())
+		{
+			throw std::runtime_error{file.error().format()};
+		}
+		const auto bytes = file->bytes();
+		std::vector<unsigned char> data(bytes.size());
+		std::ranges::transform(bytes, data.begin(), [](std::byte value) {
+			return static_cast<unsigned char>(value);
+		});
+		return data;
+	}
+
+	static auto blank_atlas() -> atlas::layer_chains
+	{
+		return {{renderer::mip_level{
+			.width = s_atlas_size,
+			.height = s_atlas_size,
+			.texels = std::vector<renderer::texel>(
+				std::size_t{s_atlas_size} * s_atlas_size)}}};
+	}
+
+	auto rasterize(char32_t code_point) -> error::result<glyph>
+	{
+		const auto index =
+			stbtt_FindGlyphIndex(&this->m_info, static_cast<int>(code_point));
+		int advance = 0;
+		int bearing = 0;
+		stbtt_GetGlyphHMetrics(&this->m_info, index, &advance, &bearing);
+		glyph result{.advance = static_cast<float>(advance) * this->m_scale};
+		int x0 = 0;
+		int y0 = 0;
+		int x1 = 0;
+		int y1 = 0;
+		stbtt_GetGlyphBitmapBox(&this->m_info,
+								index,
+								this->m_scale,
+								this->m_scale,
+								&x0,
+								&y0,
+								&x1,
+								&y1);
+		const auto width = static_cast<std::uint32_t>(std::max(x1 - x0, 0));
+		const auto height = static_cast<std::uint32_t>(std::max(y1 - y0, 0));
+		if (width == 0 || height == 0)
+		{
+			// Spaces only move the pen
+			return result;
+		}
+		if (this->m_cursor.x + width + s_padding > s_atlas_size)
+		{
+			const auto next_row =
+				this->m_cursor.y + this->m_row_height + s_padding;
+			this->m_cursor = {s_padding, next_row};
+			this->m_row_height = 0;
+		}
+		if (this->m_cursor.y + height + s_padding > s_atlas_size)
+		{
+			if (!this->m_full)
+			{
+				this->m_full = true;
+				log_warn<"Glyph atlas is full, dropping U+{:04X} and later">(
+					static_cast<std::uint32_t>(code_point));
+			}
+			return result;
+		}
+
+		std::vector<unsigned char> coverage(std::size_t{width} * height);
+		stbtt_MakeGlyphBitmap(&this->m_info,
+							  coverage.data(),
+							  static_cast<int>(width),
+							  static_cast<int>(height),
+							  static_cast<int>(width),
+							  this->m_scale,
+							  this->m_scale,
+							  index);
+		// stb_truetype writes top to bottom, the atlas goes bottom to top
+		std::vector<renderer::texel> texels(coverage.size());
+		const bool premultiplied =
+			this->m_alpha == renderer::alpha_mode::premultiplied;
+		for (std::uint32_t row = 0; row < height; ++row)
+		{
+			for (std::uint32_t column = 0; column < width; ++column)
+			{
+				const auto alpha = std::byte{
+					coverage[(std::size_t{row} * width) + column]};
+				const auto white = premultiplied ? alpha : std::byte{0xFF};
+				texels[(std::size_t{height - 1 - row} * width) + column] = {
+					white, white, white, alpha};
+			}
+		}
+		Try(this->m_atlas.write_region(
+			0, this->m_cursor.x, this->m_cursor.y, width, height, texels));
+
+		const glm::vec2 low{this->m_cursor};
+		const glm::vec2 size{static_cast<float>(width),
+							 static_cast<float>(height)};
+		result.offset = {static_cast<float>(x0), static_cast<float>(-y1)};
+		result.size = size;
+		result.uv_rect = glm::vec4{low, low + size} /
+						 static_cast<float>(s_atlas_size);
+		this->m_cursor.x += width + s_padding;
+		this->m_row_height = std::max(this->m_row_height, height);
+		return result;
+	}
+
+	auto find(char32_t code_point) -> error::result<const glyph*>
+	{
+		const auto found = this->m_glyphs.find(code_point);
+		if (found != this->m_glyphs.end())
+		{
+			return &found->second;
+		}
+		const auto created = Try(this->rasterize(code_point));
+		return &this->m_glyphs.emplace(code_point, created).first->second;
+	}
+
+public:
+	// `font_path` is inside assets/, like textures
+	font(const std::string& font_path, float pixel_height,
+		 renderer::alpha_mode alpha = renderer::alpha_mode::straight) :
+		m_data{font::load(font_path)},
+		m_alpha{alpha},
+		m_atlas(std::vector<std::string>{font_path},
+				font::blank_atlas(),
+				renderer::mip_options{.max_levels = 1})
+	{
+		const memory_scope scope{memory_tag::assets};
+		const auto offset = stbtt_GetFontOffsetForIndex(this->m_data.data(), 0);
+		if (stbtt_InitFont(&this->m_info, this->m_data.data(), offset) == 0)
+		{
+			throw std::runtime_error{"Failed to read font " + font_path};
+		}
+		this->m_scale = stbtt_ScaleForPixelHeight(&this->m_info, pixel_height);
+		int ascent = 0;
+		int descent = 0;
+		int line_gap = 0;
+		stbtt_GetFontVMetrics(&this->m_info, &ascent, &descent, &line_gap);
+		this->m_line_height =
+			static_cast<float>(ascent - descent + line_gap) * this->m_scale;
+	}
+	~font() = default;
+
+	// Valid until the next call, the cache may start over
+	auto layout(std::string_view text) -> error::result<const text_run*>
+	{
+		const auto cached = this->m_runs.find(text);
+		if (cached != this->m_runs.end())
+		{
+			return &cached->second;
+		}
+		const memory_scope scope{memory_tag::assets};
+		if (this->m_runs.size() >= s_max_runs)
+		{
+			this->m_runs.clear();
+		}
+		text_run run;
+		glm::vec2 pen{0.0F, 0.0F};
+		float width = 0.0F;
+		char32_t previous = 0;
+		for (auto rest = text; !rest.empty();)
+		{
+			const auto code_point = next_code_point(rest);
+			if (code_point == U'\n')
+			{
+				width = std::max(width, pen.x);
+				pen = {0.0F, pen.y - this->m_line_height};
+				previous = 0;
+				continue;
+			}
+			if (previous != 0)
+			{
+				pen.x += static_cast<float>(stbtt_GetCodepointKernAdvance(
+							 &this->m_info,
+							 static_cast<int>(previous),
+							 static_cast<int>(code_point))) *
+						 this->m_scale;
+			}
+			const glyph* found = Try(this->find(code_point));
+			if (found->size.x > 0.0F)
+			{
+				run.glyphs.push_back(
+					{pen + found->offset, found->size, found->uv_rect});
+			}
+			pen.x += found->advance;
+			previous = code_point;
+		}
+		run.size = {std::max(width, pen.x), this->m_line_height - pen.y};
+		return &this->m_runs.emplace(std::string{text}, std::move(run))
+					.first->second;
+	}
+
+	// Lays `text` out into the batch with its baseline starting at `origin`
+	error::result<> append(sprite_batch& batch, std::string_view text,
+						   glm::vec2 origin, float scale = 1.0F)
+	{
+		const text_run* run = Try(this->layout(text));
+		auto out = batch.append(run->glyphs.size());
+		for (std::size_t i = 0; i < run->glyphs.size(); ++i)
+		{
+			const auto& placed = run->glyphs[i];
+			write_sprite(out.subspan(i * 4).first<4>(),
+						 {.position = origin + (placed.offset * scale),
+						  .size = placed.size * scale},
+						 {.uv_rect = placed.uv_rect, .layer = 0});
+		}
+		return {};
+	}
+
+	[[nodiscard]] error::result<> bind(std::uint32_t slot = 1) const
+	{
+		Try(this->m_atlas.bind(slot));
+		return {};
+	}
+
+	[[nodiscard]] float line_height() const
+	{
+		return this->m_line_height;
+	}
+
+	font(const font&) = delete;
+	font(font&&) = delete;
+	font& operator=(const font&) = delete;
+	font& operator=(font&&) = delete;
+};
+
+// A string that keeps its vertices on the GPU. Drawing it again is one draw
+// call, it's only laid out and uploaded when something about it changes.
+class text_label
+{
+	font& m_font;
+	sprite_batch m_batch{64};
+	std::string m_text;
+	glm::vec2 m_position;
+	float m_scale;
+	bool m_dirty{true};
+
+public:
+	explicit text_label(font& source, std::string_view text = {},
+						glm::vec2 position = {0.0F, 0.0F}, float scale = 1.0F) :
+		m_font{source},
+		m_text{text},
+		m_position{position},
+		m_scale{scale}
+	{
+	}
+	~text_label() = default;
+
+	void set_text(std::string_view text)
+	{
+		if (text != this->m_text)
+		{
+			this->m_text = text;
+			this->m_dirty = true;
+		}
+	}
+
+	void set_position(glm::vec2 position)
+	{
+		if (position != this->m_position)
+		{
+			this->m_position = position;
+			this->m_dirty = true;
+		}
+	}
+
+	void set_scale(float scale)
+	{
+		if (scale != this->m_scale)
+		{
+			this->m_scale = scale;
+			this->m_dirty = true;
+		}
+	}
+
+	[[nodiscard]] const std::string& get_text() const
+	{
+		return this->m_text;
+	}
+
+	error::result<> draw(const renderer::shader& shader)
+	{
+		if (this->m_dirty)
+		{
+			this->m_batch.clear();
+			Try(this->m_font.append(
+				this->m_batch, this->m_text, this->m_position, this->m_scale));
+			Try(this->m_batch.upload());
+			this->m_dirty = false;
+		}
+		Try(this->m_font.bind());
+		Try(this->m_batch.draw(shader));
+		return {};
+	}
+
+	text_label(const text_label&) = delete;
+	text_label(text_label&&) = delete;
+	text_label& operator=(const text_label&) = delete;
+	text_label& operator=(text_label&&) = delete;
+};
+} // namespace moonstone::engine
@@ -0,0 +1,333 @@
+module;
+
+#include "Try.hpp"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+export module moonstone:tilemap;
+
+import :error;
+import :vertex_element;
+import :vertex_buffer;
+import :vertex_array;
+import :index_buffer;
+import :buffer_layout;
+import :shader;
+import :renderer;
+import :memory_tracking;
+import :spatial_grid;
+import :sprites;
+
+export namespace moonstone::engine
+{
+// Index into the tileset plus one, 0 is an empty tile
+using tile = std::uint16_t;
+
+struct tilemap_stats
+{
+	std::size_t visible_chunks{0};
+	// Chunks with GPU buffers, baked the first time they're seen
+	std::size_t resident_chunks{0};
+	std::size_t total_chunks{0};
+};
+
+// Static tile layer split into square chunks, each baked into its own
+// vertex buffer and drawn in one call. Every chunk has the same index
+// pattern, empty tiles are degenerate quads, so one index buffer serves all
+// of them and editing a tile rewrites only its four vertices. Only chunks
+// overlapping the view are touched each frame, the size of the map doesn't
+// matter.
+class tilemap
+{
+public:
+	static constexpr std::uint32_t s_chunk_tiles = 32;
+
+private:
+	static constexpr std::size_t s_tiles_per_chunk =
+		std::size_t{s_chunk_tiles} * s_chunk_tiles;
+	// A chunk out of view for this many frames gives its buffers back
+	static constexpr std::uint64_t s_evict_after = 600;
+	static constexpr std::size_t s_clean =
+		std::numeric_limits<std::size_t>::max();
+
+	struct mesh
+	{
+		renderer::vertex_array vao;
+		renderer::static_buffer<renderer::vertex_element> vbo;
+
+		explicit mesh(std::span<const renderer::vertex_element> vertices) :
+			vbo{vertices}
+		{
+		}
+	};
+
+	struct chunk
+	{
+		std::array<tile, s_tiles_per_chunk> tiles{};
+		std::size_t filled{0};
+		// Tiles edited since the last upload, in chunk order
+		std::size_t dirty_first{s_clean};
+		std::size_t dirty_last{0};
+		std::unique_ptr<mesh> baked;
+		std::uint64_t last_seen{0};
+	};
+
+	glm::uvec2 m_size;
+	glm::uvec2 m_chunks_across;
+	float m_tile_size;
+	std::vector<sprite> m_tileset;
+	std::vector<chunk> m_chunks;
+	std::vector<std::size_t> m_resident;
+	renderer::index_buffer m_ibo;
+	renderer::buffer_layout m_layout;
+	// Reused for every bake and upload
+	std::vector<renderer::vertex_element> m_scratch;
+	std::uint64_t m_frame{0};
+	tilemap_stats m_stats;
+
+	error::result<> create()
+	{
+		renderer::vertex_element::register_layout(this->m_layout);
+		std::vector<std::uint32_t> indices;
+		indices.reserve(s_tiles_per_chunk * 6);
+		for (std::size_t i = 0; i < s_tiles_per_chunk; ++i)
+		{
+			for (const std::uint32_t corner : {0U, 1U, 2U, 2U, 3U, 0U})
+			{
+				indices.push_back(static_cast<std::uint32_t>(i * 4) + corner);
+			}
+		}
+		Try(this->m_ibo.append(indices));
+		return {};
+	}
+
+	[[nodiscard]] glm::uvec2 chunk_origin(std::size_t index) const
+	{
+		const auto across = this->m_chunks_across.x;
+		return glm::uvec2{static_cast<std::uint32_t>(index % across),
+						  static_cast<std::uint32_t>(index / across)} *
+			   s_chunk_tiles;
+	}
+
+	// Writes tiles [first, last] of the chunk into the scratch vertices
+	void write_tiles(std::size_t index, std::size_t first, std::size_t last)
+	{
+		const auto& source = this->m_chunks[index];
+		const auto origin = this->chunk_origin(index);
+		this->m_scratch.resize((last - first + 1) * 4);
+		auto out = std::span{this->m_scratch};
+		for (auto i = first; i <= last; ++i)
+		{
+			auto corners = out.subspan((i - first) * 4).first<4>();
+			const auto kind = source.tiles[i];
+			if (kind == 0 || kind > this->m_tileset.size())
+			{
+				std::ranges::fill(corners, renderer::vertex_element{});
+				continue;
+			}
+			const auto column = static_cast<std::uint32_t>(i % s_chunk_tiles);
+			const auto row = static_cast<std::uint32_t>(i / s_chunk_tiles);
+			const glm::uvec2 cell{column, row};
+			write_sprite(
+				corners,
+				{.position = glm::vec2{origin + cell} * this->m_tile_size,
+				 .size = glm::vec2{this->m_tile_size}},
+				this->m_tileset[kind - 1]);
+		}
+	}
+
+	error::result<> bake(std::size_t index)
+	{
+		const memory_scope scope{memory_tag::renderer};
+		auto& target = this->m_chunks[index];
+		this->write_tiles(index, 0, s_tiles_per_chunk - 1);
+		target.baked = std::make_unique<mesh>(
+			std::span<const renderer::vertex_element>{this->m_scratch});
+		Try(target.baked->vao.add_buffer(target.baked->vbo, this->m_layout));
+		Try(renderer::vertex_array::unbind());
+		target.dirty_first = s_clean;
+		this->m_resident.push_back(index);
+		return {};
+	}
+
+	error::result<> flush(std::size_t index)
+	{
+		auto& target = this->m_chunks[index];
+		if (target.dirty_first == s_clean)
+		{
+			return {};
+		}
+		this->write_tiles(index, target.dirty_first, target.dirty_last);
+		Try(target.baked->vbo.update(
+			target.dirty_first * 4,
+			std::span<const renderer::vertex_element>{this->m_scratch}));
+		target.dirty_first = s_clean;
+		return {};
+	}
+
+	void evict()
+	{
+		std::erase_if(this->m_resident, [this](std::size_t index) {
+			auto& target = this->m_chunks[index];
+			if (this->m_frame - target.last_seen < s_evict_after)
+			{
+				return false;
+			}
+			target.baked.reset();
+			return true;
+		});
+	}
+
+public:
+	// `tileset[kind - 1]` is what a tile of that kind looks like
+	tilemap(glm::uvec2 size, float tile_size, std::vector<sprite> tileset) :
+		m_size{size},
+		m_chunks_across{(size + (s_chunk_tiles - 1)) / s_chunk_tiles},
+		m_tile_size{tile_size},
+		m_tileset{std::move(tileset)},
+		m_chunks(std::size_t{m_chunks_across.x} * m_chunks_across.y)
+	{
+		const memory_scope scope{memory_tag::renderer};
+		this->m_stats.total_chunks = this->m_chunks.size();
+		auto err = this->create();
+		if (!err.has_value())
+		{
+			throw std::runtime_error(err.error().format());
+		}
+	}
+	~tilemap() = default;
+
+	void set(glm::uvec2 where, tile kind)
+	{
+		if (where.x >= this->m_size.x || where.y >= this->m_size.y)
+		{
+			return;
+		}
+		const auto chunk_cell = where / s_chunk_tiles;
+		auto& target = this->m_chunks[(std::size_t{chunk_cell.y} *
+									   this->m_chunks_across.x) +
+									  chunk_cell.x];
+		const auto local = where % s_chunk_tiles;
+		const auto i = (std::size_t{local.y} * s_chunk_tiles) + local.x;
+		auto& slot = target.tiles[i];
+		if (slot == kind)
+		{
+			return;
+		}
+		target.filled += static_cast<std::size_t>(kind != 0) -
+						 static_cast<std::size_t>(slot != 0);
+		slot = kind;
+		// Chunks that aren't baked pick it up when they are
+		if (!target.baked)
+		{
+			return;
+		}
+		if (target.dirty_first == s_clean)
+		{
+			target.dirty_first = i;
+			target.dirty_last = i;
+		}
+		else
+		{
+			target.dirty_first = std::min(target.dirty_first, i);
+			target.dirty_last = std::max(target.dirty_last, i);
+		}
+	}
+
+	[[nodiscard]] tile get(glm::uvec2 where) const
+	{
+		if (where.x >= this->m_size.x || where.y >= this->m_size.y)
+		{
+			return 0;
+		}
+		const auto chunk_cell = where / s_chunk_tiles;
+		const auto local = where % s_chunk_tiles;
+		return this->m_chunks[(std::size_t{chunk_cell.y} *
+							   this->m_chunks_across.x) +
+							  chunk_cell.x]
+			.tiles[(std::size_t{local.y} * s_chunk_tiles) + local.x];
+	}
+
+	[[nodiscard]] glm::uvec2 size() const
+	{
+		return this->m_size;
+	}
+
+	[[nodiscard]] aabb bounds() const
+	{
+		return {{0.0F, 0.0F}, glm::vec2{this->m_size} * this->m_tile_size};
+	}
+
+	// Bakes, updates and draws the chunks overlapping `view`. The camera and
+	// the draw block are the caller's, like for sprite_batch.
+	error::result<> draw(const aabb& view, const renderer::shader& shader)
+	{
+		++this->m_frame;
+		this->m_stats.visible_chunks = 0;
+		if (!view.overlaps(this->bounds()))
+		{
+			this->evict();
+			return {};
+		}
+		const auto chunk_size = this->m_tile_size * s_chunk_tiles;
+		const auto last = glm::ivec2{this->m_chunks_across} - 1;
+		const auto low = glm::clamp(
+			glm::ivec2{glm::floor(view.min / chunk_size)}, glm::ivec2{0}, last);
+		const auto high = glm::clamp(
+			glm::ivec2{glm::floor(view.max / chunk_size)}, glm::ivec2{0}, last);
+		for (int y = low.y; y <= high.y; ++y)
+		{
+			for (int x = low.x; x <= high.x; ++x)
+			{
+				const auto index =
+					(static_cast<std::size_t>(y) * this->m_chunks_across.x) +
+					static_cast<std::size_t>(x);
+				auto& target = this->m_chunks[index];
+				if (target.filled == 0)
+				{
+					continue;
+				}
+				if (target.baked)
+				{
+					Try(this->flush(index));
+				}
+				else
+				{
+					Try(this->bake(index));
+				}
+				target.last_seen = this->m_frame;
+				++this->m_stats.visible_chunks;
+				Try(renderer::renderer::draw(
+					target.baked->vao,
+					this->m_ibo,
+					shader,
+					static_cast<std::uint32_t>(s_tiles_per_chunk * 6),
+					static_cast<std::uint32_t>(s_tiles_per_chunk * 4)));
+			}
+		}
+		this->evict();
+		return {};
+	}
+
+	[[nodiscard]] tilemap_stats get_stats() const
+	{
+		auto result = this->m_stats;
+		result.resident_chunks = this->m_resident.size();
+		return result;
+	}
+
+	tilemap(const tilemap&) = delete;
+	tilemap(tilemap&&) = delete;
+	tilemap& operator=(const tilemap&) = delete;
+	tilemap& operator=(tilemap&&) = delete;
+};
+} // namespace moonstone::engine
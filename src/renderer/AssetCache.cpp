@@ -0,0 +1,619 @@
+module;
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <future>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+export module moonstone:asset_cache;
+
+import :utility;
+import :error;
+import :jobs;
+import :file_system;
+import :mipmap;
+import :residency;
+import :texture;
+import :texture_array;
+import :shader;
+import :shader_preprocessor;
+import :shader_reload;
+import :memory_tracking;
+
+export namespace moonstone::renderer
+{
+template <typename T>
+using asset_handle = std::shared_ptr<T>;
+
+template <std::size_t W, std::size_t H>
+struct array_layer
+{
+	asset_handle<texture_array<W, H>> array;
+	std::uint32_t layer;
+};
+
+// Hands out shared handles so scenes that use the same files share the
+// decode and the GPU memory. Entries are weak, an asset lives as long as a
+// handle to it does. Everything that creates GL objects has to be called
+// from the GL thread, request_texture only starts the CPU work.
+class asset_cache
+{
+	struct decoded_texture
+	{
+		std::uint64_t hash{};
+		std::vector<mip_level> levels;
+	};
+	struct layer_entry
+	{
+		std::weak_ptr<void> array;
+		std::type_index type;
+		std::uint32_t layer;
+	};
+
+	std::mutex m_mutex;
+	std::unordered_map<std::string, std::weak_ptr<texture>> m_textures;
+	std::unordered_map<std::uint64_t, std::weak_ptr<texture>> m_by_content;
+	std::unordered_map<std::string,
+					   std::shared_future<error::result<decoded_texture>>>
+		m_pending;
+	std::unordered_map<std::string, std::weak_ptr<void>> m_arrays;
+	std::unordered_map<std::uint64_t, std::weak_ptr<void>> m_arrays_by_content;
+	std::unordered_map<std::string, layer_entry> m_layers;
+	// Per path pair and permutation key, and per preprocessed source so two
+	// variants that expand to the same text share a program
+	std::unordered_map<std::string, std::weak_ptr<shader>> m_shaders;
+	std::unordered_map<std::uint64_t, std::weak_ptr<shader>> m_programs;
+	// Decoded/preprocessed on a worker by the preload_ functions, waiting
+	// for the GL thread to create the objects
+	std::unordered_map<std::string, std::vector<std::vector<mip_level>>>
+		m_preloaded_arrays;
+	std::unordered_map<std::string, shader_sources> m_preloaded_shaders;
+	// Arrays and shaders some thread is reading and creating right now with
+	// m_mutex released, others asking for the same key wait on it
+	std::unordered_map<std::string, std::shared_future<void>> m_loading;
+	residency_manager* m_residency{nullptr};
+	shader_reloader* m_reloader{nullptr};
+	std::uint64_t m_hits{0};
+	std::uint64_t m_content_hits{0};
+	std::uint64_t m_loads{0};
+
+	// Held by the thread loading a key. The destructor takes the lock back
+	// if it was released and lets the waiters go, if the load threw they
+	// find nothing in the cache and try it themselves.
+	class loading_guard
+	{
+		asset_cache& m_cache;
+		std::unique_lock<std::mutex>& m_lock;
+		std::string m_key;
+		std::promise<void> m_done;
+
+	public:
+		// Expects lock to hold m_mutex
+		loading_guard(asset_cache& cache, std::unique_lock<std::mutex>& lock,
+					  std::string key) :
+			m_cache{cache},
+			m_lock{lock},
+			m_key{std::move(key)}
+		{
+			this->m_cache.m_loading.emplace(this->m_key,
+											this->m_done.get_future().share());
+		}
+		~loading_guard()
+		{
+			if (!this->m_lock.owns_lock())
+			{
+				this->m_lock.lock();
+			}
+			this->m_cache.m_loading.erase(this->m_key);
+			this->m_done.set_value();
+		}
+
+		loading_guard(const loading_guard&) = delete;
+		loading_guard(loading_guard&&) = delete;
+		loading_guard& operator=(const loading_guard&) = delete;
+		loading_guard& operator=(loading_guard&&) = delete;
+	};
+
+	// Expects lock to hold m_mutex. If another thread is loading the key,
+	// waits for it with the lock released and returns true, the caller then
+	// looks in the cache again.
+	auto wait_for_load(std::unique_lock<std::mutex>& lock,
+					   const std::string& key) -> bool
+	{
+		auto loading = this->m_loading.find(key);
+		if (loading == this->m_loading.end())
+		{
+			return false;
+		}
+		const auto done = loading->second;
+		lock.unlock();
+		done.wait();
+		lock.lock();
+		return true;
+	}
+
+	static auto canonical(const std::string& directory,
+						  const std::string& file) -> std::string
+	{
+		return std::filesystem::weakly_canonical(
+				   std::filesystem::path{directory} / file)
+			.string();
+	}
+
+	// Everything in mip_options changes the GPU copy, so it's part of every
+	// key, by path or by content
+	static auto options_key(mip_options options) -> std::string
+	{
+		return std::format("{},{},{}",
+						   static_cast<int>(options.filter),
+						   static_cast<int>(options.alpha),
+						   options.max_levels);
+	}
+
+	static auto texture_key(const std::string& path, mip_options options)
+		-> std::string
+	{
+		return std::format(
+			"{}#{}", canonical("assets", path), options_key(options));
+	}
+
+	template <std::size_t W, std::size_t H>
+	static auto array_key(std::initializer_list<const char*> paths,
+						  mip_options options) -> std::string
+	{
+		std::string key = std::format("{}x{}#{}", W, H, options_key(options));
+		for (const auto* path : paths)
+		{
+			key += ';';
+			key += canonical("assets", path);
+		}
+		return key;
+	}
+
+	static auto content_key(std::uint64_t file_hash, mip_options options)
+		-> std::uint64_t
+	{
+		return hash_string(options_key(options), file_hash);
+	}
+
+	// The files' contents in order, the size and the options
+	template <std::size_t W, std::size_t H>
+	static auto array_content_key(std::span<const file_buffer> contents,
+								  mip_options options) -> std::uint64_t
+	{
+		auto hash = hash_string(std::format("{}x{}", W, H));
+		for (const auto& content : contents)
+		{
+			hash = hash_bytes(content, hash);
+		}
+		return content_key(hash, options);
+	}
+
+	// Expects m_mutex to be held
+	template <std::size_t W, std::size_t H>
+	auto find_array_by_content(std::uint64_t hash)
+		-> asset_handle<texture_array<W, H>>
+	{
+		auto iterator = this->m_arrays_by_content.find(hash);
+		return iterator == this->m_arrays_by_content.end()
+				   ? nullptr
+				   : std::static_pointer_cast<texture_array<W, H>>(
+						 iterator->second.lock());
+	}
+
+	static auto shader_key(const std::string& vs_path,
+						   const std::string& fs_path,
+						   const shader_defines& defines) -> std::string
+	{
+		return std::format("{};{}#{:016x}",
+						   canonical("shaders", vs_path),
+						   canonical("shaders", fs_path),
+						   defines.key());
+	}
+
+	auto find_by_content(std::uint64_t hash) -> asset_handle<texture>
+	{
+		auto iterator = this->m_by_content.find(hash);
+		return iterator == this->m_by_content.end()
+				   ? nullptr
+				   : iterator->second.lock();
+	}
+
+	// Runs on a worker thread, a failure is handed to whoever gets the
+	// texture instead of being thrown on the worker
+	auto decode_texture(const std::string& path, mip_options options)
+		-> error::result<decoded_texture>
+	{
+		const memory_scope scope{memory_tag::textures};
+		auto file = files().map(std::format("{}{}", "assets/", path));
+		if (!file.has_value())
+		{
+			return std::unexpected(std::move(file).error());
+		}
+		decoded_texture decoded{
+			.hash = content_key(hash_bytes(file->bytes()), options)};
+		{
+			// Same pixels and options under another name, the GPU copy gets
+			// reused so there's nothing to decode
+			const std::scoped_lock lock{this->m_mutex};
+			auto same = this->m_by_content.find(decoded.hash);
+			if (same != this->m_by_content.end() && !same->second.expired())
+			{
+				return decoded;
+			}
+		}
+		try
+		{
+			decoded.levels =
+				texture::decode_memory(file->bytes(), path, options);
+		}
+		catch (const std::exception& e)
+		{
+			return std::unexpected(error::gl_error{
+				"APPLICATION", {}, "ERROR", 0, "HIGH", e.what()});
+		}
+		return decoded;
+	}
+
+	// Expects lock to hold m_mutex and releases it. The job system can run
+	// the decode inline and decode_texture takes the lock itself.
+	auto start_texture_load(std::unique_lock<std::mutex>& lock,
+							const std::string& key, const std::string& path,
+							mip_options options)
+		-> std::shared_future<error::result<decoded_texture>>
+	{
+		auto pending = this->m_pending.find(key);
+		if (pending != this->m_pending.end())
+		{
+			auto future = pending->second;
+			lock.unlock();
+			return future;
+		}
+		std::promise<error::result<decoded_texture>> decoded;
+		auto future = decoded.get_future().share();
+		this->m_pending.emplace(key, future);
+		lock.unlock();
+		jobs().run(
+			[this, path, options, decoded = std::move(decoded)]() mutable {
+				decoded.set_value(this->decode_texture(path, options));
+			});
+		return future;
+	}
+
+public:
+	asset_cache() = default;
+	explicit asset_cache(residency_manager& residency) :
+		m_residency{&residency}
+	{
+	}
+	~asset_cache() = default;
+
+	// Shaders created from now on are rebuilt when their files change
+	void set_shader_reloader(shader_reloader& reloader)
+	{
+		this->m_reloader = &reloader;
+	}
+
+	// Starts decoding on a worker so a later get_texture doesn't block
+	void request_texture(const std::string& path, mip_options options = {})
+	{
+		const auto key = texture_key(path, options);
+		std::unique_lock lock{this->m_mutex};
+		auto cached = this->m_textures.find(key);
+		if (cached != this->m_textures.end() && !cached->second.expired())
+		{
+			return;
+		}
+		this->start_texture_load(lock, key, path, options);
+	}
+
+	// The preload_ functions block until the CPU side work (file reads,
+	// decoding, mip chains, preprocessing) is done, they are meant to run on
+	// a worker while something else is on screen. The matching get_ call on
+	// the GL thread then only has to create the GL objects.
+	void preload_texture(const std::string& path, mip_options options = {})
+	{
+		const memory_scope scope{memory_tag::assets};
+		const auto key = texture_key(path, options);
+		std::unique_lock lock{this->m_mutex};
+		auto cached = this->m_textures.find(key);
+		if (cached != this->m_textures.end() && !cached->second.expired())
+		{
+			return;
+		}
+		this->start_texture_load(lock, key, path, options).wait();
+	}
+
+	template <std::size_t W, std::size_t H>
+	void preload_texture_array(std::initializer_list<const char*> paths,
+							   mip_options options = {})
+	{
+		const memory_scope scope{memory_tag::assets};
+		const auto key = array_key<W, H>(paths, options);
+		{
+			const std::scoped_lock lock{this->m_mutex};
+			auto cached = this->m_arrays.find(key);
+			if ((cached != this->m_arrays.end() &&
+				 !cached->second.expired()) ||
+				this->m_preloaded_arrays.contains(key))
+			{
+				return;
+			}
+		}
+		const auto texture_paths =
+			std::vector<std::string>(paths.begin(), paths.end());
+		const auto contents = texture_array<W, H>::read_layers(texture_paths);
+		const auto content = array_content_key<W, H>(contents, options);
+		{
+			const std::scoped_lock lock{this->m_mutex};
+			if (this->find_array_by_content<W, H>(content))
+			{
+				return;
+			}
+		}
+		auto layers =
+			texture_array<W, H>::decode(contents, texture_paths, options);
+		const std::scoped_lock lock{this->m_mutex};
+		this->m_preloaded_arrays.try_emplace(key, std::move(layers));
+	}
+
+	void preload_shader(const std::string& vs_path, const std::string& fs_path,
+						const shader_defines& defines = {})
+	{
+		const memory_scope scope{memory_tag::assets};
+		const auto key = shader_key(vs_path, fs_path, defines);
+		{
+			const std::scoped_lock lock{this->m_mutex};
+			auto cached = this->m_shaders.find(key);
+			if ((cached != this->m_shaders.end() &&
+				 !cached->second.expired()) ||
+				this->m_preloaded_shaders.contains(key))
+			{
+				return;
+			}
+		}
+		auto sources = shader::preprocess(vs_path, fs_path, defines);
+		if (!sources.has_value())
+		{
+			throw std::runtime_error(sources.error().format());
+		}
+		const std::scoped_lock lock{this->m_mutex};
+		this->m_preloaded_shaders.try_emplace(key, *std::move(sources));
+	}
+
+	auto get_texture(const std::string& path, mip_options options = {})
+		-> error::result<asset_handle<texture>>
+	{
+		const auto key = texture_key(path, options);
+		std::unique_lock lock{this->m_mutex};
+		auto cached = this->m_textures.find(key);
+		if (cached != this->m_textures.end())
+		{
+			if (auto handle = cached->second.lock())
+			{
+				++this->m_hits;
+				return handle;
+			}
+		}
+		// Every requester of the same key waits on the same decode
+		const auto future = this->start_texture_load(lock, key, path, options);
+		const auto& result = future.get();
+
+		lock.lock();
+		// Failed decodes are dropped too, the next request tries again
+		this->m_pending.erase(key);
+		if (!result.has_value())
+		{
+			return std::unexpected(result.error());
+		}
+		const decoded_texture& decoded = *result;
+		auto handle = this->find_by_content(decoded.hash);
+		if (handle)
+		{
+			++this->m_content_hits;
+		}
+		else
+		{
+			// No levels means the texture it matched was released while this
+			// one was waiting, so it has to be decoded after all
+			handle = decoded.levels.empty()
+						 ? std::make_shared<texture>(path, options)
+						 : std::make_shared<texture>(
+							   path, decoded.levels, options);
+			if (this->m_residency != nullptr)
+			{
+				handle->attach(*this->m_residency);
+			}
+			this->m_by_content[decoded.hash] = handle;
+			++this->m_loads;
+		}
+		this->m_textures[key] = handle;
+		return handle;
+	}
+
+	template <std::size_t W, std::size_t H>
+	auto get_texture_array(std::initializer_list<const char*> paths,
+						   mip_options options = {})
+		-> asset_handle<texture_array<W, H>>
+	{
+		const memory_scope scope{memory_tag::textures};
+		const auto key = array_key<W, H>(paths, options);
+		std::unique_lock lock{this->m_mutex};
+		do
+		{
+			auto cached = this->m_arrays.find(key);
+			if (cached != this->m_arrays.end())
+			{
+				if (auto handle =
+						std::static_pointer_cast<texture_array<W, H>>(
+							cached->second.lock()))
+				{
+					++this->m_hits;
+					return handle;
+				}
+			}
+		} while (this->wait_for_load(lock, key));
+		const loading_guard loading{*this, lock, key};
+		auto preloaded = this->m_preloaded_arrays.extract(key);
+		lock.unlock();
+
+		const auto texture_paths =
+			std::vector<std::string>(paths.begin(), paths.end());
+		const auto contents = texture_array<W, H>::read_layers(texture_paths);
+		const auto content = array_content_key<W, H>(contents, options);
+		lock.lock();
+		auto handle = this->find_array_by_content<W, H>(content);
+		if (handle)
+		{
+			++this->m_content_hits;
+			this->m_arrays[key] = handle;
+			return handle;
+		}
+		lock.unlock();
+
+		if (preloaded)
+		{
+			handle = std::make_shared<texture_array<W, H>>(
+				texture_paths, preloaded.mapped(), options);
+		}
+		else
+		{
+			// Decodes the bytes just read for the key instead of reading
+			// the files again
+			handle = std::make_shared<texture_array<W, H>>(
+				texture_paths,
+				texture_array<W, H>::decode(contents, texture_paths, options),
+				options);
+		}
+		if (this->m_residency != nullptr)
+		{
+			handle->attach(*this->m_residency);
+		}
+		lock.lock();
+		this->m_arrays[key] = handle;
+		this->m_arrays_by_content[content] = handle;
+		std::uint32_t layer = 0;
+		for (const auto& path : handle->get_paths())
+		{
+			this->m_layers.insert_or_assign(
+				canonical("assets", path),
+				layer_entry{handle, typeid(texture_array<W, H>), layer++});
+		}
+		++this->m_loads;
+		return handle;
+	}
+
+	// Finds a layer of any live array that already holds the file
+	template <std::size_t W, std::size_t H>
+	auto find_layer(const std::string& path)
+		-> std::optional<array_layer<W, H>>
+	{
+		const std::scoped_lock lock{this->m_mutex};
+		auto iterator = this->m_layers.find(canonical("assets", path));
+		if (iterator == this->m_layers.end() ||
+			iterator->second.type != typeid(texture_array<W, H>))
+		{
+			return std::nullopt;
+		}
+		auto array = std::static_pointer_cast<texture_array<W, H>>(
+			iterator->second.array.lock());
+		if (!array)
+		{
+			return std::nullopt;
+		}
+		++this->m_hits;
+		return array_layer<W, H>{array, iterator->second.layer};
+	}
+
+	auto get_shader(const std::string& vs_path, const std::string& fs_path,
+					const shader_defines& defines = {}) -> asset_handle<shader>
+	{
+		const memory_scope scope{memory_tag::shaders};
+		const auto key = shader_key(vs_path, fs_path, defines);
+		std::unique_lock lock{this->m_mutex};
+		do
+		{
+			auto cached = this->m_shaders.find(key);
+			if (cached != this->m_shaders.end())
+			{
+				if (auto handle = cached->second.lock())
+				{
+					++this->m_hits;
+					return handle;
+				}
+			}
+		} while (this->wait_for_load(lock, key));
+		const loading_guard loading{*this, lock, key};
+		error::result<shader_sources> sources;
+		if (auto preloaded = this->m_preloaded_shaders.extract(key))
+		{
+			sources = std::move(preloaded.mapped());
+		}
+		else
+		{
+			lock.unlock();
+			sources = shader::preprocess(vs_path, fs_path, defines);
+			lock.lock();
+		}
+		if (!sources.has_value())
+		{
+			throw std::runtime_error(sources.error().format());
+		}
+		const auto source_hash = sources->hash();
+		auto same = this->m_programs.find(source_hash);
+		if (same != this->m_programs.end())
+		{
+			if (auto handle = same->second.lock())
+			{
+				++this->m_content_hits;
+				this->m_shaders[key] = handle;
+				return handle;
+			}
+		}
+		lock.unlock();
+
+		auto handle =
+			std::make_shared<shader>(vs_path, fs_path, *sources, defines);
+		if (this->m_reloader != nullptr)
+		{
+			this->m_reloader->watch(handle);
+		}
+		lock.lock();
+		this->m_shaders[key] = handle;
+		this->m_programs[source_hash] = handle;
+		++this->m_loads;
+		return handle;
+	}
+
+	[[nodiscard]] std::uint64_t get_hits() const
+	{
+		return this->m_hits;
+	}
+	[[nodiscard]] std::uint64_t get_content_hits() const
+	{
+		return this->m_content_hits;
+	}
+	[[nodiscard]] std::uint64_t get_loads() const
+	{
+		return this->m_loads;
+	}
+
+	asset_cache(const asset_cache&) = delete;
+	asset_cache(asset_cache&&) = delete;
+	asset_cache& operator=(const asset_cache&) = delete;
+	asset_cache& operator=(asset_cache&&) = delete;
+};
+} // namespace moonstone::renderer
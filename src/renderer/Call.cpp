@@ -3,12 +3,15 @@ module;
 #include <expected>
 #include <queue>
 #include <source_location>
+#include <string>
+#include <string_view>
 #include <utility>
 #include <variant>
 
 export module moonstone:call;
 
 import :error;
+import :stats;
 
 export namespace moonstone::renderer
 {
@@ -16,20 +19,26 @@ export namespace moonstone::renderer
 struct gl
 {
 #ifdef _DEBUG
+	// Runs for every GL call, so nothing here allocates: the short file name
+	// is a view into the static file name and is only copied on an error
 	explicit gl(std::source_location l = std::source_location::current()) :
 		m_location(l)
 	{
-		std::string_view file{l.file_name()};
-		std::string new_file{file.begin() + file.rfind('/'), file.end()};
-		this->m_short_file = std::move(new_file);
+		const std::string_view file{l.file_name()};
+		const auto slash = file.rfind('/');
+		this->m_short_file =
+			slash == std::string_view::npos ? file : file.substr(slash);
 	}
 	template <typename T, typename F, typename... Args>
 	std::expected<T, error::gl_error> call_returning(F f, Args... args)
 	{
-		// Empty the queue
-		std::queue<error::gl_error> empty{};
-		std::swap(error::errors, empty);
+		// Empty the queue without building a new one every call
+		while (!error::errors.empty())
+		{
+			error::errors.pop();
+		}
 		// Call opengl function
+		count(counter::gl_calls);
 		T returned = f(args...);
 		// Check for errors in the queue
 		if (error::errors.empty())
@@ -42,16 +51,19 @@ struct gl
 		}
 		auto err = error::errors.back();
 		err.set_location(this->m_location);
-		err.set_file(this->m_short_file);
+		err.set_file(std::string{this->m_short_file});
 		return std::unexpected{const_cast<const error::gl_error&>(err)};
 	}
 	template <typename F, typename... Args>
 	std::expected<std::monostate, error::gl_error> call(F f, Args... args)
 	{
-		// Empty the queue
-		std::queue<error::gl_error> empty{};
-		std::swap(error::errors, empty);
+		// Empty the queue without building a new one every call
+		while (!error::errors.empty())
+		{
+			error::errors.pop();
+		}
 		// Call opengl function
+		count(counter::gl_calls);
 		f(args...);
 		// Check for errors in the queue
 		if (error::errors.empty())
@@ -69,18 +81,20 @@ struct gl
 
 private:
 	std::source_location m_location;
-	std::string m_short_file;
+	std::string_view m_short_file;
 #else
 	explicit gl() = default;
 	template <typename F, typename... Args>
 	inline std::expected<void, error::gl_error> call(F f, Args... args)
 	{
+		count(counter::gl_calls);
 		f(args...);
 		return {};
 	}
 	template <typename T, typename F, typename... Args>
 	inline std::expected<T, error::gl_error> call_returning(F f, Args... args)
 	{
+		count(counter::gl_calls);
 		return f(args...);
 	}
 #endif
@@ -5,15 +5,21 @@ module;
 #include <algorithm>
 #include <exception>
 #include <flat_map>
-#include <print>
+#include <functional>
+#include <memory_resource>
 #include <ranges>
+#include <span>
 #include <stdexcept>
 #include <tuple>
+#include <vector>
 
 export module moonstone:index_buffer;
 
 import :error;
 import :call;
+import :logging;
+import :stats;
+import :memory_tracking;
 
 export namespace moonstone::renderer
 {
@@ -22,7 +28,10 @@ class index_buffer
 	std::uint32_t m_renderer_id{};
 	std::size_t m_index_count{0};
 	std::size_t m_highest{0};
-	std::flat_map<std::uint32_t, std::uint32_t> m_indices;
+	std::flat_map<std::uint32_t, std::uint32_t, std::less<std::uint32_t>,
+				  std::pmr::vector<std::uint32_t>,
+				  std::pmr::vector<std::uint32_t>>
+		m_indices;
 
 	error::result<> create()
 	{
@@ -38,7 +47,9 @@ class index_buffer
 	}
 
 public:
-	index_buffer()
+	explicit index_buffer(std::pmr::memory_resource* resource =
+							  std::pmr::get_default_resource()) :
+		m_indices(std::pmr::polymorphic_allocator<>{resource})
 	{
 		auto err = this->create();
 		if (!err.has_value())
@@ -53,7 +64,8 @@ public:
 		auto err = gl().call(glDeleteBuffers, 1, &this->m_renderer_id);
 		if (!err.has_value())
 		{
-			std::println(stderr, "{}", err.error().format());
+			log_error<"{}">(err.error().format());
+			flush_logs();
 			std::terminate();
 		}
 	}
@@ -67,6 +79,7 @@ public:
 	error::result<std::array<std::size_t, N>> insert(
 		const std::array<std::size_t, N>& indices)
 	{
+		const memory_scope scope{memory_tag::buffers};
 		std::array<std::size_t, N> returned{};
 		std::ranges::for_each(
 			std::views::zip(indices, returned),
@@ -80,6 +93,22 @@ public:
 		return std::move(returned);
 	}
 
+	// Appends without handing the ids back, for batches whose index buffer
+	// only ever grows
+	error::result<> append(std::span<const std::uint32_t> indices)
+	{
+		const memory_scope scope{memory_tag::buffers};
+		for (const auto index : indices)
+		{
+			this->m_indices.insert(
+				{static_cast<std::uint32_t>(this->m_index_count++), index});
+			this->m_highest =
+				std::max(static_cast<std::size_t>(index), this->m_highest);
+		}
+		Try(this->update());
+		return {};
+	}
+
 	void replace(std::uint32_t index_id, std::uint32_t index)
 	{
 		try
@@ -89,7 +118,7 @@ public:
 		}
 		catch (const std::out_of_range& e)
 		{
-			std::println("Oops! called index: {}", index_id);
+			log_warn<"Oops! called index: {}">(index_id);
 		}
 	}
 
@@ -118,6 +147,7 @@ public:
 						  size,
 						  this->m_indices.values().data()));
 		}
+		count(counter::bytes_uploaded, size);
 		return {};
 	}
 
@@ -0,0 +1,623 @@
+module;
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numbers>
+#include <ranges>
+#include <span>
+#include <vector>
+#ifdef __x86_64__
+#include <immintrin.h>
+#define MOONSTONE_MIPMAP_SIMD
+#endif
+
+export module moonstone:mipmap;
+
+import :jobs;
+
+export namespace moonstone::renderer
+{
+struct texel
+{
+	std::byte r;
+	std::byte g;
+	std::byte b;
+	std::byte a;
+} __attribute__((aligned(4), packed));
+
+enum class mip_filter : unsigned char
+{
+	box,
+	kaiser
+};
+
+// `straight` keeps the stored colors unassociated so they blend with
+// GL_SRC_ALPHA, `premultiplied` keeps them associated for GL_ONE blending.
+// Filtering is always done on premultiplied colors so transparent texels
+// don't bleed their color into the smaller levels.
+enum class alpha_mode : unsigned char
+{
+	straight,
+	premultiplied
+};
+
+struct mip_options
+{
+	mip_filter filter{mip_filter::box};
+	alpha_mode alpha{alpha_mode::straight};
+	// 0 means the full chain down to 1x1
+	std::uint32_t max_levels{0};
+};
+
+struct mip_level
+{
+	std::uint32_t width{};
+	std::uint32_t height{};
+	std::vector<texel> texels;
+};
+
+constexpr auto mip_level_count(std::uint32_t width, std::uint32_t height)
+	-> std::uint32_t
+{
+	return std::bit_width(std::max({width, height, 1U}));
+}
+} // namespace moonstone::renderer
+
+namespace moonstone::renderer
+{
+// Levels smaller than this are not worth splitting into jobs
+constexpr std::uint32_t s_rows_per_worker = 64;
+// Kaiser windowed sinc, 6 taps over the 2:1 decimation
+constexpr std::size_t s_kaiser_taps = 6;
+constexpr float s_kaiser_support = 3.0F;
+constexpr float s_kaiser_beta = 4.0F;
+
+// Decoding already runs off the render thread, the pieces go to the shared
+// job system and this thread helps until they're done
+template <typename F>
+void parallel_rows(std::uint32_t rows, const F& function)
+{
+	if (rows <= s_rows_per_worker)
+	{
+		function(0U, rows);
+		return;
+	}
+	jobs().parallel_for(
+		0, rows, s_rows_per_worker, [&](std::size_t begin, std::size_t end) {
+			function(static_cast<std::uint32_t>(begin),
+					 static_cast<std::uint32_t>(end));
+		});
+}
+
+inline auto channel(std::byte value) -> std::uint32_t
+{
+	return std::to_integer<std::uint32_t>(value);
+}
+
+auto bessel_i0(float x) -> float
+{
+	// Power series, converges quickly for the betas used by mip filters
+	float sum = 1.0F;
+	float term = 1.0F;
+	const float half_x = x * 0.5F;
+	for (int k = 1; k < 16; ++k)
+	{
+		term *= (half_x / static_cast<float>(k)) *
+				(half_x / static_cast<float>(k));
+		sum += term;
+	}
+	return sum;
+}
+
+auto make_kaiser_weights() -> std::array<float, s_kaiser_taps>
+{
+	std::array<float, s_kaiser_taps> weights{};
+	float total = 0.0F;
+	for (std::size_t i = 0; i < s_kaiser_taps; ++i)
+	{
+		// Distance from the destination texel center in source texels
+		const float distance = std::abs(static_cast<float>(i) - 2.5F);
+		const float x = distance / 2.0F;
+		const float sinc =
+			std::sin(std::numbers::pi_v<float> * x) /
+			(std::numbers::pi_v<float> * x);
+		const float ratio = distance / s_kaiser_support;
+		const float window =
+			bessel_i0(s_kaiser_beta * std::sqrt(1.0F - ratio * ratio)) /
+			bessel_i0(s_kaiser_beta);
+		weights.at(i) = sinc * window;
+		total += weights.at(i);
+	}
+	std::ranges::for_each(weights, [total](float& w) { w /= total; });
+	return weights;
+}
+
+const std::array<float, s_kaiser_taps> s_kaiser_weights =
+	make_kaiser_weights();
+
+void premultiply_scalar(std::span<texel> texels)
+{
+	for (auto& value : texels)
+	{
+		const std::uint32_t alpha = channel(value.a);
+		auto multiply = [alpha](std::byte c) {
+			const std::uint32_t product = channel(c) * alpha + 128;
+			return static_cast<std::byte>((product + (product >> 8)) >> 8);
+		};
+		value.r = multiply(value.r);
+		value.g = multiply(value.g);
+		value.b = multiply(value.b);
+	}
+}
+
+void unpremultiply(std::span<texel> texels)
+{
+	for (auto& value : texels)
+	{
+		const std::uint32_t alpha = channel(value.a);
+		if (alpha == 0 || alpha == 255)
+		{
+			continue;
+		}
+		auto divide = [alpha](std::byte c) {
+			return static_cast<std::byte>(
+				std::min(255U, (channel(c) * 255 + alpha / 2) / alpha));
+		};
+		value.r = divide(value.r);
+		value.g = divide(value.g);
+		value.b = divide(value.b);
+	}
+}
+
+void box_scalar(const texel* row0, const texel* row1, std::uint32_t src_width,
+				texel* out, std::uint32_t begin, std::uint32_t end)
+{
+	for (std::uint32_t x = begin; x < end; ++x)
+	{
+		const std::uint32_t x0 = std::min(2 * x, src_width - 1);
+		const std::uint32_t x1 = std::min(2 * x + 1, src_width - 1);
+		auto average = [](std::byte a, std::byte b, std::byte c, std::byte d) {
+			return static_cast<std::byte>(
+				(channel(a) + channel(b) + channel(c) + channel(d) + 2) >> 2);
+		};
+		out[x] = {average(row0[x0].r, row0[x1].r, row1[x0].r, row1[x1].r),
+				  average(row0[x0].g, row0[x1].g, row1[x0].g, row1[x1].g),
+				  average(row0[x0].b, row0[x1].b, row1[x0].b, row1[x1].b),
+				  average(row0[x0].a, row0[x1].a, row1[x0].a, row1[x1].a)};
+	}
+}
+
+#ifdef MOONSTONE_MIPMAP_SIMD
+const bool s_has_avx2 = __builtin_cpu_supports("avx2") != 0;
+// Checked on its own, there are AVX2 CPUs without FMA
+const bool s_has_fma = __builtin_cpu_supports("fma") != 0;
+
+// 16 bit channels, multiplies rgb by alpha and divides by 255 with rounding
+inline __m128i premultiply_sse2_half(__m128i pixels, __m128i alpha_mask)
+{
+	__m128i alpha = _mm_shufflehi_epi16(
+		_mm_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3)),
+		_MM_SHUFFLE(3, 3, 3, 3));
+	alpha = _mm_or_si128(_mm_andnot_si128(alpha_mask, alpha),
+						 _mm_and_si128(alpha_mask, _mm_set1_epi16(255)));
+	__m128i value = _mm_add_epi16(_mm_mullo_epi16(pixels, alpha),
+								  _mm_set1_epi16(128));
+	value = _mm_add_epi16(value, _mm_srli_epi16(value, 8));
+	return _mm_srli_epi16(value, 8);
+}
+
+auto premultiply_sse2(texel* texels, std::size_t count) -> std::size_t
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alpha_mask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+	std::size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		auto* address = reinterpret_cast<__m128i*>(texels + i);
+		const __m128i pixels = _mm_loadu_si128(address);
+		const __m128i low = premultiply_sse2_half(
+			_mm_unpacklo_epi8(pixels, zero), alpha_mask);
+		const __m128i high = premultiply_sse2_half(
+			_mm_unpackhi_epi8(pixels, zero), alpha_mask);
+		_mm_storeu_si128(address, _mm_packus_epi16(low, high));
+	}
+	return i;
+}
+
+__attribute__((target("avx2"))) inline __m256i premultiply_avx2_half(
+	__m256i pixels, __m256i alpha_mask)
+{
+	__m256i alpha = _mm256_shufflehi_epi16(
+		_mm256_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3)),
+		_MM_SHUFFLE(3, 3, 3, 3));
+	alpha = _mm256_blendv_epi8(alpha, _mm256_set1_epi16(255), alpha_mask);
+	__m256i value = _mm256_add_epi16(_mm256_mullo_epi16(pixels, alpha),
+									 _mm256_set1_epi16(128));
+	value = _mm256_add_epi16(value, _mm256_srli_epi16(value, 8));
+	return _mm256_srli_epi16(value, 8);
+}
+
+__attribute__((target("avx2"))) auto premultiply_avx2(texel* texels,
+													  std::size_t count)
+	-> std::size_t
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i alpha_mask = _mm256_set_epi16(
+		-1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0);
+	std::size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		auto* address = reinterpret_cast<__m256i*>(texels + i);
+		const __m256i pixels = _mm256_loadu_si256(address);
+		// unpack and pack both work per 128 bit lane so the order is kept
+		const __m256i low = premultiply_avx2_half(
+			_mm256_unpacklo_epi8(pixels, zero), alpha_mask);
+		const __m256i high = premultiply_avx2_half(
+			_mm256_unpackhi_epi8(pixels, zero), alpha_mask);
+		_mm256_storeu_si256(address, _mm256_packus_epi16(low, high));
+	}
+	return i;
+}
+
+// Sums a pair of texels from two rows, the low half holds the result
+inline __m128i box_sse2_pair(__m128i a, __m128i b, bool high)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i sum =
+		high ? _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+							 _mm_unpackhi_epi8(b, zero))
+			 : _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+							 _mm_unpacklo_epi8(b, zero));
+	return _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+}
+
+// 4 source texels per row produce 2 destination texels as 16 bit channels
+inline __m128i box_sse2_half(__m128i a, __m128i b)
+{
+	return _mm_srli_epi16(
+		_mm_add_epi16(_mm_unpacklo_epi64(box_sse2_pair(a, b, false),
+										 box_sse2_pair(a, b, true)),
+					  _mm_set1_epi16(2)),
+		2);
+}
+
+auto box_sse2(const texel* row0, const texel* row1, texel* out,
+			  std::uint32_t begin, std::uint32_t end) -> std::uint32_t
+{
+	std::uint32_t x = begin;
+	for (; x + 4 <= end; x += 4)
+	{
+		const auto* a = reinterpret_cast<const __m128i*>(row0 + 2 * x);
+		const auto* b = reinterpret_cast<const __m128i*>(row1 + 2 * x);
+		const __m128i first =
+			box_sse2_half(_mm_loadu_si128(a), _mm_loadu_si128(b));
+		const __m128i second =
+			box_sse2_half(_mm_loadu_si128(a + 1), _mm_loadu_si128(b + 1));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x),
+						 _mm_packus_epi16(first, second));
+	}
+	return x;
+}
+
+__attribute__((target("avx2"))) inline __m256i box_avx2_pair(__m256i a,
+															 __m256i b,
+															 bool high)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i sum =
+		high ? _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero),
+								_mm256_unpackhi_epi8(b, zero))
+			 : _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero),
+								_mm256_unpacklo_epi8(b, zero));
+	return _mm256_add_epi16(sum, _mm256_srli_si256(sum, 8));
+}
+
+__attribute__((target("avx2"))) inline __m256i box_avx2_half(__m256i a,
+															 __m256i b)
+{
+	return _mm256_srli_epi16(
+		_mm256_add_epi16(_mm256_unpacklo_epi64(box_avx2_pair(a, b, false),
+											   box_avx2_pair(a, b, true)),
+						 _mm256_set1_epi16(2)),
+		2);
+}
+
+__attribute__((target("avx2"))) auto box_avx2(const texel* row0,
+											  const texel* row1, texel* out,
+											  std::uint32_t begin,
+											  std::uint32_t end)
+	-> std::uint32_t
+{
+	std::uint32_t x = begin;
+	for (; x + 8 <= end; x += 8)
+	{
+		const auto* a = reinterpret_cast<const __m256i*>(row0 + 2 * x);
+		const auto* b = reinterpret_cast<const __m256i*>(row1 + 2 * x);
+		const __m256i first =
+			box_avx2_half(_mm256_loadu_si256(a), _mm256_loadu_si256(b));
+		const __m256i second = box_avx2_half(_mm256_loadu_si256(a + 1),
+											 _mm256_loadu_si256(b + 1));
+		// Lanes come out as [0 1 4 5][2 3 6 7], restore the texel order
+		const __m256i packed = _mm256_permute4x64_epi64(
+			_mm256_packus_epi16(first, second), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), packed);
+	}
+	return x;
+}
+
+inline __m128 load_texel(texel value)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bytes = _mm_cvtsi32_si128(std::bit_cast<std::int32_t>(value));
+	return _mm_cvtepi32_ps(
+		_mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero));
+}
+
+inline texel store_texel(__m128 value)
+{
+	// Negative lobes can push rgb over alpha, keep the texel premultiplied
+	const __m128 alpha = _mm_shuffle_ps(value, value, _MM_SHUFFLE(3, 3, 3, 3));
+	value = _mm_min_ps(value, alpha);
+	const __m128i integer = _mm_cvtps_epi32(value);
+	const __m128i bytes =
+		_mm_packus_epi16(_mm_packs_epi32(integer, integer), integer);
+	return std::bit_cast<texel>(_mm_cvtsi128_si32(bytes));
+}
+
+void kaiser_horizontal(const mip_level& src, std::uint32_t dst_width,
+					   std::vector<float>& out, std::uint32_t begin,
+					   std::uint32_t end)
+{
+	const auto last = static_cast<std::int64_t>(src.width) - 1;
+	for (std::uint32_t y = begin; y < end; ++y)
+	{
+		const texel* row = src.texels.data() + std::size_t{y} * src.width;
+		float* out_row = out.data() + std::size_t{y} * dst_width * 4;
+		for (std::uint32_t x = 0; x < dst_width; ++x)
+		{
+			__m128 accumulator = _mm_setzero_ps();
+			for (std::size_t tap = 0; tap < s_kaiser_taps; ++tap)
+			{
+				const auto source = std::clamp<std::int64_t>(
+					(2 * std::int64_t{x}) - 2 + std::int64_t(tap), 0, last);
+				accumulator = _mm_add_ps(
+					accumulator,
+					_mm_mul_ps(load_texel(row[source]),
+							   _mm_set1_ps(s_kaiser_weights.at(tap))));
+			}
+			_mm_storeu_ps(out_row + std::size_t{x} * 4, accumulator);
+		}
+	}
+}
+
+__attribute__((target("avx2,fma"))) void kaiser_vertical_avx2(
+	const std::array<const float*, s_kaiser_taps>& rows, std::uint32_t floats,
+	texel* out)
+{
+	std::uint32_t i = 0;
+	for (; i + 8 <= floats; i += 8)
+	{
+		__m256 accumulator = _mm256_setzero_ps();
+		for (std::size_t tap = 0; tap < s_kaiser_taps; ++tap)
+		{
+			accumulator =
+				_mm256_fmadd_ps(_mm256_loadu_ps(rows.at(tap) + i),
+								_mm256_set1_ps(s_kaiser_weights.at(tap)),
+								accumulator);
+		}
+		out[i / 4] = store_texel(_mm256_castps256_ps128(accumulator));
+		out[(i / 4) + 1] = store_texel(_mm256_extractf128_ps(accumulator, 1));
+	}
+	for (; i < floats; i += 4)
+	{
+		__m128 accumulator = _mm_setzero_ps();
+		for (std::size_t tap = 0; tap < s_kaiser_taps; ++tap)
+		{
+			accumulator = _mm_fmadd_ps(_mm_loadu_ps(rows.at(tap) + i),
+									   _mm_set1_ps(s_kaiser_weights.at(tap)),
+									   accumulator);
+		}
+		out[i / 4] = store_texel(accumulator);
+	}
+}
+
+void kaiser_vertical_sse2(const std::array<const float*, s_kaiser_taps>& rows,
+						  std::uint32_t floats, texel* out)
+{
+	for (std::uint32_t i = 0; i < floats; i += 4)
+	{
+		__m128 accumulator = _mm_setzero_ps();
+		for (std::size_t tap = 0; tap < s_kaiser_taps; ++tap)
+		{
+			accumulator = _mm_add_ps(
+				accumulator,
+				_mm_mul_ps(_mm_loadu_ps(rows.at(tap) + i),
+						   _mm_set1_ps(s_kaiser_weights.at(tap))));
+		}
+		out[i / 4] = store_texel(accumulator);
+	}
+}
+#else
+void kaiser_horizontal(const mip_level& src, std::uint32_t dst_width,
+					   std::vector<float>& out, std::uint32_t begin,
+					   std::uint32_t end)
+{
+	const auto last = static_cast<std::int64_t>(src.width) - 1;
+	for (std::uint32_t y = begin; y < end; ++y)
+	{
+		const texel* row = src.texels.data() + std::size_t{y} * src.width;
+		float* out_row = out.data() + std::size_t{y} * dst_width * 4;
+		for (std::uint32_t x = 0; x < dst_width; ++x)
+		{
+			std::array<float, 4> accumulator{};
+			for (std::size_t tap = 0; tap < s_kaiser_taps; ++tap)
+			{
+				const auto& source = row[std::clamp<std::int64_t>(
+					(2 * std::int64_t{x}) - 2 + std::int64_t(tap), 0, last)];
+				const float weight = s_kaiser_weights.at(tap);
+				accumulator[0] += static_cast<float>(channel(source.r)) * weight;
+				accumulator[1] += static_cast<float>(channel(source.g)) * weight;
+				accumulator[2] += static_cast<float>(channel(source.b)) * weight;
+				accumulator[3] += static_cast<float>(channel(source.a)) * weight;
+			}
+			std::ranges::copy(accumulator, out_row + std::size_t{x} * 4);
+		}
+	}
+}
+
+void kaiser_vertical_scalar(
+	const std::array<const float*, s_kaiser_taps>& rows, std::uint32_t floats,
+	texel* out)
+{
+	for (std::uint32_t i = 0; i < floats; i += 4)
+	{
+		std::array<float, 4> accumulator{};
+		for (std::size_t tap = 0; tap < s_kaiser_taps; ++tap)
+		{
+			for (std::size_t c = 0; c < 4; ++c)
+			{
+				accumulator.at(c) +=
+					rows.at(tap)[i + c] * s_kaiser_weights.at(tap);
+			}
+		}
+		auto quantize = [&](std::size_t c) {
+			const float value = std::min(accumulator.at(c), accumulator[3]);
+			return static_cast<std::byte>(
+				std::clamp(std::lround(value), 0L, 255L));
+		};
+		out[i / 4] = {quantize(0), quantize(1), quantize(2), quantize(3)};
+	}
+}
+#endif
+
+void premultiply(std::span<texel> texels)
+{
+	std::size_t done = 0;
+#ifdef MOONSTONE_MIPMAP_SIMD
+	done = s_has_avx2 ? premultiply_avx2(texels.data(), texels.size())
+					  : premultiply_sse2(texels.data(), texels.size());
+#endif
+	premultiply_scalar(texels.subspan(done));
+}
+
+void downsample_box(const mip_level& src, mip_level& dst)
+{
+	parallel_rows(dst.height, [&](std::uint32_t begin, std::uint32_t end) {
+		for (std::uint32_t y = begin; y < end; ++y)
+		{
+			const std::uint32_t y0 = std::min(2 * y, src.height - 1);
+			const std::uint32_t y1 = std::min(2 * y + 1, src.height - 1);
+			const texel* row0 = src.texels.data() + std::size_t{y0} * src.width;
+			const texel* row1 = src.texels.data() + std::size_t{y1} * src.width;
+			texel* out = dst.texels.data() + std::size_t{y} * dst.width;
+			std::uint32_t x = 0;
+#ifdef MOONSTONE_MIPMAP_SIMD
+			// Every destination texel has both source columns available
+			if (dst.width * 2 <= src.width)
+			{
+				if (s_has_avx2)
+				{
+					x = box_avx2(row0, row1, out, x, dst.width);
+				}
+				x = box_sse2(row0, row1, out, x, dst.width);
+			}
+#endif
+			box_scalar(row0, row1, src.width, out, x, dst.width);
+		}
+	});
+}
+
+void downsample_kaiser(const mip_level& src, mip_level& dst)
+{
+	std::vector<float> horizontal(std::size_t{dst.width} * src.height * 4);
+	parallel_rows(src.height, [&](std::uint32_t begin, std::uint32_t end) {
+		kaiser_horizontal(src, dst.width, horizontal, begin, end);
+	});
+	const auto last = static_cast<std::int64_t>(src.height) - 1;
+	const std::uint32_t floats = dst.width * 4;
+	parallel_rows(dst.height, [&](std::uint32_t begin, std::uint32_t end) {
+		for (std::uint32_t y = begin; y < end; ++y)
+		{
+			std::array<const float*, s_kaiser_taps> rows{};
+			for (std::size_t tap = 0; tap < s_kaiser_taps; ++tap)
+			{
+				const auto source = std::clamp<std::int64_t>(
+					(2 * std::int64_t{y}) - 2 + std::int64_t(tap), 0, last);
+				rows.at(tap) = horizontal.data() + (source * floats);
+			}
+			texel* out = dst.texels.data() + std::size_t{y} * dst.width;
+#ifdef MOONSTONE_MIPMAP_SIMD
+			if (s_has_avx2 && s_has_fma)
+			{
+				kaiser_vertical_avx2(rows, floats, out);
+			}
+			else
+			{
+				kaiser_vertical_sse2(rows, floats, out);
+			}
+#else
+			kaiser_vertical_scalar(rows, floats, out);
+#endif
+		}
+	});
+}
+} // namespace moonstone::renderer
+
+export namespace moonstone::renderer
+{
+void premultiply_alpha(std::span<texel> texels)
+{
+	premultiply(texels);
+}
+
+// Builds every level starting with the base image, the result can be
+// uploaded straight into glTexStorage with one glTexSubImage per level
+auto build_mip_chain(std::span<const texel> base, std::uint32_t width,
+					 std::uint32_t height, mip_options options = {})
+	-> std::vector<mip_level>
+{
+	std::uint32_t count = mip_level_count(width, height);
+	if (options.max_levels != 0)
+	{
+		count = std::min(count, options.max_levels);
+	}
+	std::vector<mip_level> levels;
+	levels.reserve(count);
+	levels.push_back({width, height, {base.begin(), base.end()}});
+	premultiply(levels.front().texels);
+
+	for (std::uint32_t level = 1; level < count; ++level)
+	{
+		const mip_level& src = levels.back();
+		mip_level dst{std::max(1U, src.width / 2),
+					  std::max(1U, src.height / 2),
+					  {}};
+		dst.texels.resize(std::size_t{dst.width} * dst.height);
+		if (options.filter == mip_filter::kaiser)
+		{
+			downsample_kaiser(src, dst);
+		}
+		else
+		{
+			downsample_box(src, dst);
+		}
+		levels.push_back(std::move(dst));
+	}
+
+	if (options.alpha == alpha_mode::straight)
+	{
+		// The base level is copied back untouched so the round trip is
+		// lossless where it matters the most
+		std::ranges::copy(base, levels.front().texels.begin());
+		for (auto& level : levels | std::views::drop(1))
+		{
+			unpremultiply(level.texels);
+		}
+	}
+	return levels;
+}
+} // namespace moonstone::renderer
@@ -0,0 +1,180 @@
+module;
+
+#include "Try.hpp"
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <glad/glad.h>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+export module moonstone:program_cache;
+
+import :utility;
+import :error;
+import :logging;
+import :call;
+
+namespace moonstone::renderer
+{
+struct program_binary_header
+{
+	std::array<char, 4> magic{'M', 'S', 'P', 'B'};
+	std::uint32_t version{1};
+	std::uint32_t format{};
+	std::uint32_t length{};
+};
+} // namespace moonstone::renderer
+
+export namespace moonstone::renderer
+{
+// Linked programs are stored with glGetProgramBinary under
+// `.shader_cache/<key>.bin`. The key hashes the sources together with the
+// driver vendor, renderer and version strings so edited shaders or a driver
+// update simply miss, and a binary the driver refuses is deleted.
+class program_cache
+{
+	static constexpr std::string_view s_directory{".shader_cache"};
+
+	static auto driver_string(GLenum name) -> error::result<std::string>
+	{
+		const auto* value = Try(
+			gl().call_returning<const GLubyte*>(glGetString, name));
+		return value == nullptr
+				   ? std::string{}
+				   : std::string{reinterpret_cast<const char*>(value)};
+	}
+
+	static auto file_path(std::uint64_t key) -> std::filesystem::path
+	{
+		return std::filesystem::path{s_directory} /
+			   std::format("{:016x}.bin", key);
+	}
+
+	// A file we can't use is deleted so the next store replaces it
+	static auto discard(const std::filesystem::path& path)
+		-> std::optional<std::uint32_t>
+	{
+		std::error_code ignored;
+		std::filesystem::remove(path, ignored);
+		return std::nullopt;
+	}
+
+public:
+	[[nodiscard]] static auto is_supported() -> error::result<bool>
+	{
+		std::int32_t formats = 0;
+		Try(gl().call(glGetIntegerv, GL_NUM_PROGRAM_BINARY_FORMATS, &formats));
+		return formats > 0;
+	}
+
+	[[nodiscard]] static auto key(std::string_view vertex_source,
+								  std::string_view fragment_source)
+		-> error::result<std::uint64_t>
+	{
+		static std::optional<std::uint64_t> driver;
+		if (!driver.has_value())
+		{
+			auto hash = hash_string(Try(driver_string(GL_VENDOR)));
+			hash = hash_string(Try(driver_string(GL_RENDERER)), hash);
+			hash = hash_string(Try(driver_string(GL_VERSION)), hash);
+			driver = hash;
+		}
+		return hash_string(fragment_source,
+						   hash_string(vertex_source, *driver));
+	}
+
+	// Returns a linked program, or nothing when there is no usable binary
+	[[nodiscard]] static auto load(std::uint64_t key)
+		-> error::result<std::optional<std::uint32_t>>
+	{
+		const auto path = file_path(key);
+		std::ifstream file{path, std::ios::binary};
+		if (!file)
+		{
+			return std::nullopt;
+		}
+		program_binary_header header{};
+		file.read(reinterpret_cast<char*>(&header), sizeof(header));
+		if (!file || header.magic != program_binary_header{}.magic ||
+			header.version != program_binary_header{}.version)
+		{
+			return discard(path);
+		}
+		// The length comes from the file, check it before allocating
+		std::error_code error;
+		const auto size = std::filesystem::file_size(path, error);
+		if (error || header.length == 0 ||
+			header.length > size - sizeof(header))
+		{
+			return discard(path);
+		}
+		std::vector<char> binary(header.length);
+		file.read(binary.data(), static_cast<std::streamsize>(binary.size()));
+		if (!file)
+		{
+			return discard(path);
+		}
+
+		auto program = Try(gl().call_returning<std::uint32_t>(glCreateProgram));
+		// A format the driver no longer accepts raises an error, that is
+		// a miss like a failed link and the caller compiles from source
+		const auto loaded = gl().call(glProgramBinary,
+									  program,
+									  header.format,
+									  binary.data(),
+									  header.length);
+		std::int32_t status = GL_FALSE;
+		if (loaded.has_value())
+		{
+			Try(gl().call(glGetProgramiv, program, GL_LINK_STATUS, &status));
+		}
+		if (status == GL_FALSE)
+		{
+			Try(gl().call(glDeleteProgram, program));
+			return discard(path);
+		}
+		return program;
+	}
+
+	static auto store(std::uint64_t key, std::uint32_t program)
+		-> error::result<>
+	{
+		std::int32_t length = 0;
+		Try(gl().call(
+			glGetProgramiv, program, GL_PROGRAM_BINARY_LENGTH, &length));
+		if (length <= 0)
+		{
+			return {};
+		}
+		std::vector<char> binary(static_cast<std::size_t>(length));
+		program_binary_header header{};
+		GLenum format = 0;
+		Try(gl().call(glGetProgramBinary,
+					  program,
+					  length,
+					  &length,
+					  &format,
+					  binary.data()));
+		header.format = format;
+		header.length = static_cast<std::uint32_t>(length);
+
+		std::error_code error;
+		std::filesystem::create_directories(s_directory, error);
+		std::ofstream file{file_path(key), std::ios::binary | std::ios::trunc};
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(binary.data(), length);
+		if (!file)
+		{
+			log_warn<"couldn't write program binary {}">(
+				file_path(key).string());
+		}
+		return {};
+	}
+};
+} // namespace moonstone::renderer
@@ -4,7 +4,9 @@ module;
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 #include <glad/glad.h>
+#include <cstdint>
 #include <glm/ext/vector_float4.hpp>
+#include <glm/glm.hpp>
 #include <stdexcept>
 
 export module moonstone:renderer;
@@ -13,8 +15,12 @@ import :window;
 import :shader;
 import :vertex_array;
 import :index_buffer;
+import :uniform_buffer;
 import :error;
+import :logging;
 import :call;
+import :stats;
+import :memory_tracking;
 
 export namespace moonstone::renderer
 {
@@ -22,6 +28,28 @@ export namespace moonstone::renderer
 class renderer
 {
 	window& m_window;
+	frame_globals m_globals{};
+	glm::ivec2 m_framebuffer{0, 0};
+	// What glViewport was last called with
+	glm::ivec4 m_viewport{0, 0, 0, 0};
+	uniform_buffer<frame_globals> m_frame_block{uniform_binding::frame};
+	uniform_ring m_draw_blocks{};
+	double m_last_time{0.0};
+	std::uint64_t m_frame{0};
+
+	// Cameras apply every frame and usually keep the viewport they had
+	error::result<> set_viewport(glm::ivec4 viewport)
+	{
+		if (viewport == this->m_viewport)
+		{
+			return {};
+		}
+		Try(gl().call(
+			glViewport, viewport.x, viewport.y, viewport.z, viewport.w));
+		this->m_viewport = viewport;
+		this->m_globals.viewport = glm::vec4{viewport};
+		return {};
+	}
 
 public:
 	explicit renderer(window& wd) : m_window{wd}
@@ -34,17 +62,129 @@ public:
 		}
 #endif
 	}
+	// Fills the per frame block (time, viewport) and recycles the draw ring,
+	// call before anything is drawn
+	error::result<> begin_frame()
+	{
+		const memory_scope scope{memory_tag::renderer};
+		Try(this->m_draw_blocks.begin_frame());
+		const double now = glfwGetTime();
+		std::int32_t width = 0;
+		std::int32_t height = 0;
+		glfwGetFramebufferSize(
+			this->m_window.get_glfw_window(), &width, &height);
+		this->m_framebuffer = {width, height};
+		// A camera may have narrowed it last frame
+		Try(this->set_viewport({0, 0, width, height}));
+		this->m_globals.time = {static_cast<float>(now),
+								static_cast<float>(now - this->m_last_time),
+								static_cast<float>(this->m_frame),
+								0.0F};
+		this->m_last_time = now;
+		++this->m_frame;
+		Try(this->m_frame_block.update(this->m_globals));
+		return {};
+	}
+	// Every program reads the camera from the frame block, so this replaces
+	// setting a matrix uniform on each shader
+	error::result<> set_camera(const glm::mat4& view,
+							   const glm::mat4& projection)
+	{
+		// Nothing to rebuild or upload for a camera that didn't move
+		if (view == this->m_globals.view &&
+			projection == this->m_globals.projection)
+		{
+			return {};
+		}
+		this->m_globals.view = view;
+		this->m_globals.projection = projection;
+		this->m_globals.view_projection = projection * view;
+		Try(this->m_frame_block.update(this->m_globals));
+		return {};
+	}
+	// Same, drawing into `viewport` (x, y, width, height in pixels) only,
+	// for split screen or a minimap
+	error::result<> set_camera(const glm::mat4& view,
+							   const glm::mat4& projection,
+							   glm::ivec4 viewport)
+	{
+		const bool moved = viewport != this->m_viewport;
+		Try(this->set_viewport(viewport));
+		Try(this->set_camera(view, projection));
+		// A new viewport alone still has to reach the frame block
+		if (moved)
+		{
+			Try(this->m_frame_block.update(this->m_globals));
+		}
+		return {};
+	}
+	// Binds a per draw std140 block for the next draw call
+	template <typename T>
+	error::result<> push_draw_block(const T& block)
+	{
+		Try(this->m_draw_blocks.push(block, uniform_binding::draw));
+		return {};
+	}
+	[[nodiscard]] const frame_globals& get_frame_globals() const
+	{
+		return this->m_globals;
+	}
+	// In pixels, as of begin_frame
+	[[nodiscard]] glm::ivec2 get_framebuffer_size() const
+	{
+		return this->m_framebuffer;
+	}
 	static error::result<> draw(const vertex_array& vao, index_buffer& ib,
 								const shader& shader)
+	{
+		Try(renderer::draw(vao,
+						   ib,
+						   shader,
+						   ib.get_size(),
+						   ib.get_size() == 0 ? 0 : ib.get_highest() + 1));
+		return {};
+	}
+	// Only the first `index_count` indices, for batches that keep a bigger
+	// index buffer than what they fill this frame
+	static error::result<> draw(const vertex_array& vao, index_buffer& ib,
+								const shader& shader,
+								std::uint32_t index_count,
+								std::uint32_t vertex_count)
 	{
 		Try(shader.bind());
 		Try(vao.bind());
 		Try(ib.bind());
 		Try(gl().call(glDrawElements,
 					  GL_TRIANGLES,
-					  ib.get_size(),
+					  index_count,
 					  GL_UNSIGNED_INT,
 					  nullptr));
+		count(counter::draw_calls);
+		count(counter::indices, index_count);
+		count(counter::vertices, vertex_count);
+		return {};
+	}
+	// `instances` copies of the first `index_count` indices, the vertex
+	// array's per instance attributes tell them apart
+	static error::result<> draw_instanced(const vertex_array& vao,
+										  index_buffer& ib,
+										  const shader& shader,
+										  std::uint32_t index_count,
+										  std::uint32_t vertex_count,
+										  std::uint32_t instances)
+	{
+		Try(shader.bind());
+		Try(vao.bind());
+		Try(ib.bind());
+		Try(gl().call(glDrawElementsInstanced,
+					  GL_TRIANGLES,
+					  index_count,
+					  GL_UNSIGNED_INT,
+					  nullptr,
+					  instances));
+		count(counter::draw_calls);
+		count(counter::indices, std::uint64_t{index_count} * instances);
+		count(counter::vertices, std::uint64_t{vertex_count} * instances);
 		return {};
 	}
 	static error::result<> clear()
@@ -60,6 +200,12 @@ public:
 	}
 	void update_buffers()
 	{
+		const memory_scope scope{memory_tag::renderer};
+		auto err = this->m_draw_blocks.end_frame();
+		if (!err.has_value())
+		{
+			log_error<"{}">(err.error().format());
+		}
 		glfwPollEvents();
 		glfwSwapBuffers(this->m_window.get_glfw_window());
 	}
@@ -0,0 +1,312 @@
+module;
+
+#include "Try.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <expected>
+#include <functional>
+#include <future>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+export module moonstone:residency;
+
+import :error;
+import :jobs;
+
+export namespace moonstone::renderer
+{
+using residency_id = std::uint32_t;
+
+enum class residency_state : unsigned char
+{
+	resident,
+	evicted,
+	loading
+};
+
+// `evict` drops the GPU storage, `reload` runs on a worker thread (decode,
+// mip generation...) and hands back the part that has to run on the GL
+// thread to upload the data again.
+struct residency_callbacks
+{
+	using upload_function = std::function<error::result<>()>;
+	std::function<error::result<>()> evict;
+	std::function<upload_function()> reload;
+};
+
+struct residency_stats
+{
+	std::size_t budget_bytes{};
+	std::size_t resident_bytes{};
+	std::size_t peak_resident_bytes{};
+	std::size_t resident_count{};
+	std::size_t evicted_count{};
+	std::size_t loading_count{};
+	std::uint64_t evictions{};
+	std::uint64_t reloads{};
+};
+
+class residency_manager
+{
+	static constexpr std::uint64_t s_never = 0;
+
+public:
+	static constexpr std::size_t whole_resource =
+		std::numeric_limits<std::size_t>::max();
+
+private:
+	struct entry
+	{
+		residency_callbacks callbacks;
+		std::size_t bytes{};
+		std::uint64_t last_used{s_never};
+		std::vector<std::uint64_t> layer_last_used;
+		residency_state state{residency_state::resident};
+		std::future<residency_callbacks::upload_function> pending;
+		bool alive{false};
+	};
+
+	std::vector<entry> m_entries;
+	std::vector<residency_id> m_free_ids;
+	std::size_t m_budget_bytes;
+	std::size_t m_resident_bytes{0};
+	std::size_t m_peak_resident_bytes{0};
+	std::uint64_t m_frame{1};
+	std::uint64_t m_evictions{0};
+	std::uint64_t m_reloads{0};
+
+	error::result<> evict(entry& entry)
+	{
+		Try(entry.callbacks.evict());
+		entry.state = residency_state::evicted;
+		this->m_resident_bytes -= entry.bytes;
+		++this->m_evictions;
+		return {};
+	}
+
+	error::result<> finish_loads()
+	{
+		using namespace std::chrono_literals;
+		for (auto& entry : this->m_entries)
+		{
+			if (!entry.alive || entry.state != residency_state::loading ||
+				entry.pending.wait_for(0s) != std::future_status::ready)
+			{
+				continue;
+			}
+			// Stays evicted if anything fails, the next touch() retries
+			entry.state = residency_state::evicted;
+			residency_callbacks::upload_function upload;
+			try
+			{
+				upload = entry.pending.get();
+			}
+			catch (const std::exception& e)
+			{
+				return std::unexpected(error::gl_error{
+					"APPLICATION",
+					{},
+					"ERROR",
+					0,
+					"HIGH",
+					std::string{"Reloading an evicted resource failed: "} +
+						e.what()});
+			}
+			Try(upload());
+			entry.state = residency_state::resident;
+			this->m_resident_bytes += entry.bytes;
+			this->m_peak_resident_bytes =
+				std::max(this->m_peak_resident_bytes, this->m_resident_bytes);
+			++this->m_reloads;
+		}
+		return {};
+	}
+
+	error::result<> enforce_budget()
+	{
+		while (this->m_resident_bytes > this->m_budget_bytes)
+		{
+			// Anything used this frame is still needed for the draw calls
+			// that were just recorded, so it's never a candidate
+			entry* oldest = nullptr;
+			for (auto& entry : this->m_entries)
+			{
+				if (entry.alive && entry.state == residency_state::resident &&
+					entry.last_used < this->m_frame &&
+					(oldest == nullptr || entry.last_used < oldest->last_used))
+				{
+					oldest = &entry;
+				}
+			}
+			if (oldest == nullptr)
+			{
+				break;
+			}
+			Try(this->evict(*oldest));
+		}
+		return {};
+	}
+
+public:
+	explicit residency_manager(std::size_t budget_bytes) :
+		m_budget_bytes{budget_bytes}
+	{
+	}
+	~residency_manager() = default;
+
+	residency_id add(std::size_t bytes, std::size_t layers,
+					 residency_callbacks callbacks)
+	{
+		residency_id id{};
+		if (this->m_free_ids.empty())
+		{
+			id = static_cast<residency_id>(this->m_entries.size());
+			this->m_entries.emplace_back();
+		}
+		else
+		{
+			id = this->m_free_ids.back();
+			this->m_free_ids.pop_back();
+		}
+		auto& entry = this->m_entries[id];
+		entry.callbacks = std::move(callbacks);
+		entry.bytes = bytes;
+		entry.last_used = this->m_frame;
+		entry.layer_last_used.assign(std::max<std::size_t>(layers, 1),
+									 this->m_frame);
+		entry.state = residency_state::resident;
+		entry.alive = true;
+		this->m_resident_bytes += bytes;
+		this->m_peak_resident_bytes =
+			std::max(this->m_peak_resident_bytes, this->m_resident_bytes);
+		return id;
+	}
+
+	void remove(residency_id id)
+	{
+		auto& entry = this->m_entries.at(id);
+		if (entry.pending.valid())
+		{
+			// The worker may still be decoding, the upload is just dropped
+			entry.pending.wait();
+			entry.pending = {};
+		}
+		if (entry.state == residency_state::resident)
+		{
+			this->m_resident_bytes -= entry.bytes;
+		}
+		entry = {};
+		this->m_free_ids.push_back(id);
+	}
+
+	// Marks the entry (and layer) as used this frame, returns whether it can
+	// be sampled right now. Evicted entries start reloading asynchronously.
+	bool touch(residency_id id, std::size_t layer = whole_resource)
+	{
+		auto& entry = this->m_entries.at(id);
+		entry.last_used = this->m_frame;
+		if (layer < entry.layer_last_used.size())
+		{
+			entry.layer_last_used[layer] = this->m_frame;
+		}
+		if (entry.state == residency_state::evicted)
+		{
+			entry.state = residency_state::loading;
+			std::promise<residency_callbacks::upload_function> reloaded;
+			entry.pending = reloaded.get_future();
+			// Jobs shouldn't throw, finish_loads rethrows the failure
+			jobs().run([reload = entry.callbacks.reload,
+						reloaded = std::move(reloaded)]() mutable {
+				try
+				{
+					reloaded.set_value(reload());
+				}
+				catch (...)
+				{
+					reloaded.set_exception(std::current_exception());
+				}
+			});
+		}
+		return entry.state == residency_state::resident;
+	}
+
+	// Called once per frame from the GL thread after all draws.
+	error::result<> update()
+	{
+		// A failed reload still lets the frame finish, it's reported after
+		auto loaded = this->finish_loads();
+		Try(this->enforce_budget());
+		++this->m_frame;
+		return loaded;
+	}
+
+	void set_budget(std::size_t budget_bytes)
+	{
+		this->m_budget_bytes = budget_bytes;
+	}
+
+	[[nodiscard]] residency_state get_state(residency_id id) const
+	{
+		return this->m_entries.at(id).state;
+	}
+
+	[[nodiscard]] std::uint64_t get_last_used(
+		residency_id id, std::size_t layer = whole_resource) const
+	{
+		const auto& entry = this->m_entries.at(id);
+		if (layer == whole_resource)
+		{
+			return entry.last_used;
+		}
+		return layer < entry.layer_last_used.size()
+				   ? entry.layer_last_used[layer]
+				   : s_never;
+	}
+
+	[[nodiscard]] std::uint64_t get_frame() const
+	{
+		return this->m_frame;
+	}
+
+	[[nodiscard]] residency_stats get_stats() const
+	{
+		residency_stats stats{.budget_bytes = this->m_budget_bytes,
+							  .resident_bytes = this->m_resident_bytes,
+							  .peak_resident_bytes =
+								  this->m_peak_resident_bytes,
+							  .evictions = this->m_evictions,
+							  .reloads = this->m_reloads};
+		for (const auto& entry : this->m_entries)
+		{
+			if (!entry.alive)
+			{
+				continue;
+			}
+			switch (entry.state)
+			{
+			case residency_state::resident:
+				++stats.resident_count;
+				break;
+			case residency_state::evicted:
+				++stats.evicted_count;
+				break;
+			case residency_state::loading:
+				++stats.loading_count;
+				break;
+			}
+		}
+		return stats;
+	}
+
+	residency_manager(const residency_manager&) = delete;
+	residency_manager(residency_manager&&) = delete;
+	residency_manager& operator=(const residency_manager&) = delete;
+	residency_manager& operator=(residency_manager&&) = delete;
+};
+} // namespace moonstone::renderer
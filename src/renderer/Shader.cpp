@@ -3,32 +3,100 @@ module;
 #define GLFW_INCLUDE_NONE
 #include "Try.hpp"
 #include "glad/glad.h"
+#include <algorithm>
+#include <array>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <exception>
+#include <format>
 #include <glm/ext/matrix_float4x4.hpp>
 #include <glm/ext/vector_float3.hpp>
 #include <glm/ext/vector_float4.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#include <print>
-#include <source_location>
+#include <span>
+#include <stdexcept>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <utility>
+#include <vector>
 
 export module moonstone:shader;
 
 import :utility;
 import :call;
+import :stats;
 import :error;
+import :logging;
+import :program_cache;
+import :shader_preprocessor;
 
 export namespace moonstone::renderer
 {
+// Uniform names are hashed at compile time so setting one never allocates,
+// `shader.setUniformMatf4("u_model_view_projection", mvp)` keeps working as
+// the literal converts implicitly.
+struct uniform_id
+{
+	std::uint64_t hash;
+	std::string_view name;
+
+	template <std::size_t N>
+	consteval uniform_id(const char (&literal)[N]) :
+		hash{hash_string({literal, N - 1})},
+		name{literal, N - 1}
+	{
+	}
+	static constexpr auto runtime(std::string_view name) -> uniform_id
+	{
+		return uniform_id{hash_string(name), name};
+	}
+
+private:
+	constexpr uniform_id(std::uint64_t hash, std::string_view name) :
+		hash{hash},
+		name{name}
+	{
+	}
+};
+
+// Both stages after #include and define expansion
+struct shader_sources
+{
+	preprocessed_source vertex;
+	preprocessed_source fragment;
+
+	[[nodiscard]] std::uint64_t hash() const
+	{
+		return hash_bytes(std::as_bytes(std::span{&this->fragment.hash, 1}),
+						  this->vertex.hash);
+	}
+};
+
 class shader
 {
+	// Big enough for the largest uniform type that is set (mat4)
+	static constexpr std::size_t s_max_uniform_size = 64;
+	// Program made current by the last bind, to count actual switches
+	static inline std::uint32_t s_bound{0};
+	struct uniform_slot
+	{
+		std::uint64_t hash;
+		std::int32_t location;
+		std::uint32_t type;
+		std::int32_t count;
+		std::array<std::byte, s_max_uniform_size> last_value;
+		bool has_value;
+	};
+
 	unsigned int m_renderer_id;
 	std::string m_vs_file_path;
 	std::string m_fs_file_path;
-	std::unordered_map<std::string, int> m_uniform_location_cache;
+	shader_defines m_defines;
+	// Every file the two stages were built from, includes too
+	std::vector<std::string> m_dependencies;
+	// Sorted by hash, filled once after linking
+	std::vector<uniform_slot> m_uniforms;
 
 	shader(std::string vs_path, std::string fs_path, std::uint32_t id) :
 		m_fs_file_path{std::move(fs_path)},
@@ -37,39 +105,167 @@ class shader
 	{
 	}
 
-	auto get_uniform_location(const std::string& name)
-		-> error::result<std::uint32_t>
+	auto reflect() -> error::result<>
 	{
-		if (this->m_uniform_location_cache.find(name) !=
-			this->m_uniform_location_cache.end())
+		this->m_uniforms.clear();
+		std::int32_t count = 0;
+		std::int32_t max_length = 0;
+		Try(gl().call(
+			glGetProgramiv, this->m_renderer_id, GL_ACTIVE_UNIFORMS, &count));
+		Try(gl().call(glGetProgramiv,
+					  this->m_renderer_id,
+					  GL_ACTIVE_UNIFORM_MAX_LENGTH,
+					  &max_length));
+		std::string name(static_cast<std::size_t>(max_length), '\0');
+		for (std::int32_t i = 0; i < count; ++i)
 		{
-			return this->m_uniform_location_cache[name];
+			std::int32_t length = 0;
+			std::int32_t size = 0;
+			GLenum type = 0;
+			Try(gl().call(glGetActiveUniform,
+						  this->m_renderer_id,
+						  i,
+						  max_length,
+						  &length,
+						  &size,
+						  &type,
+						  name.data()));
+			const auto location =
+				Try(gl().call_returning<std::int32_t>(glGetUniformLocation,
+													  this->m_renderer_id,
+													  name.c_str()));
+			// Members of uniform blocks don't have a location
+			if (location < 0)
+			{
+				continue;
+			}
+			std::string_view view{name.data(),
+								  static_cast<std::size_t>(length)};
+			if (view.ends_with("[0]"))
+			{
+				view.remove_suffix(3);
+			}
+			this->m_uniforms.push_back(
+				{hash_string(view), location, type, size, {}, false});
 		}
+		std::ranges::sort(this->m_uniforms, {}, &uniform_slot::hash);
+		return {};
+	}
 
-		const std::uint32_t location = Try(gl().call_returning<std::uint32_t>(
-			glGetUniformLocation, this->m_renderer_id, name.c_str()));
+	// A name the program doesn't have (a permutation's #define or the
+	// driver optimized it away) warns once and is cached with location -1,
+	// setting it from then on is a no-op
+	auto find_uniform(uniform_id id) -> uniform_slot&
+	{
+		auto iterator = std::ranges::lower_bound(
+			this->m_uniforms, id.hash, {}, &uniform_slot::hash);
+		if (iterator == this->m_uniforms.end() || iterator->hash != id.hash)
+		{
+			log_warn<"uniform {} doesn't exist in {} + {}">(
+				id.name, this->m_vs_file_path, this->m_fs_file_path);
+			iterator = this->m_uniforms.insert(
+				iterator, {id.hash, -1, GL_NONE, 0, {}, false});
+		}
+		return *iterator;
+	}
 
-		if (location == -1)
+	// Skips the GL call when the value didn't change since the last time
+	template <typename T, typename F>
+	auto set_uniform(uniform_id id, const T& value, F upload)
+		-> error::result<>
+	{
+		static_assert(sizeof(T) <= s_max_uniform_size);
+		uniform_slot& slot = this->find_uniform(id);
+		if (slot.location < 0 ||
+			(slot.has_value &&
+			 std::memcmp(slot.last_value.data(), &value, sizeof(T)) == 0))
 		{
-			auto location = std::source_location::current();
-			std::println(stderr,
-						 "[{}:{}][OpenGL][WARN]: uniform {} doesn't exist!",
-						 location.file_name(),
-						 location.line(),
-						 name);
+			return {};
 		}
+		Try(upload(slot.location));
+		std::memcpy(slot.last_value.data(), &value, sizeof(T));
+		slot.has_value = true;
+		return {};
+	}
 
-		this->m_uniform_location_cache[name] = location;
-		return location;
+	// Only the types the setters below can produce ever have a value
+	auto restore_uniform(uniform_slot& slot,
+						 const std::array<std::byte, s_max_uniform_size>& value)
+		-> error::result<>
+	{
+		const auto* floats = reinterpret_cast<const float*>(value.data());
+		switch (slot.type)
+		{
+		case GL_FLOAT_VEC4:
+			Try(gl().call(glProgramUniform4fv,
+						  this->m_renderer_id,
+						  slot.location,
+						  1,
+						  floats));
+			break;
+		case GL_FLOAT_VEC3:
+			Try(gl().call(glProgramUniform3fv,
+						  this->m_renderer_id,
+						  slot.location,
+						  1,
+						  floats));
+			break;
+		case GL_FLOAT_MAT4:
+			Try(gl().call(glProgramUniformMatrix4fv,
+						  this->m_renderer_id,
+						  slot.location,
+						  1,
+						  GL_FALSE,
+						  floats));
+			break;
+		default:
+			Try(gl().call(glProgramUniform1iv,
+						  this->m_renderer_id,
+						  slot.location,
+						  1,
+						  reinterpret_cast<const std::int32_t*>(value.data())));
+			break;
+		}
+		slot.last_value = value;
+		slot.has_value = true;
+		return {};
 	}
-	[[nodiscard]] static auto create_shader(
-		const std::string& vertex_shader_file,
-		const std::string& fragment_shader_file) -> error::result<std::uint32_t>
+	void set_dependencies(const shader_sources& sources)
 	{
+		this->m_dependencies = sources.vertex.files;
+		this->m_dependencies.insert(this->m_dependencies.end(),
+									sources.fragment.files.begin(),
+									sources.fragment.files.end());
+	}
 
-		auto vertex_shader = read_shader_file(vertex_shader_file);
+	static auto load_sources(const std::string& vs_path,
+							 const std::string& fs_path,
+							 const shader_defines& defines) -> shader_sources
+	{
+		auto sources = preprocess(vs_path, fs_path, defines);
+		if (!sources.has_value())
+		{
+			throw std::runtime_error(sources.error().format());
+		}
+		return *std::move(sources);
+	}
 
-		auto fragment_shader = read_shader_file(fragment_shader_file);
+	[[nodiscard]] static auto create_shader(const std::string& vertex_shader,
+											const std::string& fragment_shader)
+		-> error::result<std::uint32_t>
+	{
+		// Warm runs skip compilation entirely
+		const bool cacheable = Try(program_cache::is_supported());
+		const auto cache_key =
+			Try(program_cache::key(vertex_shader, fragment_shader));
+		if (cacheable)
+		{
+			auto cached = Try(program_cache::load(cache_key));
+			if (cached.has_value())
+			{
+				return *cached;
+			}
+		}
 
 		auto program = Try(gl().call_returning<std::uint32_t>(glCreateProgram));
 		auto vs = Try(compile_shader(vertex_shader, GL_VERTEX_SHADER));
@@ -77,11 +273,28 @@ class shader
 
 		Try(gl().call(glAttachShader, program, vs));
 		Try(gl().call(glAttachShader, program, fs));
+		if (cacheable)
+		{
+			Try(gl().call(glProgramParameteri,
+						  program,
+						  GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+						  GL_TRUE));
+		}
 		Try(gl().call(glLinkProgram, program));
 		Try(gl().call(glValidateProgram, program));
 		Try(gl().call(glDeleteShader, vs));
 		Try(gl().call(glDeleteShader, fs));
 
+		if (auto linked = finish_link(program); !linked.has_value())
+		{
+			Try(gl().call(glDeleteProgram, program));
+			return std::unexpected(std::move(linked).error());
+		}
+		if (cacheable)
+		{
+			Try(program_cache::store(cache_key, program));
+		}
+
 		return program;
 	}
 	[[nodiscard]] static auto compile_shader(const std::string& source,
@@ -102,10 +315,8 @@ class shader
 			Try(gl().call(glGetShaderiv, id, GL_INFO_LOG_LENGTH, &length));
 			char* message = static_cast<char*>(alloca(length * sizeof(char)));
 			Try(gl().call(glGetShaderInfoLog, id, length, &length, message));
-			std::println(stderr,
-						 "Failed to compile {} shader: {}",
-						 (type == GL_VERTEX_SHADER ? "vertex" : "fragment"),
-						 message);
+			log_error<"Failed to compile {} shader: {}">(
+				type == GL_VERTEX_SHADER ? "vertex" : "fragment", message);
 			Try(gl().call(glDeleteShader, id));
 			return std::unexpected(error::gl_error{
 				"SHADER COMPILER", {}, "ERROR", 0, "HIGH", message});
@@ -114,13 +325,68 @@ class shader
 	}
 
 public:
+	// Issues the compile and link without querying any status, so with
+	// KHR_parallel_shader_compile the driver finishes it on its own threads
+	// while frames keep going. finish_link blocks if it isn't done yet.
+	[[nodiscard]] static auto begin_link(const std::string& vertex_source,
+										 const std::string& fragment_source)
+		-> error::result<std::uint32_t>
+	{
+		auto program = Try(gl().call_returning<std::uint32_t>(glCreateProgram));
+		const std::array sources{
+			std::pair{vertex_source.c_str(), GL_VERTEX_SHADER},
+			std::pair{fragment_source.c_str(), GL_FRAGMENT_SHADER}};
+		std::array<std::uint32_t, 2> stages{};
+		for (std::size_t i = 0; i < sources.size(); ++i)
+		{
+			const auto& [source, type] = sources.at(i);
+			stages.at(i) =
+				Try(gl().call_returning<std::uint32_t>(glCreateShader, type));
+			Try(gl().call(glShaderSource, stages.at(i), 1, &source, nullptr));
+			Try(gl().call(glCompileShader, stages.at(i)));
+			Try(gl().call(glAttachShader, program, stages.at(i)));
+		}
+		Try(gl().call(glProgramParameteri,
+					  program,
+					  GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+					  GL_TRUE));
+		Try(gl().call(glLinkProgram, program));
+		// Only flagged, they go away with the program
+		for (const auto stage : stages)
+		{
+			Try(gl().call(glDeleteShader, stage));
+		}
+		return program;
+	}
+
+	[[nodiscard]] static auto finish_link(std::uint32_t program)
+		-> error::result<>
+	{
+		std::int32_t linked = GL_FALSE;
+		Try(gl().call(glGetProgramiv, program, GL_LINK_STATUS, &linked));
+		if (linked == GL_TRUE)
+		{
+			return {};
+		}
+		std::int32_t length = 0;
+		Try(gl().call(glGetProgramiv, program, GL_INFO_LOG_LENGTH, &length));
+		std::string message(static_cast<std::size_t>(std::max(length, 1)),
+							'\0');
+		Try(gl().call(
+			glGetProgramInfoLog, program, length, &length, message.data()));
+		message.resize(static_cast<std::size_t>(length));
+		return std::unexpected(error::gl_error{
+			"SHADER COMPILER", {}, "ERROR", 0, "HIGH", std::move(message)});
+	}
+
 	~shader()
 #ifdef _DEBUG
 	{
 		const auto& result = gl().call(glDeleteProgram, m_renderer_id);
 		if (!result.has_value())
 		{
-			std::println(stderr, "{}", result.error().format());
+			log_error<"{}">(result.error().format());
+			flush_logs();
 			std::terminate();
 		}
 	}
@@ -129,59 +395,155 @@ public:
 		gl().call(glDeleteProgram, this->m_renderer_id);
 	}
 #endif
-	shader(const std::string& vs_path, const std::string& fs_path)
+	shader(const std::string& vs_path, const std::string& fs_path,
+		   shader_defines defines = {}) :
+		shader(vs_path,
+			   fs_path,
+			   load_sources(vs_path, fs_path, defines),
+			   defines)
+	{
+	}
+	// For callers that already preprocessed, e.g. to look the sources up
+	shader(const std::string& vs_path, const std::string& fs_path,
+		   const shader_sources& sources, const shader_defines& defines)
 	{
-		const auto& result = create_shader(vs_path, fs_path);
+		const auto& result =
+			create_shader(sources.vertex.text, sources.fragment.text);
 		if (!result.has_value())
 		{
-			std::println(stderr, "{}", result.error().format());
+			log_error<"{}">(result.error().format());
+			flush_logs();
 			__builtin_debugtrap();
 		}
 		this->m_vs_file_path = vs_path;
 		this->m_fs_file_path = fs_path;
+		this->m_defines = defines;
+		this->set_dependencies(sources);
 		this->m_renderer_id = result.value();
+		const auto reflected = this->reflect();
+		if (!reflected.has_value())
+		{
+			log_error<"{}">(reflected.error().format());
+		}
 	}
 
 	[[nodiscard]] error::result<> bind() const
 	{
 		Try(gl().call(glUseProgram, this->m_renderer_id));
+		if (s_bound != this->m_renderer_id)
+		{
+			count(counter::program_switches);
+			s_bound = this->m_renderer_id;
+		}
 		return {};
 	}
 	static error::result<> unbind()
 	{
 		Try(gl().call(glUseProgram, 0));
+		s_bound = 0;
 		return {};
 	}
 
-	auto setUniformVecf4(const std::string& name, glm::vec4 data)
-		-> error::result<>
+	[[nodiscard]] static auto preprocess(const std::string& vs_path,
+										 const std::string& fs_path,
+										 const shader_defines& defines)
+		-> error::result<shader_sources>
 	{
-		std::uint32_t location = Try(this->get_uniform_location(name));
-		Try(gl().call(glUniform4f, location, data.x, data.y, data.z, data.w));
-		return {};
+		return shader_sources{Try(preprocess_shader(vs_path, defines)),
+							  Try(preprocess_shader(fs_path, defines))};
 	}
-	auto setUniformVecf3(const std::string& name, glm::vec3 data)
+	// The sources as they are on disk right now, with this shader's defines
+	[[nodiscard]] auto preprocess() const -> error::result<shader_sources>
+	{
+		return preprocess(
+			this->m_vs_file_path, this->m_fs_file_path, this->m_defines);
+	}
+
+	// Swaps in a freshly linked program built from `sources`, uniforms that
+	// still exist keep the values last set on the old one so the swap is
+	// invisible to the caller
+	auto replace_program(std::uint32_t program, const shader_sources& sources)
 		-> error::result<>
 	{
-		std::uint32_t location = Try(this->get_uniform_location(name));
-		Try(gl().call(glUniform3f, location, data.x, data.y, data.z));
+		this->set_dependencies(sources);
+		auto old_uniforms = std::move(this->m_uniforms);
+		const auto old_program = std::exchange(this->m_renderer_id, program);
+		Try(this->reflect());
+		for (auto& slot : this->m_uniforms)
+		{
+			auto old = std::ranges::lower_bound(
+				old_uniforms, slot.hash, {}, &uniform_slot::hash);
+			if (old == old_uniforms.end() || old->hash != slot.hash ||
+				old->type != slot.type || !old->has_value)
+			{
+				continue;
+			}
+			Try(this->restore_uniform(slot, old->last_value));
+		}
+		Try(gl().call(glDeleteProgram, old_program));
 		return {};
 	}
 
-	auto setUniformMatf4(const std::string& name, const glm::mat4& data)
+	[[nodiscard]] const std::string& get_vs_path() const
+	{
+		return this->m_vs_file_path;
+	}
+	[[nodiscard]] const std::string& get_fs_path() const
+	{
+		return this->m_fs_file_path;
+	}
+	[[nodiscard]] bool depends_on(const std::string& file) const
+	{
+		return std::ranges::contains(this->m_dependencies, file);
+	}
+	[[nodiscard]] std::uint64_t get_permutation_key() const
+	{
+		return this->m_defines.key();
+	}
+
+	auto setUniformVecf4(uniform_id name, glm::vec4 data) -> error::result<>
+	{
+		return this->set_uniform(name, data, [&](std::int32_t location) {
+			return gl().call(glProgramUniform4f,
+							 this->m_renderer_id,
+							 location,
+							 data.x,
+							 data.y,
+							 data.z,
+							 data.w);
+		});
+	}
+	auto setUniformVecf3(uniform_id name, glm::vec3 data) -> error::result<>
+	{
+		return this->set_uniform(name, data, [&](std::int32_t location) {
+			return gl().call(glProgramUniform3f,
+							 this->m_renderer_id,
+							 location,
+							 data.x,
+							 data.y,
+							 data.z);
+		});
+	}
+
+	auto setUniformMatf4(uniform_id name, const glm::mat4& data)
 		-> error::result<>
 	{
-		std::uint32_t location = Try(this->get_uniform_location(name));
-		Try(gl().call(
-			glUniformMatrix4fv, location, 1, GL_FALSE, glm::value_ptr(data)));
-		return {};
+		return this->set_uniform(name, data, [&](std::int32_t location) {
+			return gl().call(glProgramUniformMatrix4fv,
+							 this->m_renderer_id,
+							 location,
+							 1,
+							 GL_FALSE,
+							 glm::value_ptr(data));
+		});
 	}
 
-	auto setUniformInt1(const std::string& name, int data) -> error::result<>
+	auto setUniformInt1(uniform_id name, int data) -> error::result<>
 	{
-		std::uint32_t location = Try(this->get_uniform_location(name));
-		Try(gl().call(glUniform1i, location, data));
-		return {};
+		return this->set_uniform(name, data, [&](std::int32_t location) {
+			return gl().call(
+				glProgramUniform1i, this->m_renderer_id, location, data);
+		});
 	}
 
 	shader(const shader&) = delete;
@@ -0,0 +1,216 @@
+module;
+
+#include "Try.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <format>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+export module moonstone:shader_preprocessor;
+
+import :utility;
+import :error;
+import :file_system;
+
+export namespace moonstone::renderer
+{
+// Injected `#define NAME VALUE` lines. Kept sorted so the same set always
+// gives the same permutation key whatever order it was built in.
+class shader_defines
+{
+	std::vector<std::pair<std::string, std::string>> m_defines;
+
+public:
+	shader_defines() = default;
+	shader_defines(
+		std::initializer_list<std::pair<std::string, std::string>> defines)
+	{
+		for (const auto& [name, value] : defines)
+		{
+			this->set(name, value);
+		}
+	}
+
+	shader_defines& set(const std::string& name, const std::string& value = "1")
+	{
+		using define = std::pair<std::string, std::string>;
+		auto iterator = std::ranges::lower_bound(
+			this->m_defines, name, {}, &define::first);
+		if (iterator != this->m_defines.end() && iterator->first == name)
+		{
+			iterator->second = value;
+		}
+		else
+		{
+			this->m_defines.emplace(iterator, name, value);
+		}
+		return *this;
+	}
+
+	[[nodiscard]] std::uint64_t key() const
+	{
+		auto hash = hash_seed;
+		for (const auto& [name, value] : this->m_defines)
+		{
+			hash = hash_string(name, hash);
+			hash = hash_string("=", hash);
+			hash = hash_string(value, hash);
+			hash = hash_string(";", hash);
+		}
+		return hash;
+	}
+
+	[[nodiscard]] bool empty() const
+	{
+		return this->m_defines.empty();
+	}
+	[[nodiscard]] auto begin() const
+	{
+		return this->m_defines.begin();
+	}
+	[[nodiscard]] auto end() const
+	{
+		return this->m_defines.end();
+	}
+};
+
+struct preprocessed_source
+{
+	std::string text;
+	// Every file that went into the text, the root first. The index is the
+	// source number used in the `#line` directives so compiler errors point
+	// at the right file.
+	std::vector<std::string> files;
+	std::uint64_t hash{};
+};
+} // namespace moonstone::renderer
+
+namespace moonstone::renderer
+{
+auto preprocessor_error(std::string message) -> error::gl_error
+{
+	return error::gl_error{
+		"SHADER PREPROCESSOR", {}, "ERROR", 0, "HIGH", std::move(message)};
+}
+
+// `#include "file"` resolves relative to the including file, inside shaders/
+auto resolve_include(const std::string& from, std::string_view included)
+	-> std::string
+{
+	return (std::filesystem::path{from}.parent_path() / included)
+		.lexically_normal()
+		.generic_string();
+}
+
+auto trim(std::string_view line) -> std::string_view
+{
+	const auto first = line.find_first_not_of(" \t");
+	return first == std::string_view::npos ? std::string_view{}
+										   : line.substr(first);
+}
+
+auto expand(const std::string& file, const shader_defines& defines,
+			std::vector<std::string>& stack, preprocessed_source& output)
+	-> error::result<>
+{
+	if (std::ranges::contains(stack, file))
+	{
+		return std::unexpected(
+			preprocessor_error(std::format("{} includes itself", file)));
+	}
+	// Every file is included at most once, no guards needed
+	if (std::ranges::contains(output.files, file))
+	{
+		return {};
+	}
+	if (!files().exists("shaders/" + file))
+	{
+		const auto from = stack.empty()
+							  ? std::string{}
+							  : std::format(" (from {})", stack.back());
+		return std::unexpected(
+			preprocessor_error(std::format("can't find {}{}", file, from)));
+	}
+	const auto source_number = output.files.size();
+	output.files.push_back(file);
+	stack.push_back(file);
+	if (source_number != 0)
+	{
+		output.text += std::format("#line 1 {}\n", source_number);
+	}
+
+	const auto text = read_shader_file(file);
+	std::size_t line_number = 0;
+	for (std::size_t start = 0; start < text.size();)
+	{
+		auto end = text.find('\n', start);
+		end = end == std::string::npos ? text.size() : end;
+		const std::string_view line{text.data() + start, end - start};
+		const auto directive = trim(line);
+		start = end + 1;
+		++line_number;
+
+		if (directive.starts_with("#include"))
+		{
+			const auto open = directive.find('"');
+			const auto close = directive.rfind('"');
+			if (open == std::string_view::npos || close <= open)
+			{
+				return std::unexpected(preprocessor_error(std::format(
+					"{}:{}: malformed #include", file, line_number)));
+			}
+			Try(expand(
+				resolve_include(file,
+								directive.substr(open + 1, close - open - 1)),
+				defines,
+				stack,
+				output));
+			output.text += std::format(
+				"#line {} {}\n", line_number + 1, source_number);
+			continue;
+		}
+		if (directive.starts_with("#pragma once"))
+		{
+			continue;
+		}
+		output.text += line;
+		output.text += '\n';
+		// Defines go right after #version, which has to stay first
+		if (source_number == 0 && directive.starts_with("#version"))
+		{
+			for (const auto& [name, value] : defines)
+			{
+				output.text += std::format("#define {} {}\n", name, value);
+			}
+			output.text += std::format("#line {} 0\n", line_number + 1);
+		}
+	}
+	stack.pop_back();
+	return {};
+}
+} // namespace moonstone::renderer
+
+export namespace moonstone::renderer
+{
+// Expands `#include "file"` (paths relative to shaders/) and injects the
+// defines after `#version`.
+auto preprocess_shader(const std::string& file, const shader_defines& defines)
+	-> error::result<preprocessed_source>
+{
+	preprocessed_source output;
+	std::vector<std::string> stack;
+	Try(expand(std::filesystem::path{file}.lexically_normal().generic_string(),
+			   defines,
+			   stack,
+			   output));
+	output.hash = hash_string(output.text);
+	return output;
+}
+} // namespace moonstone::renderer
@@ -0,0 +1,406 @@
+module;
+
+#define GLFW_INCLUDE_NONE
+#include "Try.hpp"
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <expected>
+#include <future>
+#include <glad/glad.h>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stop_token>
+#include <string>
+#include <sys/inotify.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+export module moonstone:shader_reload;
+
+import :error;
+import :logging;
+import :call;
+import :window;
+import :shader;
+import :program_cache;
+
+namespace moonstone::renderer
+{
+// Not in every glad build, so the extension is loaded by hand
+constexpr GLenum completion_status_khr = 0x91B1;
+using max_compiler_threads_function = void(APIENTRY*)(GLuint);
+
+// Runs with the shared context current, so it uses GL directly instead of
+// gl() whose error queue belongs to the main context's debug callback.
+auto link_on_worker(const std::string& vertex_source,
+					const std::string& fragment_source) -> std::uint32_t
+{
+	const auto program = glCreateProgram();
+	const std::array sources{vertex_source.c_str(), fragment_source.c_str()};
+	const std::array<GLenum, 2> types{GL_VERTEX_SHADER, GL_FRAGMENT_SHADER};
+	std::array<std::uint32_t, 2> stages{};
+	for (std::size_t i = 0; i < stages.size(); ++i)
+	{
+		stages.at(i) = glCreateShader(types.at(i));
+		glShaderSource(stages.at(i), 1, &sources.at(i), nullptr);
+		glCompileShader(stages.at(i));
+		glAttachShader(program, stages.at(i));
+	}
+	glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(program);
+	for (const auto stage : stages)
+	{
+		glDeleteShader(stage);
+	}
+	// Querying the status waits for the link here instead of on the main
+	// thread, and the main context only sees the program once it's finished
+	std::int32_t linked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	glFinish();
+	return program;
+}
+} // namespace moonstone::renderer
+
+export namespace moonstone::renderer
+{
+// Watches the shader directory with inotify and rebuilds the programs that
+// use a changed file without stalling the frame. With
+// KHR_parallel_shader_compile the driver compiles on its own threads and the
+// program is polled every update, otherwise a hidden window sharing the main
+// context compiles on a worker thread. The new program replaces the old one
+// between frames only when it linked, a broken edit keeps the old one.
+// inotify isn't recursive, only files directly in the directory are seen.
+class shader_reloader
+{
+	struct pending_reload
+	{
+		std::weak_ptr<shader> target;
+		shader_sources sources;
+		// Parallel compile path
+		std::uint32_t program{};
+		// Shared context path
+		std::future<std::uint32_t> compiled;
+		// A newer edit came in while this one was compiling
+		bool superseded{false};
+	};
+	struct worker_job
+	{
+		std::string vertex_source;
+		std::string fragment_source;
+		std::promise<std::uint32_t> promise;
+	};
+
+	std::string m_directory;
+	int m_inotify{-1};
+	int m_watch{-1};
+	bool m_parallel{false};
+	std::vector<std::weak_ptr<shader>> m_shaders;
+	std::vector<pending_reload> m_pending;
+	std::uint64_t m_reloads{0};
+	std::uint64_t m_failures{0};
+
+	GLFWwindow* m_context{nullptr};
+	std::mutex m_jobs_mutex;
+	std::condition_variable_any m_jobs_ready;
+	std::deque<worker_job> m_jobs;
+	std::jthread m_worker;
+
+	void work(const std::stop_token& stop)
+	{
+		glfwMakeContextCurrent(this->m_context);
+		while (true)
+		{
+			worker_job job;
+			{
+				std::unique_lock lock{this->m_jobs_mutex};
+				if (!this->m_jobs_ready.wait(
+						lock, stop, [this] { return !this->m_jobs.empty(); }))
+				{
+					break;
+				}
+				job = std::move(this->m_jobs.front());
+				this->m_jobs.pop_front();
+			}
+			job.promise.set_value(
+				link_on_worker(job.vertex_source, job.fragment_source));
+		}
+		glfwMakeContextCurrent(nullptr);
+	}
+
+	void start_worker(window& wd)
+	{
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		this->m_context =
+			glfwCreateWindow(1, 1, "", nullptr, wd.get_glfw_window());
+		glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+		if (this->m_context == nullptr)
+		{
+			log_warn<"no shared context, shader reloads will compile on the "
+					 "main thread">();
+			return;
+		}
+		this->m_worker = std::jthread{
+			[this](const std::stop_token& stop) { this->work(stop); }};
+	}
+
+	// File names (relative to the watched directory) written since the last
+	// call
+	auto changed_files() -> std::set<std::string>
+	{
+		std::set<std::string> changed;
+		if (this->m_inotify < 0)
+		{
+			return changed;
+		}
+		alignas(inotify_event) std::array<char, 4096> buffer{};
+		while (true)
+		{
+			const auto length =
+				read(this->m_inotify, buffer.data(), buffer.size());
+			if (length <= 0)
+			{
+				break;
+			}
+			for (std::size_t offset = 0;
+				 offset < static_cast<std::size_t>(length);)
+			{
+				const auto* event =
+					reinterpret_cast<const inotify_event*>(&buffer.at(offset));
+				if (event->len > 0)
+				{
+					changed.emplace(event->name);
+				}
+				offset += sizeof(inotify_event) + event->len;
+			}
+		}
+		return changed;
+	}
+
+	error::result<> start_reload(const std::shared_ptr<shader>& target)
+	{
+		for (auto& pending : this->m_pending)
+		{
+			if (pending.target.lock() == target)
+			{
+				pending.superseded = true;
+			}
+		}
+		auto sources = target->preprocess();
+		if (!sources.has_value())
+		{
+			// A half written include, the next save will try again
+			log_warn<"{}\nkeeping the previous program">(
+				sources.error().format());
+			++this->m_failures;
+			return {};
+		}
+		pending_reload reload{.target = target, .sources = *std::move(sources)};
+		const auto& vertex = reload.sources.vertex.text;
+		const auto& fragment = reload.sources.fragment.text;
+		if (this->m_parallel || !this->m_worker.joinable())
+		{
+			reload.program = Try(shader::begin_link(vertex, fragment));
+		}
+		else
+		{
+			worker_job job{vertex, fragment, {}};
+			reload.compiled = job.promise.get_future();
+			{
+				const std::scoped_lock lock{this->m_jobs_mutex};
+				this->m_jobs.push_back(std::move(job));
+			}
+			this->m_jobs_ready.notify_one();
+		}
+		this->m_pending.push_back(std::move(reload));
+		return {};
+	}
+
+	// Returns whether the program is done, successful or not
+	error::result<bool> poll(pending_reload& reload)
+	{
+		using namespace std::chrono_literals;
+		if (reload.compiled.valid())
+		{
+			if (reload.compiled.wait_for(0s) != std::future_status::ready)
+			{
+				return false;
+			}
+			reload.program = reload.compiled.get();
+			return true;
+		}
+		if (this->m_parallel)
+		{
+			std::int32_t done = GL_FALSE;
+			Try(gl().call(glGetProgramiv,
+						  reload.program,
+						  completion_status_khr,
+						  &done));
+			return done == GL_TRUE;
+		}
+		return true;
+	}
+
+	error::result<> finish(pending_reload& reload)
+	{
+		auto target = reload.target.lock();
+		auto linked = shader::finish_link(reload.program);
+		if (!target || reload.superseded || !linked.has_value())
+		{
+			if (!linked.has_value() && !reload.superseded)
+			{
+				log_warn<"{}\nkeeping the previous program">(
+					linked.error().format());
+				++this->m_failures;
+			}
+			Try(gl().call(glDeleteProgram, reload.program));
+			return {};
+		}
+		Try(target->replace_program(reload.program, reload.sources));
+		if (Try(program_cache::is_supported()))
+		{
+			const auto key = Try(program_cache::key(
+				reload.sources.vertex.text, reload.sources.fragment.text));
+			Try(program_cache::store(key, reload.program));
+		}
+		++this->m_reloads;
+		log_info<"reloaded {} + {}">(target->get_vs_path(),
+									 target->get_fs_path());
+		return {};
+	}
+
+public:
+	explicit shader_reloader(window& wd, std::string directory = "shaders") :
+		m_directory{std::move(directory)}
+	{
+		this->m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (this->m_inotify >= 0)
+		{
+			// Editors that save through a temporary file show up as a move
+			this->m_watch = inotify_add_watch(this->m_inotify,
+											  this->m_directory.c_str(),
+											  IN_CLOSE_WRITE | IN_MOVED_TO);
+		}
+		if (this->m_inotify < 0 || this->m_watch < 0)
+		{
+			log_warn<"can't watch {}, hot reload is disabled">(
+				this->m_directory);
+		}
+
+		auto max_threads = reinterpret_cast<max_compiler_threads_function>(
+			glfwGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+		this->m_parallel =
+			glfwExtensionSupported("GL_KHR_parallel_shader_compile") ==
+				GLFW_TRUE &&
+			max_threads != nullptr;
+		if (this->m_parallel)
+		{
+			// Let the driver pick how many threads it wants
+			max_threads(0xFFFFFFFF);
+		}
+		else
+		{
+			this->start_worker(wd);
+		}
+	}
+	~shader_reloader()
+	{
+		if (this->m_worker.joinable())
+		{
+			this->m_worker.request_stop();
+			this->m_worker.join();
+		}
+		using namespace std::chrono_literals;
+		for (auto& reload : this->m_pending)
+		{
+			// Jobs the worker never got to have no program yet
+			if (reload.compiled.valid())
+			{
+				if (reload.compiled.wait_for(0s) != std::future_status::ready)
+				{
+					continue;
+				}
+				reload.program = reload.compiled.get();
+			}
+			gl().call(glDeleteProgram, reload.program);
+		}
+		if (this->m_context != nullptr)
+		{
+			glfwDestroyWindow(this->m_context);
+		}
+		if (this->m_inotify >= 0)
+		{
+			close(this->m_inotify);
+		}
+	}
+
+	void watch(const std::shared_ptr<shader>& target)
+	{
+		this->m_shaders.push_back(target);
+	}
+
+	// Called once per frame from the GL thread, never waits on a compile
+	error::result<> update()
+	{
+		std::erase_if(this->m_shaders,
+					  [](const auto& weak) { return weak.expired(); });
+		const auto changed = this->changed_files();
+		for (const auto& weak : this->m_shaders)
+		{
+			auto target = weak.lock();
+			if (std::ranges::any_of(changed, [&](const std::string& file) {
+					return target->depends_on(file);
+				}))
+			{
+				Try(this->start_reload(target));
+			}
+		}
+
+		for (auto iterator = this->m_pending.begin();
+			 iterator != this->m_pending.end();)
+		{
+			if (!Try(this->poll(*iterator)))
+			{
+				++iterator;
+				continue;
+			}
+			Try(this->finish(*iterator));
+			iterator = this->m_pending.erase(iterator);
+		}
+		return {};
+	}
+
+	[[nodiscard]] bool is_parallel() const
+	{
+		return this->m_parallel;
+	}
+	[[nodiscard]] std::size_t get_pending() const
+	{
+		return this->m_pending.size();
+	}
+	[[nodiscard]] std::uint64_t get_reloads() const
+	{
+		return this->m_reloads;
+	}
+	[[nodiscard]] std::uint64_t get_failures() const
+	{
+		return this->m_failures;
+	}
+
+	shader_reloader(const shader_reloader&) = delete;
+	shader_reloader(shader_reloader&&) = delete;
+	shader_reloader& operator=(const shader_reloader&) = delete;
+	shader_reloader& operator=(shader_reloader&&) = delete;
+};
+} // namespace moonstone::renderer
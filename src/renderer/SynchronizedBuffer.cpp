@@ -12,7 +12,9 @@ module;
 #include <array>
 #include <cstddef>
 #include <flat_map>
+#include <functional>
 #include <iterator>
+#include <memory_resource>
 #include <numeric>
 #include <tuple>
 #include <utility>
@@ -83,8 +85,11 @@ private:
 template <typename T, std::size_t N>
 class synchronized_buffer
 {
-	std::flat_map<std::size_t, std::array<T, N>> m_buffer{};
-	std::vector<moonstone::renderer::lock_status> m_locks;
+	std::flat_map<std::size_t, std::array<T, N>, std::less<std::size_t>,
+				  std::pmr::vector<std::size_t>,
+				  std::pmr::vector<std::array<T, N>>>
+		m_buffer;
+	std::pmr::vector<moonstone::renderer::lock_status> m_locks;
 	std::size_t m_last_key{0};
 	bool m_locked{false};
 
@@ -124,7 +129,12 @@ class synchronized_buffer
 	};
 
 public:
-	synchronized_buffer<T, N>() = default;
+	explicit synchronized_buffer(std::pmr::memory_resource* resource =
+									 std::pmr::get_default_resource()) :
+		m_buffer(std::pmr::polymorphic_allocator<>{resource}),
+		m_locks(resource)
+	{
+	}
 	buffer_connection<synchronized_buffer<T, N>, T, N> connect()
 	{
 		inner_buffer_scoped_lock lock(*this);
@@ -2,36 +2,59 @@ module;
 
 #include "Try.hpp"
 #include "glad/glad.h"
+#include <cstddef>
 #include <exception>
 #include <format>
-#include <print>
+#include <span>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 #include <stdexcept>
+#include <utility>
+#include <vector>
 
 export module moonstone:texture;
 
 import :utility;
 import :error;
+import :logging;
 import :call;
+import :stats;
+import :mipmap;
+import :residency;
 
 export namespace moonstone::renderer
 {
 class texture
 {
 	std::uint32_t m_renderer_id{};
-	unsigned char* m_local_buffer{};
 	std::string m_file_path;
-	std::int32_t m_width{}, m_height{}, m_pixel_size{};
+	std::int32_t m_width{}, m_height{};
+	mip_options m_options;
+	std::size_t m_bytes{0};
+	residency_manager* m_residency{nullptr};
+	residency_id m_residency_id{};
 
-	moonstone::error::result<> create()
+	error::result<> evict()
+	{
+		Try(gl().call(glDeleteTextures, 1, &this->m_renderer_id));
+		this->m_renderer_id = 0;
+		return {};
+	}
+
+	moonstone::error::result<> create(const std::vector<mip_level>& levels)
 	{
 		Try(gl().call(glGenTextures, 1, &this->m_renderer_id));
 		Try(gl().call(glBindTexture, GL_TEXTURE_2D, this->m_renderer_id));
-		Try(gl().call(
-			glTexParameteri, GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+		Try(gl().call(glTexParameteri,
+					  GL_TEXTURE_2D,
+					  GL_TEXTURE_MIN_FILTER,
+					  GL_LINEAR_MIPMAP_LINEAR));
 		Try(gl().call(
 			glTexParameteri, GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+		Try(gl().call(glTexParameteri,
+					  GL_TEXTURE_2D,
+					  GL_TEXTURE_MAX_LEVEL,
+					  static_cast<std::int32_t>(levels.size()) - 1));
 		Try(gl().call(glTexParameteri,
 					  GL_TEXTURE_2D,
 					  GL_TEXTURE_WRAP_S,
@@ -40,62 +63,145 @@ class texture
 					  GL_TEXTURE_2D,
 					  GL_TEXTURE_WRAP_T,
 					  GL_CLAMP_TO_EDGE));
-		Try(gl().call(glTexImage2D,
+		Try(gl().call(glTexStorage2D,
 					  GL_TEXTURE_2D,
-					  0,
+					  levels.size(),
 					  GL_RGBA8,
 					  this->m_width,
-					  this->m_height,
-					  0,
-					  GL_RGBA8,
-					  GL_UNSIGNED_BYTE,
-					  this->m_local_buffer));
+					  this->m_height));
+		for (std::size_t level = 0; level < levels.size(); ++level)
+		{
+			const auto& mip = levels[level];
+			Try(gl().call(glTexSubImage2D,
+						  GL_TEXTURE_2D,
+						  level,
+						  0,
+						  0,
+						  mip.width,
+						  mip.height,
+						  GL_RGBA,
+						  GL_UNSIGNED_BYTE,
+						  mip.texels.data()));
+			count(counter::bytes_uploaded, mip.texels.size() * sizeof(texel));
+		}
 		Try(texture::unbind());
 		return {};
 	}
 
 public:
-	explicit texture(const std::string& path) : m_file_path{path}
+	// Safe to call from worker threads, only touches stb and the CPU side
+	static auto decode_memory(std::span<const std::byte> bytes,
+							  const std::string& path, mip_options options)
+		-> std::vector<mip_level>
 	{
-		stbi_set_flip_vertically_on_load(1);
-		auto real_path = std::format("{}{}", "assets/", path);
+		stbi_set_flip_vertically_on_load_thread(1);
+		std::int32_t width{}, height{}, channels{};
+		unsigned char* buffer = stbi_load_from_memory(
+			reinterpret_cast<const stbi_uc*>(bytes.data()),
+			static_cast<std::int32_t>(bytes.size()),
+			&width,
+			&height,
+			&channels,
+			4);
+		if (buffer == nullptr)
+		{
+			throw std::runtime_error{
+				std::format("Failed to load texture file {}", path)};
+		}
 
-		m_local_buffer = stbi_load(real_path.c_str(),
-								   &this->m_width,
-								   &this->m_height,
-								   &this->m_pixel_size,
-								   4);
+		const auto texel_count = static_cast<std::size_t>(width) * height;
+		auto levels = build_mip_chain(
+			std::span<const texel>{reinterpret_cast<const texel*>(buffer),
+								   texel_count},
+			width,
+			height,
+			options);
+		stbi_image_free(buffer);
+		return levels;
+	}
+	static auto decode(const std::string& path, mip_options options)
+		-> std::vector<mip_level>
+	{
+		auto file = files().map(std::format("{}{}", "assets/", path));
+		if (!file.has_value())
+		{
+			throw std::runtime_error{file.error().format()};
+		}
+		return texture::decode_memory(file->bytes(), path, options);
+	}
 
-		auto err = this->create();
-		if (!err.has_value())
+	explicit texture(const std::string& path, mip_options options = {}) :
+		texture(path, texture::decode(path, options), options)
+	{
+	}
+	// Takes an already decoded chain, see asset_cache
+	texture(std::string path, const std::vector<mip_level>& levels,
+			mip_options options) :
+		m_file_path{std::move(path)},
+		m_width{static_cast<std::int32_t>(levels.front().width)},
+		m_height{static_cast<std::int32_t>(levels.front().height)},
+		m_options{options}
+	{
+		for (const auto& level : levels)
 		{
-			throw std::runtime_error(err.error().format());
+			this->m_bytes += level.texels.size() * sizeof(texel);
 		}
 
-		if (m_local_buffer != nullptr)
+		auto err = this->create(levels);
+		if (!err.has_value())
 		{
-			stbi_image_free(m_local_buffer);
+			throw std::runtime_error(err.error().format());
 		}
 	}
 	~texture()
 #ifdef _DEBUG
 	{
+		if (this->m_residency != nullptr)
+		{
+			this->m_residency->remove(this->m_residency_id);
+		}
 		auto err = gl().call(glDeleteTextures, 1, &this->m_renderer_id);
 		if (!err.has_value())
 		{
-			std::println(stderr, "{}", err.error().format());
+			log_error<"{}">(err.error().format());
+			flush_logs();
 			std::terminate();
 		}
 	}
 #else
 	{
+		if (this->m_residency != nullptr)
+		{
+			this->m_residency->remove(this->m_residency_id);
+		}
 		gl().call(glDeleteTextures, 1, &this->m_renderer_id);
 	}
 #endif
+	void attach(residency_manager& residency)
+	{
+		this->m_residency = &residency;
+		residency_callbacks callbacks{
+			.evict = [this]() { return this->evict(); },
+			.reload = [this,
+					   path = this->m_file_path,
+					   options = this->m_options]()
+				-> residency_callbacks::upload_function {
+				return [this, levels = texture::decode(path, options)]() {
+					return this->create(levels);
+				};
+			}};
+		this->m_residency_id = residency.add(this->m_bytes, 1, callbacks);
+	}
+	// Binds texture 0 while an evicted texture is being reloaded
 	[[nodiscard]] error::result<> bind(std::uint32_t slot = 0) const
 	{
+		if (this->m_residency != nullptr)
+		{
+			this->m_residency->touch(this->m_residency_id);
+		}
 		Try(gl().call(glActiveTexture, GL_TEXTURE0 + slot));
 		Try(gl().call(glBindTexture, GL_TEXTURE_2D, this->m_renderer_id));
+		count(counter::texture_binds);
 		return {};
 	}
 	static error::result<> unbind()
@@ -112,5 +218,9 @@ public:
 	{
 		return this->m_height;
 	}
+	texture(const texture&) = delete;
+	texture(texture&&) = delete;
+	texture& operator=(const texture&) = delete;
+	texture& operator=(texture&&) = delete;
 };
 } // namespace moonstone::renderer
@@ -3,75 +3,102 @@ module;
 #include "Try.hpp"
 #include <cstddef>
 #include <cstdint>
+#include <format>
 #include <glad/glad.h>
 #include <initializer_list>
-#include <print>
 #include <ranges>
 #include <span>
 #include <stb_image.h>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
 
 export module moonstone:texture_array;
 
 import :call;
+import :stats;
 import :error;
-
-namespace moonstone::renderer
-{
-struct texel
-{
-	std::byte r;
-	std::byte g;
-	std::byte b;
-	std::byte a;
-} __attribute__((aligned(4), packed));
-} // namespace moonstone::renderer
+import :logging;
+import :file_system;
+import :mipmap;
+import :residency;
 
 export namespace moonstone::renderer
 {
 template <std::size_t W, std::size_t H>
 class texture_array
 {
+public:
+	using layer_chains = std::vector<std::vector<mip_level>>;
+
+private:
 	static constexpr std::int32_t s_pixel_size = 4;
 	std::uint32_t m_renderer_id{};
-	std::vector<std::array<texel, W * H>> m_image_buffers{};
+	std::vector<std::string> m_paths;
+	mip_options m_options;
+	std::size_t m_bytes{0};
+	residency_manager* m_residency{nullptr};
+	residency_id m_residency_id{};
+
+	error::result<> evict()
+	{
+		Try(gl().call(glDeleteTextures, 1, &this->m_renderer_id));
+		this->m_renderer_id = 0;
+		return {};
+	}
 
-	error::result<> create(std::size_t size)
+	error::result<> create(const layer_chains& layers)
 	{
 		Try(gl().call(glActiveTexture, GL_TEXTURE0));
 		Try(gl().call(glGenTextures, 1, &this->m_renderer_id));
-		Try(gl().call(glGenTextures, 1, &this->m_renderer_id));
 		Try(gl().call(glBindTexture, GL_TEXTURE_2D_ARRAY, this->m_renderer_id));
-		// Allocate the storage.
-		Try(gl().call(
-			glTexStorage3D, GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, W, H, size));
-		// Upload pixel data.
-		// The first 0 refers to the mipmap level (level 0, since there's only
-		// 1) The following 2 zeroes refers to the x and y offsets in case you
-		// only want to specify a subrectangle. The final 0 refers to the layer
-		// index offset (we start from index 0 and have 2 levels). Altogether
-		// you can specify a 3D box subset of the overall texture, but only one
-		// mip level at a time.
-		Try(gl().call(glTexSubImage3D,
+		const auto levels = static_cast<std::int32_t>(
+			layers.empty() ? 1 : layers.front().size());
+		// Allocate the storage for every mip level.
+		Try(gl().call(glTexStorage3D,
 					  GL_TEXTURE_2D_ARRAY,
-					  0,
-					  0,
-					  0,
-					  0,
+					  levels,
+					  GL_RGBA8,
 					  W,
 					  H,
-					  size,
-					  GL_RGBA,
-					  GL_UNSIGNED_BYTE,
-					  this->m_image_buffers.data()));
+					  layers.size()));
+		// Upload pixel data, one layer of one mip level at a time since the
+		// chains are stored per layer.
+		for (std::int32_t level = 0; level < levels; ++level)
+		{
+			for (std::size_t layer = 0; layer < layers.size(); ++layer)
+			{
+				const auto& mip = layers[layer][level];
+				Try(gl().call(glTexSubImage3D,
+							  GL_TEXTURE_2D_ARRAY,
+							  level,
+							  0,
+							  0,
+							  layer,
+							  mip.width,
+							  mip.height,
+							  1,
+							  GL_RGBA,
+							  GL_UNSIGNED_BYTE,
+							  mip.texels.data()));
+				count(counter::bytes_uploaded,
+					  mip.texels.size() * sizeof(texel));
+			}
+		}
 		// Always set reasonable texture parameters
 		Try(gl().call(glTexParameteri,
 					  GL_TEXTURE_2D_ARRAY,
 					  GL_TEXTURE_MIN_FILTER,
-					  GL_LINEAR));
+					  GL_LINEAR_MIPMAP_LINEAR));
 		Try(gl().call(glTexParameteri,
 					  GL_TEXTURE_2D_ARRAY,
 					  GL_TEXTURE_MAG_FILTER,
 					  GL_LINEAR));
+		Try(gl().call(glTexParameteri,
+					  GL_TEXTURE_2D_ARRAY,
+					  GL_TEXTURE_MAX_LEVEL,
+					  levels - 1));
 		Try(gl().call(glTexParameteri,
 					  GL_TEXTURE_2D_ARRAY,
 					  GL_TEXTURE_WRAP_S,
@@ -80,26 +107,58 @@ class texture_array
 					  GL_TEXTURE_2D_ARRAY,
 					  GL_TEXTURE_WRAP_T,
 					  GL_CLAMP_TO_EDGE));
-		Try(gl().call(glGenerateMipmap, GL_TEXTURE_2D_ARRAY));
 		return {};
 	}
 
 public:
-	texture_array(std::initializer_list<const char*> texture_paths =
-					  std::initializer_list<const char*>{}) :
-		m_image_buffers(texture_paths.size())
+	// Every layer's file in one file_system::read_batch, so with io_uring
+	// they are all read with a single submit
+	static std::vector<file_buffer> read_layers(
+		const std::vector<std::string>& paths)
 	{
+		std::vector<std::string> virtual_paths;
+		virtual_paths.reserve(paths.size());
+		for (const auto& texture_path : paths)
+		{
+			virtual_paths.push_back("assets/" + texture_path);
+		}
+		std::vector<file_buffer> contents;
+		contents.reserve(paths.size());
+		for (auto& read : files().read_batch(virtual_paths))
+		{
+			auto content = read.get();
+			if (!content.has_value())
+			{
+				throw std::runtime_error{content.error().format()};
+			}
+			contents.push_back(*std::move(content));
+		}
+		return contents;
+	}
+
+	// Safe to call from worker threads, only touches stb and the CPU side.
+	// `contents` holds the files read_layers returned for `paths`.
+	static layer_chains decode(std::span<const file_buffer> contents,
+							   const std::vector<std::string>& paths,
+							   mip_options options)
+	{
+		layer_chains layers;
+		layers.reserve(paths.size());
 		stbi_set_flip_vertically_on_load_thread(1);
-		for (const auto& [texture_path, element] :
-			 std::views::zip(texture_paths, this->m_image_buffers))
+		for (std::size_t i = 0; i < paths.size(); ++i)
 		{
-			std::string path{"assets/"};
-			path.append(texture_path);
+			const auto& texture_path = paths[i];
+			const auto& file = contents[i];
 			int width = 0;
 			int height = 0;
 			int channels = 0;
-			stbi_uc* texels = stbi_load(
-				path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+			stbi_uc* texels = stbi_load_from_memory(
+				reinterpret_cast<const stbi_uc*>(file.data()),
+				static_cast<int>(file.size()),
+				&width,
+				&height,
+				&channels,
+				STBI_rgb_alpha);
 			/*
 			ASSERT(width == W)
 			ASSERT(height == H)
@@ -110,36 +169,144 @@ public:
 				throw std::runtime_error{std::format(
 					"Failed to load texture file {}", texture_path)};
 			}
-			std::span<texel, (W * H)> texels_span{
-				reinterpret_cast<texel*>(texels), W * H};
-			std::copy(texels_span.begin(), texels_span.end(), element.begin());
+			std::span<const texel, (W * H)> texels_span{
+				reinterpret_cast<const texel*>(texels), W * H};
+			// The mip chain is built on worker threads and the decoded
+			// image isn't kept around once the chain exists
+			layers.push_back(build_mip_chain(texels_span, W, H, options));
 			stbi_image_free(static_cast<void*>(texels));
-			auto err = this->create(texture_paths.size());
-			if (!err.has_value())
+		}
+		return layers;
+	}
+
+	static layer_chains decode(const std::vector<std::string>& paths,
+							   mip_options options)
+	{
+		return decode(read_layers(paths), paths, options);
+	}
+
+	texture_array(std::initializer_list<const char*> texture_paths =
+					  std::initializer_list<const char*>{},
+				  mip_options options = {}) :
+		texture_array(std::vector<std::string>(texture_paths.begin(),
+											   texture_paths.end()),
+					  options)
+	{
+	}
+	explicit texture_array(const std::vector<std::string>& texture_paths,
+						   mip_options options = {}) :
+		texture_array(texture_paths,
+					  texture_array::decode(texture_paths, options),
+					  options)
+	{
+	}
+	// Takes layers that were already decoded, see asset_cache
+	texture_array(std::vector<std::string> texture_paths,
+				  const layer_chains& layers, mip_options options) :
+		m_paths(std::move(texture_paths)),
+		m_options{options}
+	{
+		for (const auto& chain : layers)
+		{
+			for (const auto& level : chain)
 			{
-				throw std::runtime_error(err.error().format().c_str());
+				this->m_bytes += level.texels.size() * sizeof(texel);
 			}
 		}
+		auto err = this->create(layers);
+		if (!err.has_value())
+		{
+			throw std::runtime_error(err.error().format().c_str());
+		}
 	}
 	~texture_array()
 #ifdef _DEBUG
 	{
+		if (this->m_residency != nullptr)
+		{
+			this->m_residency->remove(this->m_residency_id);
+		}
 		auto err = gl().call(glDeleteTextures, 1, &this->m_renderer_id);
 		if (!err.has_value())
 		{
-			std::println("{}", err.error().format());
+			log_error<"{}">(err.error().format());
+			flush_logs();
 			__builtin_trap();
 		}
 	}
 #else
 	{
+		if (this->m_residency != nullptr)
+		{
+			this->m_residency->remove(this->m_residency_id);
+		}
 		gl().call(glDeleteTextures, 1, &this->m_renderer_id);
 	}
 #endif
+	// Lets the manager evict the whole array when it goes cold, layers are
+	// tracked individually through mark_layer_used for monitoring.
+	void attach(residency_manager& residency)
+	{
+		this->m_residency = &residency;
+		residency_callbacks callbacks{
+			.evict = [this]() { return this->evict(); },
+			.reload = [this, paths = this->m_paths, options = this->m_options]()
+				-> residency_callbacks::upload_function {
+				auto layers = texture_array::decode(paths, options);
+				return [this, layers = std::move(layers)]() {
+					return this->create(layers);
+				};
+			}};
+		this->m_residency_id =
+			residency.add(this->m_bytes, this->m_paths.size(), callbacks);
+	}
+	[[nodiscard]] const std::vector<std::string>& get_paths() const
+	{
+		return this->m_paths;
+	}
+	void mark_layer_used(std::size_t layer) const
+	{
+		if (this->m_residency != nullptr)
+		{
+			this->m_residency->touch(this->m_residency_id, layer);
+		}
+	}
+	// Overwrites a rectangle of the base level of one layer, for atlases
+	// filled at runtime. Smaller levels aren't rebuilt, so those arrays
+	// should be made with a single level. Rows go bottom to top like the
+	// decoded images.
+	error::result<> write_region(std::size_t layer, std::uint32_t x,
+								 std::uint32_t y, std::uint32_t width,
+								 std::uint32_t height,
+								 std::span<const texel> texels)
+	{
+		Try(gl().call(glActiveTexture, GL_TEXTURE0));
+		Try(gl().call(glBindTexture, GL_TEXTURE_2D_ARRAY, this->m_renderer_id));
+		Try(gl().call(glTexSubImage3D,
+					  GL_TEXTURE_2D_ARRAY,
+					  0,
+					  x,
+					  y,
+					  layer,
+					  width,
+					  height,
+					  1,
+					  GL_RGBA,
+					  GL_UNSIGNED_BYTE,
+					  texels.data()));
+		count(counter::bytes_uploaded, texels.size_bytes());
+		return {};
+	}
+	// Binds texture 0 while an evicted array is being reloaded
 	[[nodiscard]] error::result<> bind(std::uint32_t slot = 1) const
 	{
+		if (this->m_residency != nullptr)
+		{
+			this->m_residency->touch(this->m_residency_id);
+		}
 		Try(gl().call(glActiveTexture, GL_TEXTURE0 + slot));
 		Try(gl().call(glBindTexture, GL_TEXTURE_2D_ARRAY, this->m_renderer_id));
+		count(counter::texture_binds);
 		return {};
 	}
 	static error::result<> unbind()
@@ -0,0 +1,280 @@
+module;
+
+#include "Try.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <expected>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <stdexcept>
+#include <utility>
+
+export module moonstone:uniform_buffer;
+
+import :error;
+import :logging;
+import :call;
+import :stats;
+
+export namespace moonstone::renderer
+{
+// Binding points shared by every program, shaders declare the blocks with
+// `layout(std140, binding = N)` so nothing has to be set per program.
+enum class uniform_binding : std::uint32_t
+{
+	frame = 0,
+	draw = 1
+};
+
+// std140, keep it in sync with shaders/frame_globals.glsl
+struct frame_globals
+{
+	glm::mat4 view{1.0F};
+	glm::mat4 projection{1.0F};
+	glm::mat4 view_projection{1.0F};
+	// x, y, width, height
+	glm::vec4 viewport{};
+	// seconds, delta seconds, frame number
+	glm::vec4 time{};
+};
+static_assert(sizeof(frame_globals) == 224);
+
+template <typename T>
+class uniform_buffer
+{
+	static_assert(sizeof(T) % 16 == 0, "std140 blocks are padded to vec4");
+	std::uint32_t m_renderer_id{};
+	std::uint32_t m_binding;
+	T m_value{};
+	bool m_uploaded{false};
+
+	error::result<> create()
+	{
+		Try(gl().call(glGenBuffers, 1, &this->m_renderer_id));
+		Try(gl().call(glBindBuffer, GL_UNIFORM_BUFFER, this->m_renderer_id));
+		Try(gl().call(glBufferData,
+					  GL_UNIFORM_BUFFER,
+					  sizeof(T),
+					  nullptr,
+					  GL_DYNAMIC_DRAW));
+		Try(this->bind());
+		return {};
+	}
+
+public:
+	explicit uniform_buffer(uniform_binding binding) :
+		m_binding{std::to_underlying(binding)}
+	{
+		auto res = this->create();
+		if (!res.has_value())
+		{
+			throw std::runtime_error(res.error().format());
+		}
+	}
+	~uniform_buffer()
+#ifdef _DEBUG
+	{
+		auto res = gl().call(glDeleteBuffers, 1, &this->m_renderer_id);
+		if (!res.has_value())
+		{
+			log_error<"{}">(res.error().format());
+			flush_logs();
+			std::terminate();
+		}
+	}
+#else
+	{
+		gl().call(glDeleteBuffers, 1, &this->m_renderer_id);
+	}
+#endif
+
+	// Only uploads when the contents actually changed
+	error::result<> update(const T& value)
+	{
+		if (this->m_uploaded &&
+			std::memcmp(&this->m_value, &value, sizeof(T)) == 0)
+		{
+			return {};
+		}
+		this->m_value = value;
+		this->m_uploaded = true;
+		Try(gl().call(glBindBuffer, GL_UNIFORM_BUFFER, this->m_renderer_id));
+		Try(gl().call(
+			glBufferSubData, GL_UNIFORM_BUFFER, 0, sizeof(T), &this->m_value));
+		count(counter::bytes_uploaded, sizeof(T));
+		return {};
+	}
+
+	[[nodiscard]] error::result<> bind() const
+	{
+		Try(gl().call(glBindBufferBase,
+					  GL_UNIFORM_BUFFER,
+					  this->m_binding,
+					  this->m_renderer_id));
+		return {};
+	}
+
+	[[nodiscard]] const T& get() const
+	{
+		return this->m_value;
+	}
+
+	uniform_buffer(const uniform_buffer&) = delete;
+	uniform_buffer(uniform_buffer&&) = delete;
+	uniform_buffer& operator=(const uniform_buffer&) = delete;
+	uniform_buffer& operator=(uniform_buffer&&) = delete;
+};
+
+// Per draw blocks are written into a persistently mapped buffer split in one
+// segment per frame in flight, a fence guards each segment so the CPU never
+// overwrites data the GPU hasn't consumed yet.
+class uniform_ring
+{
+	static constexpr std::size_t s_frames_in_flight = 3;
+	std::uint32_t m_renderer_id{};
+	std::size_t m_segment_size;
+	std::size_t m_alignment{256};
+	std::byte* m_mapped{nullptr};
+	std::size_t m_segment{0};
+	std::size_t m_offset{0};
+	std::array<GLsync, s_frames_in_flight> m_fences{};
+
+	error::result<> create()
+	{
+		std::int32_t alignment = 0;
+		Try(gl().call(
+			glGetIntegerv, GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment));
+		this->m_alignment = static_cast<std::size_t>(alignment);
+		this->m_segment_size = (this->m_segment_size + this->m_alignment - 1) /
+							   this->m_alignment * this->m_alignment;
+		const auto size = this->m_segment_size * s_frames_in_flight;
+		constexpr GLbitfield flags =
+			GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		Try(gl().call(glGenBuffers, 1, &this->m_renderer_id));
+		Try(gl().call(glBindBuffer, GL_UNIFORM_BUFFER, this->m_renderer_id));
+		Try(gl().call(
+			glBufferStorage, GL_UNIFORM_BUFFER, size, nullptr, flags));
+		this->m_mapped = static_cast<std::byte*>(
+			Try(gl().call_returning<void*>(
+				glMapBufferRange, GL_UNIFORM_BUFFER, 0, size, flags)));
+		return {};
+	}
+
+	error::result<> destroy()
+	{
+		for (auto& fence : this->m_fences)
+		{
+			if (fence != nullptr)
+			{
+				Try(gl().call(glDeleteSync, fence));
+				fence = nullptr;
+			}
+		}
+		Try(gl().call(glBindBuffer, GL_UNIFORM_BUFFER, this->m_renderer_id));
+		Try(gl().call_returning<GLboolean>(glUnmapBuffer, GL_UNIFORM_BUFFER));
+		Try(gl().call(glDeleteBuffers, 1, &this->m_renderer_id));
+		return {};
+	}
+
+public:
+	explicit uniform_ring(std::size_t segment_size = 64UZ * 1024) :
+		m_segment_size{segment_size}
+	{
+		auto res = this->create();
+		if (!res.has_value())
+		{
+			throw std::runtime_error(res.error().format());
+		}
+	}
+	~uniform_ring()
+	{
+		auto res = this->destroy();
+		if (!res.has_value())
+		{
+			log_error<"{}">(res.error().format());
+		}
+	}
+
+	// Waits (rarely) for the GPU to be done with the segment we're about to
+	// reuse
+	error::result<> begin_frame()
+	{
+		auto& fence = this->m_fences.at(this->m_segment);
+		if (fence != nullptr)
+		{
+			constexpr std::uint64_t timeout = 1'000'000'000;
+			// Only the first wait has to flush, the fence is on its way to
+			// the GPU after that
+			GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+			GLenum status = GL_TIMEOUT_EXPIRED;
+			while (status == GL_TIMEOUT_EXPIRED)
+			{
+				status = Try(gl().call_returning<GLenum>(
+					glClientWaitSync, fence, flags, timeout));
+				flags = 0;
+			}
+			if (status == GL_WAIT_FAILED)
+			{
+				return std::unexpected(error::gl_error{
+					"APPLICATION",
+					{},
+					"ERROR",
+					0,
+					"HIGH",
+					"waiting for the GPU to release a uniform ring segment "
+					"failed"});
+			}
+			Try(gl().call(glDeleteSync, fence));
+			fence = nullptr;
+		}
+		this->m_offset = 0;
+		return {};
+	}
+
+	error::result<> end_frame()
+	{
+		this->m_fences.at(this->m_segment) = Try(gl().call_returning<GLsync>(
+			glFenceSync, GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+		this->m_segment = (this->m_segment + 1) % s_frames_in_flight;
+		return {};
+	}
+
+	// Copies the block into this frame's segment and binds that range
+	template <typename T>
+	error::result<> push(const T& block, uniform_binding binding)
+	{
+		static_assert(sizeof(T) % 16 == 0, "std140 blocks are padded to vec4");
+		if (this->m_offset + sizeof(T) > this->m_segment_size)
+		{
+			return std::unexpected(error::gl_error{
+				"APPLICATION",
+				{},
+				"ERROR",
+				0,
+				"HIGH",
+				"uniform ring segment is full, raise its size"});
+		}
+		const auto offset =
+			(this->m_segment * this->m_segment_size) + this->m_offset;
+		std::memcpy(this->m_mapped + offset, &block, sizeof(T));
+		count(counter::bytes_uploaded, sizeof(T));
+		Try(gl().call(glBindBufferRange,
+					  GL_UNIFORM_BUFFER,
+					  std::to_underlying(binding),
+					  this->m_renderer_id,
+					  offset,
+					  sizeof(T)));
+		this->m_offset += (sizeof(T) + this->m_alignment - 1) /
+						  this->m_alignment * this->m_alignment;
+		return {};
+	}
+
+	uniform_ring(const uniform_ring&) = delete;
+	uniform_ring(uniform_ring&&) = delete;
+	uniform_ring& operator=(const uniform_ring&) = delete;
+	uniform_ring& operator=(uniform_ring&&) = delete;
+};
+} // namespace moonstone::renderer
@@ -4,7 +4,6 @@ module;
 #include "glad/glad.h"
 #include <cstdint>
 #include <exception>
-#include <print>
 #include <stdexcept>
 
 export module moonstone:vertex_array;
@@ -12,6 +11,7 @@ export module moonstone:vertex_array;
 import :vertex_buffer;
 import :buffer_layout;
 import :error;
+import :logging;
 import :call;
 
 export namespace moonstone::renderer
@@ -36,7 +36,8 @@ public:
 		auto res = gl().call(glDeleteVertexArrays, 1, &this->m_renderer_id);
 		if (!res.has_value())
 		{
-			std::println(stderr, "{}", res.error().format());
+			log_error<"{}">(res.error().format());
+			flush_logs();
 			std::terminate();
 		}
 	}
@@ -45,9 +46,14 @@ public:
 		gl().call(glDeteglDeleteVertexArrays, 1, &this->m_renderer_id);
 	}
 #endif
-	template <typename T, std::size_t N>
-	[[nodiscard]] error::result<> add_buffer(const vertex_buffer<T, N>& vb,
-											 const buffer_layout& bl) const
+	// Any array buffer with a bind(), vertex_buffer or batch_buffer. The
+	// layout's attributes start at `first_location`, a non zero `divisor`
+	// makes them step once per that many instances instead of per vertex.
+	template <typename Buffer>
+	[[nodiscard]] error::result<> add_buffer(const Buffer& vb,
+											 const buffer_layout& bl,
+											 std::uint32_t first_location = 0,
+											 std::uint32_t divisor = 0) const
 	{
 		Try(this->bind());
 		Try(vb.bind());
@@ -59,14 +65,19 @@ public:
 			const auto& element = elements[i];
 			const auto stride = bl.get_stride();
 			const auto size = element.count;
-			Try(gl().call(glEnableVertexAttribArray, i));
+			const auto location = first_location + i;
+			Try(gl().call(glEnableVertexAttribArray, location));
 			Try(gl().call(glVertexAttribPointer,
-						  i,
+						  location,
 						  size,
 						  element.type,
 						  (element.normalized ? GL_TRUE : GL_FALSE),
 						  stride,
 						  reinterpret_cast<const void*>(offset)));
+			if (divisor != 0)
+			{
+				Try(gl().call(glVertexAttribDivisor, location, divisor));
+			}
 			offset += static_cast<std::uintptr_t>(element.count) *
 					  buffer_element::get_size_of_type(element.type);
 		}
@@ -1,10 +1,13 @@
 module;
 
 #include "Try.hpp"
+#include <algorithm>
 #include <cstdint>
 #include <exception>
+#include <expected>
 #include <glad/glad.h>
-#include <print>
+#include <memory_resource>
+#include <span>
 #include <stdexcept>
 
 export module moonstone:vertex_buffer;
@@ -13,6 +16,9 @@ import :vertex_element;
 import :call;
 import :error;
 import :sync_buffer;
+import :logging;
+import :stats;
+import :memory_tracking;
 
 export namespace moonstone::renderer
 {
@@ -32,7 +38,10 @@ class vertex_buffer
 	}
 
 public:
-	vertex_buffer()
+	// The resource backs the CPU copy of the vertices
+	explicit vertex_buffer(std::pmr::memory_resource* resource =
+							   std::pmr::get_default_resource()) :
+		m_buffer(resource)
 	{
 		auto res = this->create();
 		if (!res.has_value())
@@ -46,7 +55,8 @@ public:
 		auto res = gl().call(glDeleteBuffers, 1, &this->m_renderer_id);
 		if (!res.has_value())
 		{
-			std::println(stderr, "{}", res.error().format());
+			log_error<"{}">(res.error().format());
+			flush_logs();
 			std::terminate();
 		}
 	}
@@ -57,6 +67,7 @@ public:
 #endif
 	buffer_connection<synchronized_buffer<T, N>, T, N> connect()
 	{
+		const memory_scope scope{memory_tag::buffers};
 		auto connection = this->m_buffer.connect();
 		return connection;
 	}
@@ -68,7 +79,7 @@ public:
 		}
 		catch (const std::out_of_range& e)
 		{
-			std::println("Oops! called key: {}", key);
+			log_warn<"Oops! called key: {}">(key);
 		}
 	}
 	error::result<> update()
@@ -89,6 +100,7 @@ public:
 		{
 			Try(gl().call(glBufferSubData, GL_ARRAY_BUFFER, 0, size, data));
 		}
+		count(counter::bytes_uploaded, size);
 		return {};
 	}
 	[[nodiscard]] error::result<> bind() const
@@ -106,4 +118,214 @@ public:
 	vertex_buffer& operator=(const vertex_buffer&) = delete;
 	vertex_buffer& operator=(vertex_buffer&&) = delete;
 };
+
+// Refilled from contiguous memory every frame, for batches built by systems
+// rather than through per object connections
+template <typename T>
+class batch_buffer
+{
+	std::uint32_t m_renderer_id{};
+	std::size_t m_capacity{0};
+	bool m_mapped{false};
+
+	// Grows the capacity if needed and gives the buffer fresh storage
+	error::result<> orphan(std::size_t size)
+	{
+		Try(this->bind());
+		if (size > this->m_capacity)
+		{
+			this->m_capacity = std::max(size, this->m_capacity * 2);
+		}
+		Try(gl().call(glBufferData,
+					  GL_ARRAY_BUFFER,
+					  this->m_capacity,
+					  nullptr,
+					  GL_STREAM_DRAW));
+		return {};
+	}
+
+public:
+	batch_buffer()
+	{
+		auto res = gl().call(glGenBuffers, 1, &this->m_renderer_id);
+		if (!res.has_value())
+		{
+			throw std::runtime_error(res.error().format().c_str());
+		}
+	}
+	~batch_buffer()
+#ifdef _DEBUG
+	{
+		auto res = gl().call(glDeleteBuffers, 1, &this->m_renderer_id);
+		if (!res.has_value())
+		{
+			log_error<"{}">(res.error().format());
+			flush_logs();
+			std::terminate();
+		}
+	}
+#else
+	{
+		gl().call(glDeleteBuffers, 1, &this->m_renderer_id);
+	}
+#endif
+	// Orphans the old storage first so the driver doesn't wait on draws
+	// that still read last frame's data
+	error::result<> upload(std::span<const T> data)
+	{
+		const auto size = data.size_bytes();
+		Try(this->orphan(size));
+		if (size != 0)
+		{
+			Try(gl().call(
+				glBufferSubData, GL_ARRAY_BUFFER, 0, size, data.data()));
+		}
+		count(counter::bytes_uploaded, size);
+		return {};
+	}
+	// Same orphaning, but hands out the new storage so it can be filled in
+	// place without a CPU copy, from any thread. Only the GL thread may
+	// call unmap(), which has to happen before drawing from the buffer.
+	auto map(std::size_t elements) -> error::result<std::span<T>>
+	{
+		const auto size = elements * sizeof(T);
+		Try(this->orphan(size));
+		if (size == 0)
+		{
+			return std::span<T>{};
+		}
+		constexpr GLbitfield flags =
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+		auto* mapped = Try(gl().call_returning<void*>(
+			glMapBufferRange, GL_ARRAY_BUFFER, 0, size, flags));
+		this->m_mapped = true;
+		count(counter::bytes_uploaded, size);
+		return std::span<T>{static_cast<T*>(mapped), elements};
+	}
+	error::result<> unmap()
+	{
+		if (!this->m_mapped)
+		{
+			return {};
+		}
+		this->m_mapped = false;
+		Try(this->bind());
+		const auto intact = Try(
+			gl().call_returning<GLboolean>(glUnmapBuffer, GL_ARRAY_BUFFER));
+		if (intact == GL_FALSE)
+		{
+			// The storage was lost while mapped, the next map refills it
+			log_warn<"batch_buffer {} contents were lost while mapped">(
+				this->m_renderer_id);
+		}
+		return {};
+	}
+	[[nodiscard]] error::result<> bind() const
+	{
+		Try(gl().call(glBindBuffer, GL_ARRAY_BUFFER, this->m_renderer_id));
+		return {};
+	}
+	static error::result<> unbind()
+	{
+		Try(gl().call(glBindBuffer, GL_ARRAY_BUFFER, 0));
+		return {};
+	}
+	batch_buffer(const batch_buffer&) = delete;
+	batch_buffer(batch_buffer&&) = delete;
+	batch_buffer& operator=(const batch_buffer&) = delete;
+	batch_buffer& operator=(batch_buffer&&) = delete;
+};
+
+// Sized once from its first contents and edited in place afterwards, for
+// meshes that rarely change like tilemap chunks
+template <typename T>
+class static_buffer
+{
+	std::uint32_t m_renderer_id{};
+	std::size_t m_size{0};
+
+	error::result<> create(std::span<const T> data)
+	{
+		Try(gl().call(glGenBuffers, 1, &this->m_renderer_id));
+		Try(this->bind());
+		Try(gl().call(glBufferData,
+					  GL_ARRAY_BUFFER,
+					  data.size_bytes(),
+					  data.data(),
+					  GL_STATIC_DRAW));
+		count(counter::bytes_uploaded, data.size_bytes());
+		return {};
+	}
+
+public:
+	explicit static_buffer(std::span<const T> data) : m_size{data.size()}
+	{
+		auto res = this->create(data);
+		if (!res.has_value())
+		{
+			throw std::runtime_error(res.error().format().c_str());
+		}
+	}
+	~static_buffer()
+#ifdef _DEBUG
+	{
+		auto res = gl().call(glDeleteBuffers, 1, &this->m_renderer_id);
+		if (!res.has_value())
+		{
+			log_error<"{}">(res.error().format());
+			flush_logs();
+			std::terminate();
+		}
+	}
+#else
+	{
+		gl().call(glDeleteBuffers, 1, &this->m_renderer_id);
+	}
+#endif
+
+	// Overwrites the elements from `first` on, the rest stays as it was
+	error::result<> update(std::size_t first, std::span<const T> data)
+	{
+		if (first + data.size() > this->m_size)
+		{
+			return std::unexpected(error::gl_error{
+				"APPLICATION",
+				{},
+				"ERROR",
+				0,
+				"HIGH",
+				"static_buffer update past the end of the buffer"});
+		}
+		Try(this->bind());
+		Try(gl().call(glBufferSubData,
+					  GL_ARRAY_BUFFER,
+					  first * sizeof(T),
+					  data.size_bytes(),
+					  data.data()));
+		count(counter::bytes_uploaded, data.size_bytes());
+		return {};
+	}
+
+	[[nodiscard]] std::size_t size() const
+	{
+		return this->m_size;
+	}
+
+	[[nodiscard]] error::result<> bind() const
+	{
+		Try(gl().call(glBindBuffer, GL_ARRAY_BUFFER, this->m_renderer_id));
+		return {};
+	}
+
+	static error::result<> unbind()
+	{
+		Try(gl().call(glBindBuffer, GL_ARRAY_BUFFER, 0));
+		return {};
+	}
+
+	static_buffer(const static_buffer&) = delete;
+	static_buffer(static_buffer&&) = delete;
+	static_buffer& operator=(const static_buffer&) = delete;
+	static_buffer& operator=(static_buffer&&) = delete;
+};
 } // namespace moonstone::renderer
@@ -0,0 +1,205 @@
+// Measures how the job system scales from one thread up to every core:
+//   job_bench [--max-threads N] [--repeats N] [--csv <path>]
+// Each workload runs on a fresh job_system with 1..N threads, the best of
+// the repeats is reported together with the speedup over one thread.
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <print>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+import moonstone;
+
+namespace
+{
+template <typename T>
+bool parse_number(std::string_view text, T& value)
+{
+	const auto [end, error] =
+		std::from_chars(text.data(), text.data() + text.size(), value);
+	return error == std::errc{} && end == text.data() + text.size();
+}
+
+struct workload
+{
+	std::string_view name;
+	std::function<void(moonstone::job_system&)> run;
+};
+
+// Large pieces of arithmetic, close to ideal scaling
+void compute(moonstone::job_system& scheduler)
+{
+	static std::vector<float> values(1UZ << 22);
+	scheduler.parallel_for(
+		0, values.size(), 16384, [](std::size_t begin, std::size_t end) {
+			for (auto i = begin; i < end; ++i)
+			{
+				const auto x = static_cast<float>(i);
+				values[i] = std::sqrt(std::sin(x) * std::sin(x) + 1.0F);
+			}
+		});
+}
+
+// Streams memory instead, scales until bandwidth runs out
+void copy(moonstone::job_system& scheduler)
+{
+	static std::vector<std::uint32_t> source(1UZ << 24, 1);
+	static std::vector<std::uint32_t> destination(1UZ << 24);
+	scheduler.parallel_for(
+		0, source.size(), 65536, [](std::size_t begin, std::size_t end) {
+			std::copy(source.begin() + static_cast<std::ptrdiff_t>(begin),
+					  source.begin() + static_cast<std::ptrdiff_t>(end),
+					  destination.begin() + static_cast<std::ptrdiff_t>(begin));
+		});
+}
+
+// Many tiny jobs, measures the scheduling overhead itself
+void tiny(moonstone::job_system& scheduler)
+{
+	std::atomic<std::uint64_t> total{0};
+	moonstone::job_counter counter;
+	for (std::uint32_t i = 0; i < 100000; ++i)
+	{
+		scheduler.run(
+			[&total, i] { total.fetch_add(i, std::memory_order_relaxed); },
+			counter);
+	}
+	scheduler.wait(counter);
+}
+
+// Jobs that start their own parallel_for, exercises stealing
+void nested(moonstone::job_system& scheduler)
+{
+	std::atomic<std::uint64_t> total{0};
+	moonstone::job_counter counter;
+	for (std::uint32_t i = 0; i < 256; ++i)
+	{
+		scheduler.run(
+			[&scheduler, &total] {
+				scheduler.parallel_for(
+					0, 4096, 256, [&total](std::size_t begin, std::size_t end) {
+						std::uint64_t sum = 0;
+						for (auto j = begin; j < end; ++j)
+						{
+							sum += j * j;
+						}
+						total.fetch_add(sum, std::memory_order_relaxed);
+					});
+			},
+			counter);
+	}
+	scheduler.wait(counter);
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+	const std::vector<std::string_view> arguments(argv + 1, argv + argc);
+	std::size_t max_threads = std::max(1U, std::thread::hardware_concurrency());
+	int repeats = 5;
+	std::string csv_path;
+	for (std::size_t i = 0; i < arguments.size(); ++i)
+	{
+		const auto argument = arguments[i];
+		const bool has_value = i + 1 < arguments.size();
+		if (argument == "--max-threads" || argument == "--repeats")
+		{
+			const bool parsed =
+				has_value && (argument == "--max-threads"
+								  ? parse_number(arguments[++i], max_threads)
+								  : parse_number(arguments[++i], repeats));
+			if (!parsed || max_threads == 0 || repeats <= 0)
+			{
+				std::println(stderr, "{} needs a positive number", argument);
+				return EXIT_FAILURE;
+			}
+		}
+		else if (argument == "--csv" && has_value)
+		{
+			csv_path = arguments[++i];
+		}
+		else
+		{
+			std::println(stderr,
+						 "usage: job_bench [--max-threads N] [--repeats N] "
+						 "[--csv <path>]");
+			return EXIT_FAILURE;
+		}
+	}
+
+	const std::vector<workload> workloads{{"compute", compute},
+										  {"copy", copy},
+										  {"tiny_jobs", tiny},
+										  {"nested", nested}};
+	std::ofstream csv;
+	if (!csv_path.empty())
+	{
+		csv.open(csv_path, std::ios::trunc);
+		csv << "workload,threads,best_ms,speedup,efficiency,stolen\n";
+	}
+	std::println("{:<10} {:>7} {:>10} {:>8} {:>10} {:>9}",
+				 "workload",
+				 "threads",
+				 "best ms",
+				 "speedup",
+				 "efficiency",
+				 "stolen");
+	for (const auto& [name, run] : workloads)
+	{
+		double single = 0.0;
+		for (std::size_t threads = 1; threads <= max_threads; ++threads)
+		{
+			moonstone::job_system scheduler{threads - 1};
+			scheduler.bind_to_current_thread();
+			// Warm up, first touch of the buffers and waking the workers
+			run(scheduler);
+			double best = 0.0;
+			for (int repeat = 0; repeat < repeats; ++repeat)
+			{
+				const auto start = std::chrono::steady_clock::now();
+				run(scheduler);
+				const std::chrono::duration<double, std::milli> elapsed =
+					std::chrono::steady_clock::now() - start;
+				best = repeat == 0 ? elapsed.count()
+								   : std::min(best, elapsed.count());
+			}
+			if (threads == 1)
+			{
+				single = best;
+			}
+			const auto speedup = single / best;
+			const auto efficiency = speedup / static_cast<double>(threads);
+			const auto stolen = scheduler.get_stats().stolen;
+			std::println("{:<10} {:>7} {:>10.3f} {:>7.2f}x {:>9.0f}% {:>9}",
+						 name,
+						 threads,
+						 best,
+						 speedup,
+						 efficiency * 100.0,
+						 stolen);
+			if (csv.is_open())
+			{
+				csv << std::format("{},{},{:.3f},{:.3f},{:.3f},{}\n",
+								   name,
+								   threads,
+								   best,
+								   speedup,
+								   efficiency,
+								   stolen);
+			}
+		}
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+// Packs asset directories into one archive the file system can mount:
+//   pack <output.pack> <directory>... [--lz4 | --zstd] [--level N] [--align N]
+// Entries are named after the directory, `pack game.pack assets shaders`
+// stores assets/texarr1.png, shaders/shader.vert...
+
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <print>
+#include <string>
+#include <string_view>
+#include <vector>
+
+import moonstone;
+
+namespace
+{
+template <typename T>
+bool parse_number(std::string_view text, T& value)
+{
+	const auto [end, error] =
+		std::from_chars(text.data(), text.data() + text.size(), value);
+	return error == std::errc{} && end == text.data() + text.size();
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+	const std::vector<std::string_view> arguments(argv + 1, argv + argc);
+	std::filesystem::path output;
+	std::vector<std::filesystem::path> directories;
+	auto compression = moonstone::pack_compression::none;
+	int level = 0;
+	std::uint32_t alignment = 64;
+	for (std::size_t i = 0; i < arguments.size(); ++i)
+	{
+		const auto argument = arguments[i];
+		const bool has_value = i + 1 < arguments.size();
+		if (argument == "--lz4")
+		{
+			compression = moonstone::pack_compression::lz4;
+		}
+		else if (argument == "--zstd")
+		{
+			compression = moonstone::pack_compression::zstd;
+		}
+		else if (argument == "--level" || argument == "--align")
+		{
+			const bool parsed =
+				has_value && (argument == "--level"
+								  ? parse_number(arguments[++i], level)
+								  : parse_number(arguments[++i], alignment));
+			if (!parsed || alignment == 0)
+			{
+				std::println(stderr, "{} needs a number", argument);
+				return EXIT_FAILURE;
+			}
+		}
+		else if (argument.starts_with("--"))
+		{
+			std::println(stderr, "unknown option {}", argument);
+			return EXIT_FAILURE;
+		}
+		else if (output.empty())
+		{
+			output = argument;
+		}
+		else
+		{
+			directories.emplace_back(argument);
+		}
+	}
+	if (output.empty() || directories.empty())
+	{
+		std::println(stderr,
+					 "usage: pack <output.pack> <directory>... [--lz4 | "
+					 "--zstd] [--level N] [--align N]");
+		return EXIT_FAILURE;
+	}
+
+	moonstone::pack_writer writer;
+	std::size_t count = 0;
+	for (const auto& directory : directories)
+	{
+		const auto prefix = directory.lexically_normal().filename();
+		for (const auto& file :
+			 std::filesystem::recursive_directory_iterator{directory})
+		{
+			if (!file.is_regular_file())
+			{
+				continue;
+			}
+			auto mapped = moonstone::files().map(file.path().string());
+			if (!mapped.has_value())
+			{
+				std::println(stderr, "{}", mapped.error().format());
+				return EXIT_FAILURE;
+			}
+			const auto name =
+				(prefix / file.path().lexically_relative(directory))
+					.generic_string();
+			writer.add(name, {mapped->bytes().begin(), mapped->bytes().end()});
+			++count;
+		}
+	}
+	const auto written = writer.write(output, compression, level, alignment);
+	if (!written.has_value())
+	{
+		std::println(stderr, "{}", written.error().format());
+		return EXIT_FAILURE;
+	}
+	std::println("{} files, {} bytes -> {}", count, *written, output.string());
+	return EXIT_SUCCESS;
+}